@@ -0,0 +1,761 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "Asm_386.h"
+
+static const char *gp_registers[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+static const char *word_registers[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+static const char *byte_registers[] = { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" };
+//sign and zero extending loads into a 32-bit register, after 0x0F
+struct Extend_Op {
+   const char *name;
+   uint8_t opcode;
+};
+static const Extend_Op extend_ops[] = {
+   { "movzbl", 0xB6 },
+   { "movzwl", 0xB7 },
+   { "movsbl", 0xBE },
+   { "movswl", 0xBF },
+};
+//opcode extension of each ALU instruction, in encoding order
+static const char *alu_ops[] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+static const char *cond_codes[] = { "o", "no", "b", "ae", "e", "ne", "be", "a",
+   "s", "ns", "p", "np", "l", "ge", "le", "g" };
+
+//SSE instructions all take the same shape: an optional prefix, 0x0F, then
+//the opcode with the XMM register in the reg field. store is the opcode
+//for the form that writes its r/m operand, 0 when there is none.
+struct Sse_Op {
+   const char *name;
+   uint8_t prefix;
+   uint8_t load;
+   uint8_t store;
+   bool has_imm;
+};
+
+static const Sse_Op sse_ops[] = {
+   { "movss", 0xF3, 0x10, 0x11, false },
+   { "movups", 0, 0x10, 0x11, false },
+   { "movaps", 0, 0x28, 0x29, false },
+   { "movd", 0x66, 0x6E, 0x7E, false },
+   { "addss", 0xF3, 0x58, 0, false },
+   { "subss", 0xF3, 0x5C, 0, false },
+   { "mulss", 0xF3, 0x59, 0, false },
+   { "addps", 0, 0x58, 0, false },
+   { "mulps", 0, 0x59, 0, false },
+   { "orps", 0, 0x56, 0, false },
+   { "xorps", 0, 0x57, 0, false },
+   { "ucomiss", 0, 0x2E, 0, false },
+   { "paddd", 0x66, 0xFE, 0, false },
+   { "por", 0x66, 0xEB, 0, false },
+   { "shufps", 0, 0xC6, 0, true },
+   { "pshufd", 0x66, 0x70, 0, true },
+};
+
+static std::string trim(const std::string &str) {
+   size_t start = str.find_first_not_of(" \t\r");
+   if (start == std::string::npos) {
+      return "";
+   }
+   size_t end = str.find_last_not_of(" \t\r");
+   return str.substr(start, end - start + 1);
+}
+
+//splits on commas outside of parentheses and quotes
+static std::vector<std::string> split_args(const std::string &str) {
+   std::vector<std::string> args;
+   std::string cur;
+   int depth = 0;
+   bool quoted = false;
+   for (size_t i = 0; i < str.size(); ++i) {
+      char c = str[i];
+      if (quoted) {
+         if (c == '\\' && i + 1 < str.size()) {
+            cur += c;
+            c = str[++i];
+         } else if (c == '"') {
+            quoted = false;
+         }
+      } else if (c == '"') {
+         quoted = true;
+      } else if (c == '(') {
+         depth++;
+      } else if (c == ')') {
+         depth--;
+      } else if (c == ',' && depth == 0) {
+         args.push_back(trim(cur));
+         cur.clear();
+         continue;
+      }
+      cur += c;
+   }
+   if (trim(cur).size()) {
+      args.push_back(trim(cur));
+   }
+   return args;
+}
+
+static bool fits_int8(const Asm_386::Operand &op) {
+   return op.sym.empty() && op.minus.empty() && op.disp >= -128 && op.disp <= 127;
+}
+
+static bool fits_uint8(const Asm_386::Operand &op) {
+   return op.sym.empty() && op.minus.empty() && op.disp >= 0 && op.disp <= 255;
+}
+
+bool Asm_386::fail(const std::string &msg) {
+   error = "line " + std::to_string(line_num) + ": " + msg;
+   return false;
+}
+
+void Asm_386::emit32(int32_t val) {
+   for (int i = 0; i < 4; ++i) {
+      emit8((val >> (8 * i)) & 0xFF);
+   }
+}
+
+//an immediate of an 8 or 16-bit operation, only plain numbers fit those
+void Asm_386::emit_imm(const Operand &op, int size) {
+   if (size == 4) {
+      emit_field(op);
+      return;
+   }
+   emit8(op.disp & 0xFF);
+   if (size == 2) {
+      emit8((op.disp >> 8) & 0xFF);
+   }
+}
+
+//a 32-bit displacement or immediate, resolved once every label is known
+void Asm_386::emit_field(const Operand &op, bool pcrel) {
+   if (op.sym.size() || op.minus.size()) {
+      fixups.push_back(Fixup{section, (uint32_t)text().size(), op.sym, op.minus, pcrel});
+   }
+   emit32(op.disp);
+}
+
+void Asm_386::emit_modrm(int reg_field, const Operand &rm) {
+   if (rm.kind == Operand::REG || rm.kind == Operand::XMM) {
+      emit8(0xC0 | (reg_field << 3) | rm.reg);
+      return;
+   }
+   if (rm.base < 0) {
+      emit8(0x05 | (reg_field << 3));
+      emit_field(rm);
+      return;
+   }
+   int mod = 0;
+   if (!fits_int8(rm)) {
+      mod = 2;
+   } else if (rm.disp != 0 || rm.base == 5) {
+      //%ebp with no displacement is the encoding for an absolute address
+      mod = 1;
+   }
+   emit8((mod << 6) | (reg_field << 3) | rm.base);
+   if (rm.base == 4) {
+      emit8(0x24); //%esp as a base needs a SIB byte
+   }
+   if (mod == 1) {
+      emit8(rm.disp & 0xFF);
+   } else if (mod == 2) {
+      emit_field(rm);
+   }
+}
+
+void Asm_386::switch_section(const std::string &name, uint32_t flags, uint32_t type, uint32_t entsize) {
+   section = obj.get_section(name);
+   if (section >= 0) {
+      return;
+   }
+   Elf_Section sec;
+   sec.name = name;
+   sec.flags = flags;
+   sec.type = type;
+   sec.entsize = entsize;
+   obj.sections.push_back(sec);
+   section = obj.sections.size() - 1;
+}
+
+bool Asm_386::assemble(const std::string &src) {
+   switch_section(".text", ELF_SHF_ALLOC | ELF_SHF_EXECINSTR);
+   size_t pos = 0;
+   while (pos < src.size()) {
+      size_t end = src.find('\n', pos);
+      if (end == std::string::npos) {
+         end = src.size();
+      }
+      line_num++;
+      if (!parse_line(src.substr(pos, end - pos))) {
+         return false;
+      }
+      pos = end + 1;
+   }
+   return resolve_fixups();
+}
+
+bool Asm_386::parse_line(std::string line) {
+   line = trim(line);
+   if (line.empty()) {
+      return true;
+   }
+   if (line.back() == ':' && line.find_first_of(" \t\"") == std::string::npos) {
+      Elf_Symbol &sym = obj.symbols[obj.get_symbol(line.substr(0, line.size() - 1))];
+      if (sym.section >= 0) {
+         return fail("symbol '" + sym.name + "' is already defined");
+      }
+      Elf_Section &sec = obj.sections[section];
+      sym.section = section;
+      sym.value = (sec.type == ELF_SHT_NOBITS ? sec.nobits_size : sec.data.size());
+      return true;
+   }
+   size_t split = line.find_first_of(" \t");
+   std::string name = line.substr(0, split);
+   std::string args = (split == std::string::npos ? "" : trim(line.substr(split)));
+   if (name[0] == '.') {
+      return parse_directive(name, args);
+   }
+   std::vector<Operand> ops;
+   for (auto &arg : split_args(args)) {
+      Operand op;
+      if (!parse_operand(arg, op)) {
+         return false;
+      }
+      ops.push_back(op);
+   }
+   return encode(name, ops);
+}
+
+bool Asm_386::parse_directive(const std::string &name, const std::string &args) {
+   if (name.compare(".text") == 0) {
+      switch_section(".text", ELF_SHF_ALLOC | ELF_SHF_EXECINSTR);
+   } else if (name.compare(".data") == 0) {
+      switch_section(".data", ELF_SHF_ALLOC | ELF_SHF_WRITE);
+   } else if (name.compare(".bss") == 0) {
+      switch_section(".bss", ELF_SHF_ALLOC | ELF_SHF_WRITE, ELF_SHT_NOBITS);
+   } else if (name.compare(".section") == 0) {
+      std::vector<std::string> parts = split_args(args);
+      if (parts.empty()) {
+         return fail(".section needs a name");
+      }
+      std::string &sec = parts[0];
+      uint32_t flags = 0;
+      uint32_t type = ELF_SHT_PROGBITS;
+      uint32_t entsize = 0;
+      if (parts.size() > 1) {
+         for (char c : parts[1]) {
+            if (c == 'a') flags |= ELF_SHF_ALLOC;
+            else if (c == 'w') flags |= ELF_SHF_WRITE;
+            else if (c == 'x') flags |= ELF_SHF_EXECINSTR;
+            else if (c == 'M') flags |= ELF_SHF_MERGE;
+            else if (c == 'S') flags |= ELF_SHF_STRINGS;
+            else if (c != '"') return fail("unknown section flag '" + std::string(1, c) + "'");
+         }
+      } else if (sec.compare(0, 5, ".text") == 0) {
+         flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR;
+      } else if (sec.compare(0, 7, ".rodata") == 0) {
+         flags = ELF_SHF_ALLOC;
+      } else if (sec.compare(0, 5, ".data") == 0 || sec.compare(0, 4, ".bss") == 0) {
+         flags = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+      }
+      if (parts.size() > 2 && parts[2].compare(1, std::string::npos, "nobits") == 0) {
+         type = ELF_SHT_NOBITS;
+      } else if (parts.size() <= 2 && sec.compare(0, 4, ".bss") == 0) {
+         type = ELF_SHT_NOBITS;
+      }
+      if (parts.size() > 3) {
+         entsize = strtol(parts[3].c_str(), nullptr, 0);
+      }
+      switch_section(sec, flags, type, entsize);
+   } else if (name.compare(".globl") == 0 || name.compare(".global") == 0) {
+      obj.symbols[obj.get_symbol(args)].global = true;
+   } else if (name.compare(".p2align") == 0) {
+      uint32_t align = 1 << strtol(args.c_str(), nullptr, 0);
+      Elf_Section &sec = obj.sections[section];
+      if (sec.align < align) {
+         sec.align = align;
+      }
+      if (sec.type == ELF_SHT_NOBITS) {
+         sec.nobits_size = (sec.nobits_size + align - 1) & ~(align - 1);
+      }
+      while (sec.data.size() % align) {
+         sec.data.push_back(sec.flags & ELF_SHF_EXECINSTR ? 0x90 : 0); //nop
+      }
+   } else if (name.compare(".zero") == 0) {
+      int32_t size = strtol(args.c_str(), nullptr, 0);
+      Elf_Section &sec = obj.sections[section];
+      if (sec.type == ELF_SHT_NOBITS) {
+         sec.nobits_size += size;
+      } else {
+         sec.data.insert(sec.data.end(), size, 0);
+      }
+   } else if (name.compare(".long") == 0) {
+      for (auto &arg : split_args(args)) {
+         Operand op;
+         if (!parse_expression(arg, op)) {
+            return false;
+         }
+         emit_field(op);
+      }
+   } else if (name.compare(".byte") == 0 || name.compare(".short") == 0) {
+      for (auto &arg : split_args(args)) {
+         Operand op;
+         if (!parse_expression(arg, op)) {
+            return false;
+         }
+         if (op.sym.size() || op.minus.size()) {
+            return fail(name + " only takes numbers");
+         }
+         emit_imm(op, name.compare(".byte") == 0 ? 1 : 2);
+      }
+   } else if (name.compare(".quad") == 0) {
+      //numbers only, a 64-bit address has no relocation in ELF32
+      for (auto &arg : split_args(args)) {
+         char *end;
+         long long val = strtoll(arg.c_str(), &end, 0);
+         if (*end) {
+            return fail(".quad only takes numbers");
+         }
+         emit32((int32_t)val);
+         emit32((int32_t)(val >> 32));
+      }
+   } else if (name.compare(".ascii") == 0 || name.compare(".asciz") == 0) {
+      if (!parse_string(args, text())) {
+         return false;
+      }
+      if (name.compare(".asciz") == 0) {
+         emit8(0);
+      }
+   } else if (name.compare(".ident") == 0) {
+      //as puts these in .comment, after an empty string
+      int prev = section;
+      bool first = obj.get_section(".comment") < 0;
+      switch_section(".comment", ELF_SHF_MERGE | ELF_SHF_STRINGS, ELF_SHT_PROGBITS, 1);
+      if (first) {
+         emit8(0);
+      }
+      bool ok = parse_string(args, text());
+      emit8(0);
+      section = prev;
+      return ok;
+   } else {
+      return fail("unsupported directive " + name);
+   }
+   return true;
+}
+
+bool Asm_386::parse_string(const std::string &str, std::vector<uint8_t> &out) {
+   if (str.size() < 2 || str.front() != '"' || str.back() != '"') {
+      return fail("expected a string");
+   }
+   for (size_t i = 1; i + 1 < str.size(); ++i) {
+      char c = str[i];
+      if (c != '\\') {
+         out.push_back(c);
+         continue;
+      }
+      c = str[++i];
+      if (c >= '0' && c <= '7') {
+         int val = 0;
+         for (int n = 0; n < 3 && str[i] >= '0' && str[i] <= '7'; ++n, ++i) {
+            val = val * 8 + (str[i] - '0');
+         }
+         --i;
+         out.push_back(val);
+      } else if (c == 'n') {
+         out.push_back('\n');
+      } else if (c == 't') {
+         out.push_back('\t');
+      } else if (c == 'r') {
+         out.push_back('\r');
+      } else {
+         out.push_back(c);
+      }
+   }
+   return true;
+}
+
+//numbers and at most one symbol added and one subtracted, `Lstr0 - L0$pb0`
+bool Asm_386::parse_expression(std::string str, Operand &op) {
+   size_t i = 0;
+   bool negative = false;
+   while (i < str.size()) {
+      char c = str[i];
+      if (c == ' ' || c == '\t' || c == '+') {
+         ++i;
+         continue;
+      }
+      if (c == '-') {
+         negative = !negative;
+         ++i;
+         continue;
+      }
+      size_t end = i;
+      while (end < str.size() && (isalnum(str[end]) || str[end] == '_' || str[end] == '$' || str[end] == '.')) {
+         ++end;
+      }
+      if (end == i) {
+         return fail("can't parse expression '" + str + "'");
+      }
+      std::string term = str.substr(i, end - i);
+      if (isdigit(term[0])) {
+         char *term_end;
+         int32_t val = strtoll(term.c_str(), &term_end, 0);
+         if (*term_end) {
+            return fail("bad number '" + term + "'");
+         }
+         op.disp += (negative ? -val : val);
+      } else if (!negative && op.sym.empty()) {
+         op.sym = term;
+      } else if (negative && op.minus.empty()) {
+         op.minus = term;
+      } else {
+         return fail("expression '" + str + "' is too complex");
+      }
+      negative = false;
+      i = end;
+   }
+   return true;
+}
+
+bool Asm_386::parse_operand(std::string str, Operand &op) {
+   if (str[0] == '%') {
+      std::string reg = str.substr(1);
+      if (reg.compare(0, 2, "st") == 0) {
+         op.kind = Operand::ST;
+         op.reg = (reg.size() > 2 ? strtol(reg.c_str() + 3, nullptr, 10) : 0);
+         return true;
+      }
+      if (reg.compare(0, 3, "xmm") == 0 && reg.size() == 4 && reg[3] >= '0' && reg[3] <= '7') {
+         op.kind = Operand::XMM;
+         op.reg = reg[3] - '0';
+         return true;
+      }
+      for (int i = 0; i < 8; ++i) {
+         int size = 0;
+         if (reg.compare(gp_registers[i]) == 0) {
+            size = 4;
+         } else if (reg.compare(word_registers[i]) == 0) {
+            size = 2;
+         } else if (reg.compare(byte_registers[i]) == 0) {
+            size = 1;
+         }
+         if (size) {
+            op.kind = Operand::REG;
+            op.reg = i;
+            op.size = size;
+            return true;
+         }
+      }
+      return fail("unknown register " + str);
+   }
+   if (str[0] == '$') {
+      op.kind = Operand::IMM;
+      return parse_expression(str.substr(1), op);
+   }
+   op.kind = Operand::MEM;
+   size_t paren = str.find('(');
+   if (paren == std::string::npos) {
+      return parse_expression(str, op);
+   }
+   std::string base = trim(str.substr(paren + 1, str.find(')') - paren - 1));
+   Operand reg;
+   if (!parse_operand(base, reg) || reg.kind != Operand::REG) {
+      return fail("unsupported address " + str);
+   }
+   op.base = reg.reg;
+   return parse_expression(str.substr(0, paren), op);
+}
+
+bool Asm_386::encode_sse(const std::string &mnemonic, std::vector<Operand> &ops) {
+   const Sse_Op *sse = nullptr;
+   for (auto &entry : sse_ops) {
+      if (mnemonic.compare(entry.name) == 0) {
+         sse = &entry;
+      }
+   }
+   size_t n = ops.size();
+   Operand &src = ops[n - 2];
+   Operand &dst = ops[n - 1];
+   bool is_movd = sse->store == 0x7E;
+   bool src_ok = src.kind == Operand::XMM || src.kind == Operand::MEM || (is_movd && src.kind == Operand::REG);
+   bool dst_ok = dst.kind == Operand::MEM || (is_movd && dst.kind == Operand::REG);
+   if (n != (sse->has_imm ? 3u : 2u) || (sse->has_imm && (ops[0].kind != Operand::IMM || !fits_uint8(ops[0])))) {
+      return fail("bad operands for " + mnemonic);
+   }
+   if (sse->prefix) {
+      emit8(sse->prefix);
+   }
+   emit8(0x0F);
+   if (dst.kind == Operand::XMM && src_ok) {
+      emit8(sse->load);
+      emit_modrm(dst.reg, src);
+   } else if (src.kind == Operand::XMM && sse->store && dst_ok) {
+      emit8(sse->store);
+      emit_modrm(src.reg, dst);
+   } else {
+      return fail("bad operands for " + mnemonic);
+   }
+   if (sse->has_imm) {
+      emit8(ops[0].disp & 0xFF);
+   }
+   return true;
+}
+
+bool Asm_386::encode(std::string m, std::vector<Operand> &ops) {
+   size_t n = ops.size();
+   if (m.compare("ret") == 0 && n == 0) {
+      emit8(0xC3);
+      return true;
+   }
+   if (m.compare("int") == 0 && n == 1 && ops[0].kind == Operand::IMM && fits_uint8(ops[0])) {
+      emit8(0xCD);
+      emit8(ops[0].disp & 0xFF);
+      return true;
+   }
+   //direct branches are always rel32, the field is relative to the next instruction
+   bool is_jcc = false;
+   int cc = 0;
+   for (; m[0] == 'j' && cc < 16; ++cc) {
+      if (m.compare(1, std::string::npos, cond_codes[cc]) == 0) {
+         is_jcc = true;
+         break;
+      }
+   }
+   if (m.compare("call") == 0 || m.compare("jmp") == 0 || is_jcc) {
+      if (n != 1 || ops[0].kind != Operand::MEM || ops[0].base >= 0 || ops[0].sym.empty() || ops[0].minus.size()) {
+         return fail("only direct branches are supported");
+      }
+      if (is_jcc) {
+         emit8(0x0F);
+         emit8(0x80 + cc);
+      } else {
+         emit8(m[0] == 'c' ? 0xE8 : 0xE9);
+      }
+      Operand target = ops[0];
+      target.disp -= 4;
+      emit_field(target, true);
+      return true;
+   }
+   if (m.compare("fstp") == 0 && n == 1 && ops[0].kind == Operand::ST) {
+      emit8(0xDD);
+      emit8(0xD8 + ops[0].reg);
+      return true;
+   }
+   if ((m.compare("flds") == 0 || m.compare("fstps") == 0) && n == 1 && ops[0].kind == Operand::MEM) {
+      emit8(0xD9);
+      emit_modrm(m.compare("flds") == 0 ? 0 : 3, ops[0]);
+      return true;
+   }
+   for (auto &entry : sse_ops) {
+      if (m.compare(entry.name) == 0) {
+         return n >= 2 && encode_sse(m, ops);
+      }
+   }
+
+   for (auto &op : ops) {
+      if (op.kind == Operand::XMM || op.kind == Operand::ST) {
+         return fail("bad operands for " + m);
+      }
+   }
+   if (m.compare("cltd") == 0 && n == 0) {
+      emit8(0x99);
+      return true;
+   }
+   for (auto &ext : extend_ops) {
+      if (m.compare(ext.name) == 0) {
+         if (n != 2 || ops[0].kind == Operand::IMM || ops[1].kind != Operand::REG || ops[1].size != 4
+            || (ops[0].kind == Operand::REG && ops[0].size != (m[4] == 'b' ? 1 : 2))) {
+            return fail("bad operands for " + m);
+         }
+         emit8(0x0F);
+         emit8(ext.opcode);
+         emit_modrm(ops[1].reg, ops[0]);
+         return true;
+      }
+   }
+
+   //integer instructions, with or without the size suffix, otherwise sized
+   //by their register operands
+   static const char *sized_ops[] = { "mov", "push", "pop", "imul", "mul", "lea" };
+   bool known = false;
+   for (int i = 0; i < 8; ++i) {
+      known = known || m.compare(alu_ops[i]) == 0 || (i < 6 && m.compare(sized_ops[i]) == 0);
+   }
+   int size = 0;
+   if (!known && m.size() > 2) {
+      char suffix = m.back();
+      size = (suffix == 'b' ? 1 : (suffix == 'w' ? 2 : (suffix == 'l' ? 4 : 0)));
+      if (size) {
+         m.pop_back();
+      }
+   }
+   for (auto &op : ops) {
+      if (op.kind == Operand::REG) {
+         if (size && op.size != size && m.compare("lea") != 0) {
+            return fail("operand size mismatch for " + m);
+         }
+         size = op.size;
+      }
+   }
+   if (!size) {
+      size = 4;
+   }
+   if (size != 4 && (m.compare("push") == 0 || m.compare("pop") == 0 || m.compare("imul") == 0
+      || m.compare("mul") == 0 || m.compare("lea") == 0)) {
+      return fail("only 32-bit " + m + " is supported");
+   }
+   if (size == 2) {
+      emit8(0x66);
+   }
+   if (n == 1 && m.compare("mul") == 0 && ops[0].kind != Operand::IMM) {
+      emit8(0xF7);
+      emit_modrm(4, ops[0]);
+      return true;
+   }
+   if (n == 1 && m.compare("push") == 0) {
+      if (ops[0].kind == Operand::REG) {
+         emit8(0x50 + ops[0].reg);
+      } else if (ops[0].kind == Operand::IMM && fits_int8(ops[0])) {
+         emit8(0x6A);
+         emit8(ops[0].disp & 0xFF);
+      } else if (ops[0].kind == Operand::IMM) {
+         emit8(0x68);
+         emit_field(ops[0]);
+      } else {
+         emit8(0xFF);
+         emit_modrm(6, ops[0]);
+      }
+      return true;
+   }
+   if (n == 1 && m.compare("pop") == 0 && ops[0].kind != Operand::IMM) {
+      if (ops[0].kind == Operand::REG) {
+         emit8(0x58 + ops[0].reg);
+      } else {
+         emit8(0x8F);
+         emit_modrm(0, ops[0]);
+      }
+      return true;
+   }
+   if (n != 2) {
+      return fail("no encoding for " + m);
+   }
+   Operand &src = ops[0];
+   Operand &dst = ops[1];
+   if (dst.kind == Operand::IMM || (src.kind == Operand::MEM && dst.kind == Operand::MEM)) {
+      return fail("bad operands for " + m);
+   }
+   //byte operations use the opcode one below the 16 and 32-bit one
+   int wide = (size == 1 ? 0 : 1);
+   if (size != 4 && src.kind == Operand::IMM && (src.sym.size() || src.minus.size())) {
+      return fail("bad operands for " + m);
+   }
+   if (m.compare("mov") == 0) {
+      if (src.kind == Operand::IMM && dst.kind == Operand::REG) {
+         emit8((size == 1 ? 0xB0 : 0xB8) + dst.reg);
+         emit_imm(src, size);
+      } else if (src.kind == Operand::IMM) {
+         emit8(0xC6 + wide);
+         emit_modrm(0, dst);
+         emit_imm(src, size);
+      } else if (src.kind == Operand::REG) {
+         emit8(0x88 + wide);
+         emit_modrm(src.reg, dst);
+      } else {
+         emit8(0x8A + wide);
+         emit_modrm(dst.reg, src);
+      }
+      return true;
+   }
+   for (int i = 0; i < 8; ++i) {
+      if (m.compare(alu_ops[i]) != 0) {
+         continue;
+      }
+      if (src.kind == Operand::IMM && size == 1) {
+         emit8(0x80);
+         emit_modrm(i, dst);
+         emit8(src.disp & 0xFF);
+      } else if (src.kind == Operand::IMM) {
+         emit8(fits_int8(src) ? 0x83 : 0x81);
+         emit_modrm(i, dst);
+         if (fits_int8(src)) {
+            emit8(src.disp & 0xFF);
+         } else {
+            emit_imm(src, size);
+         }
+      } else if (src.kind == Operand::REG) {
+         emit8(i * 8 + wide);
+         emit_modrm(src.reg, dst);
+      } else {
+         emit8(i * 8 + 2 + wide);
+         emit_modrm(dst.reg, src);
+      }
+      return true;
+   }
+   if (m.compare("imul") == 0 && dst.kind == Operand::REG) {
+      if (src.kind == Operand::IMM) {
+         emit8(fits_int8(src) ? 0x6B : 0x69);
+         emit_modrm(dst.reg, dst);
+         if (fits_int8(src)) {
+            emit8(src.disp & 0xFF);
+         } else {
+            emit_field(src);
+         }
+      } else {
+         emit8(0x0F);
+         emit8(0xAF);
+         emit_modrm(dst.reg, src);
+      }
+      return true;
+   }
+   if (m.compare("lea") == 0 && src.kind == Operand::MEM && dst.kind == Operand::REG) {
+      emit8(0x8D);
+      emit_modrm(dst.reg, src);
+      return true;
+   }
+   return fail("no encoding for " + m);
+}
+
+//Branches to local labels in the same section and differences within one
+//section are filled in here, everything else becomes a relocation against
+//the symbol with the addend left in the field. `sym - label` with the label
+//in this section is the PIC idiom, sym + (P - label) relative to P.
+bool Asm_386::resolve_fixups() {
+   for (auto &f : fixups) {
+      Elf_Section &sec = obj.sections[f.section];
+      uint8_t *field = &sec.data[f.offset];
+      int32_t value = elf_get32(field);
+      uint8_t type = (f.pcrel ? ELF_R_386_PC32 : ELF_R_386_32);
+      if (f.minus.size()) {
+         auto minus = obj.symbol_index.find(f.minus);
+         if (f.sym.empty() || minus == obj.symbol_index.end() || obj.symbols[minus->second].section != f.section) {
+            return fail("can't subtract '" + f.minus + "' here");
+         }
+         value -= obj.symbols[minus->second].value;
+         const Elf_Symbol &sym = obj.symbols[obj.get_symbol(f.sym)];
+         if (sym.section == f.section) {
+            value += sym.value;
+            f.sym.clear();
+         } else {
+            value += f.offset;
+            type = ELF_R_386_PC32;
+         }
+      } else if (f.pcrel) {
+         const Elf_Symbol &sym = obj.symbols[obj.get_symbol(f.sym)];
+         if (sym.section == f.section && !sym.global) {
+            value += sym.value - f.offset;
+            f.sym.clear();
+         }
+      }
+      elf_set32(field, value);
+      if (f.sym.size()) {
+         sec.relocs.push_back(Elf_Reloc{f.offset, obj.get_symbol(f.sym), type});
+      }
+   }
+   //whatever is still undefined comes from another object
+   for (auto &sym : obj.symbols) {
+      if (sym.section == ELF_SECTION_UNDEF) {
+         sym.global = true;
+      }
+   }
+   return true;
+}
@@ -0,0 +1,62 @@
+
+#ifndef ASM_386_H
+#define ASM_386_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Elf_Writer.h"
+
+//The built-in assembler, for the AT&T subset Gen_386 writes and the
+//directives around it. Anything else, typically an __asm__ line it has no
+//encoding for, fails the whole file so the caller can hand it to as instead.
+struct Asm_386 {
+
+   struct Operand {
+      enum Kind { REG, XMM, ST, IMM, MEM } kind = MEM;
+      int reg = 0;
+      int size = 4; //of a register, in bytes
+      int base = -1; //-1 for an absolute address
+      int32_t disp = 0;
+      std::string sym; //disp is relative to sym, minus the address of minus
+      std::string minus;
+   };
+
+   //a field that can only be filled in once every label is known
+   struct Fixup {
+      int section;
+      uint32_t offset;
+      std::string sym;
+      std::string minus;
+      bool pcrel;
+   };
+
+   Elf_Object obj;
+   int section = -1;
+   std::vector<Fixup> fixups;
+   std::string error;
+   int line_num = 0;
+
+   bool assemble(const std::string &src);
+
+   bool fail(const std::string &msg);
+   std::vector<uint8_t> &text() { return obj.sections[section].data; }
+   void emit8(uint8_t val) { text().push_back(val); }
+   void emit32(int32_t val);
+   void emit_imm(const Operand &op, int size);
+   void emit_field(const Operand &op, bool pcrel = false);
+   void emit_modrm(int reg_field, const Operand &rm);
+   void switch_section(const std::string &name, uint32_t flags, uint32_t type = ELF_SHT_PROGBITS, uint32_t entsize = 0);
+
+   bool parse_line(std::string line);
+   bool parse_directive(const std::string &name, const std::string &args);
+   bool parse_operand(std::string str, Operand &op);
+   bool parse_expression(std::string str, Operand &op);
+   bool parse_string(const std::string &str, std::vector<uint8_t> &out);
+   bool encode(std::string mnemonic, std::vector<Operand> &ops);
+   bool encode_sse(const std::string &mnemonic, std::vector<Operand> &ops);
+   bool resolve_fixups();
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "Asm_Buf.h"
+
+void Asm_Buf::flush() {
+   if (data.size() > 0) {
+      out->sputn(data.data(), data.size());
+      data.clear();
+   }
+}
+
+void Asm_Buf::put_uint(unsigned long long value) {
+   char digits[20];
+   int n = 0;
+   do {
+      digits[n++] = '0' + value % 10;
+      value /= 10;
+   } while (value);
+   while (n > 0) {
+      data.push_back(digits[--n]);
+   }
+}
+
+void Asm_Buf::put_int(long long value) {
+   if (value < 0) {
+      data.push_back('-');
+      put_uint(0ULL - (unsigned long long)value);
+      return;
+   }
+   put_uint(value);
+}
@@ -0,0 +1,59 @@
+
+#ifndef ASM_BUF_H
+#define ASM_BUF_H
+
+#include <string>
+#include <streambuf>
+
+//Where the backends write their assembly. Text and numbers are appended
+//straight into one large buffer, which only goes to the output stream
+//buffer in big pieces once it fills up and when generation is done.
+//There is no std::endl to flush a line at a time.
+struct Asm_Buf {
+   static const size_t FLUSH_SIZE = 1 << 20;
+
+   std::streambuf *out;
+   std::string data;
+
+   Asm_Buf(std::streambuf *out) : out(out) {
+      data.reserve(FLUSH_SIZE + 4096);
+   }
+
+   ~Asm_Buf() {
+      flush();
+   }
+
+   void flush();
+   void put_int(long long value);
+   void put_uint(unsigned long long value);
+
+   Asm_Buf &operator<<(const std::string &s) {
+      data.append(s);
+      if (data.size() >= FLUSH_SIZE) {
+         flush();
+      }
+      return *this;
+   }
+
+   Asm_Buf &operator<<(const char *s) {
+      data.append(s);
+      if (data.size() >= FLUSH_SIZE) {
+         flush();
+      }
+      return *this;
+   }
+
+   Asm_Buf &operator<<(char c) {
+      data.push_back(c);
+      return *this;
+   }
+
+   Asm_Buf &operator<<(int value) { put_int(value); return *this; }
+   Asm_Buf &operator<<(long value) { put_int(value); return *this; }
+   Asm_Buf &operator<<(long long value) { put_int(value); return *this; }
+   Asm_Buf &operator<<(unsigned int value) { put_uint(value); return *this; }
+   Asm_Buf &operator<<(unsigned long value) { put_uint(value); return *this; }
+   Asm_Buf &operator<<(unsigned long long value) { put_uint(value); return *this; }
+};
+
+#endif
@@ -1,5 +1,9 @@
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
 
 #include "Code_Gen.h"
 
@@ -15,17 +19,246 @@ Variable create_const_int32(int value) {
    return var;
 }
 
+Variable create_const_float32(float value) {
+   Variable var;
+   var.type = Variable::FLOAT_32BIT;
+   var.fvalue = value;
+   var.is_type_const = true;
+   return var;
+}
+
+int get_float_bits(float value) {
+   int bits;
+   memcpy(&bits, &value, sizeof(bits));
+   return bits;
+}
+
+//32-bit argument words taken by the first n arguments of a function with
+//these parameters, two for a 64-bit one
+int get_arg_words(const std::vector<Variable> &params, size_t n) {
+   int words = 0;
+   for (size_t i = 0; i < n; ++i) {
+      words += i < params.size() && params[i].type == Variable::INT_64BIT ? 2 : 1;
+   }
+   return words;
+}
+
 //RULE: if a variable is named usings special register strings found in Code_Gen.h
 // all other variable data is ignored.
 Variable create_register(std::string reg_name) {
    Variable var;
    var.name = reg_name;
+   var.type = Variable::UNKNOWN;
+   return var;
+}
+
+//the same bits in every lane
+Variable create_const_splat(Variable::VType type, int32_t bits) {
+   Variable var;
+   var.type = type;
+   for (auto &lane : var.lanes) {
+      lane = bits;
+   }
+   var.is_type_const = true;
    return var;
 }
 
+//returns the register Reg_Alloc assigned to var in the current scope, if any
+const Variable *StackMan::
+get_register(Variable var) {
+   if (!scope) {
+      return nullptr;
+   }
+   return code_gen->reg_alloc.get_register(var.name, scope, *code_gen);
+}
+
+//Blocks don't move the stack pointer, their variables are part of the frame
+//of the function around them.
+Scope *StackMan::
+get_frame_scope(Scope &scope) {
+   if (code_gen->current_function) {
+      return code_gen->current_function->scope;
+   }
+   Scope *sc = &scope;
+   while (!is_frame_scope(*sc)) {
+      sc = sc->parent;
+   }
+   return sc;
+}
+
+struct Stack_Item {
+   Scope *scope;
+   size_t var;
+   int start;
+   int end;
+   int size;
+   int align;
+   int offset;
+};
+
+static void collect_stack_items(Scope &scope, StackMan &stack_man, std::vector<Stack_Item> &items) {
+   Reg_Alloc &reg_alloc = stack_man.code_gen->reg_alloc;
+   auto range = reg_alloc.scope_ranges.find(&scope);
+   for (size_t i = 0; i < scope.variables.size(); ++i) {
+      Variable &var = scope.variables[i];
+      if (var.is_type_const) {
+         continue; //constants are immediates and take no room
+      }
+      Stack_Item item = { &scope, i, 0, INT_MAX, stack_man.get_var_size(var), stack_man.get_var_align(var), -1 };
+      Live_Interval *li = reg_alloc.find_interval(var.name, &scope);
+      if (li) {
+         if (li->reg >= 0) {
+            continue;
+         }
+         item.start = li->start;
+         item.end = li->end;
+      } else if (range != reg_alloc.scope_ranges.end()) {
+         item.start = range->second.start;
+         item.end = range->second.end;
+      }
+      items.push_back(item);
+   }
+   for (auto &expr : scope.expressions) {
+      collect_stack_items(*expr.scope, stack_man, items);
+   }
+}
+
+//Stack slot coloring: locals whose lifetimes don't overlap share space, so
+//sibling blocks and values that are dead by the time another is defined take
+//no extra room. Lifetimes are Reg_Alloc's live intervals, anything it doesn't
+//track, like vectors, lives over its whole scope. Variables that got a
+//register have no slot at all. Offsets count down from the top of the frame
+//and each variable's address is a multiple of its alignment, so narrow
+//values pack into the gaps between wider ones.
+void StackMan::
+color_slots(Scope &frame_scope) {
+   std::vector<Stack_Item> items;
+   collect_stack_items(frame_scope, *this, items);
+   std::stable_sort(items.begin(), items.end(), [](const Stack_Item &a, const Stack_Item &b) {
+      return a.start < b.start;
+   });
+
+   int total = 0;
+   for (size_t n = 0; n < items.size(); ++n) {
+      Stack_Item &cur = items[n];
+      //first fit, past every placed item that is live at the same time
+      int offset = 0;
+      bool moved = true;
+      while (moved) {
+         moved = false;
+         offset = (offset + cur.size + cur.align - 1) / cur.align * cur.align - cur.size;
+         for (size_t p = 0; p < n; ++p) {
+            Stack_Item &other = items[p];
+            bool live = cur.start <= other.end && other.start <= cur.end;
+            if (live && offset < other.offset + other.size && other.offset < offset + cur.size) {
+               offset = other.offset + other.size;
+               moved = true;
+               break;
+            }
+         }
+      }
+      cur.offset = offset;
+      total = std::max(total, offset + cur.size);
+   }
+
+   for (auto &item : items) {
+      std::vector<int> &offsets = var_slots[item.scope];
+      offsets.resize(item.scope->variables.size(), -1);
+      offsets[item.var] = item.offset;
+   }
+   frame_bytes[&frame_scope] = (total + slot_size - 1) / slot_size * slot_size;
+}
+
+//bytes the variables of a function's blocks take, in whole slots
+int StackMan::
+get_frame_bytes(Scope &scope) {
+   auto found = frame_bytes.find(&scope);
+   if (found == frame_bytes.end()) {
+      color_slots(scope);
+      found = frame_bytes.find(&scope);
+   }
+   return found->second;
+}
+
+void StackMan::
+clear_layout() {
+   frame_layout.clear();
+   var_slots.clear();
+   frame_bytes.clear();
+}
+
+//The inner scope's name wins over an outer one, parameters over both.
+std::unordered_map<std::string, StackMan::Frame_Slot> &StackMan::
+get_frame_layout(Scope &scope) {
+   auto found = frame_layout.find(&scope);
+   if (found != frame_layout.end()) {
+      return found->second;
+   }
+   std::unordered_map<std::string, Frame_Slot> &layout = frame_layout[&scope];
+   Scope *frame_scope = get_frame_scope(scope);
+   int frame_size = code_gen->get_frame_size(*frame_scope);
+   for (Scope *sc = &scope; sc; sc = sc->parent) {
+      std::vector<int> &offsets = var_slots[sc];
+      for (size_t i = 0; i < offsets.size(); ++i) {
+         Variable &var = sc->variables[i];
+         if (offsets[i] >= 0) {
+            int top = offsets[i] + get_var_size(var);
+            layout.insert({ var.name, { frame_size - top, false, false, var.type } });
+         }
+      }
+      if (sc == frame_scope) {
+         break;
+      }
+   }
+   for (size_t i = params.size(); i-- > 0;) {
+      layout[params[i].name] = get_param_slot(i, scope);
+   }
+   return layout;
+}
+
+//the stack slot of a variable, nullptr when it is in a register or not on the stack
+const StackMan::Frame_Slot *StackMan::
+find_slot(Variable var) {
+   if (!scope || get_register(var)) {
+      return nullptr;
+   }
+   std::unordered_map<std::string, Frame_Slot> &layout = get_frame_layout(*scope);
+   auto found = layout.find(var.name);
+   return found == layout.end() ? nullptr : &found->second;
+}
+
+std::string StackMan::
+load_var(Variable var) {
+   int adjust = ext_adj;
+   ext_adj = 0;
+   const Variable *reg = get_register(var);
+   if (reg) {
+      return code_gen->gen_var(*reg);
+   }
+   if (!scope) {
+      return "";
+   }
+   std::unordered_map<std::string, Frame_Slot> &layout = get_frame_layout(*scope);
+   auto found = layout.find(var.name);
+   if (found == layout.end()) {
+      //not a local or a parameter, it may still be a global, addressed off
+      //a PIC base that can be on the stack too
+      ext_adj = adjust;
+      std::string global = code_gen->get_global(var) ? code_gen->gen_global(var) : "";
+      ext_adj = 0;
+      return global;
+   }
+   Frame_Slot slot = found->second;
+   if (!slot.frame_based) {
+      slot.offset += adjust;
+   }
+   slot.offset += var.offset;
+   return format_slot(slot);
+}
+
 
 void Code_Gen::
-gen_func_params(std::vector<Variable> &plist) {
+gen_func_params(Function &func, std::vector<Variable> &plist) {
    if (plist.size() < 1) {
       printf("Plist empty\n");
       return;
@@ -50,16 +283,119 @@ gen_func_params(std::vector<Variable> &plist) {
    stack_man->ext_adj = 0;
 }
 
+//a call is in tail position when the only thing left to do is return its result
+static bool is_tail_call(Expression &expr, size_t n) {
+   if (n + 2 != expr.instructions.size()) {
+      return false;
+   }
+   Instruction &ret = expr.instructions[n + 1];
+   return ret.type == Instruction::ASSIGN && ret.lvalue_data.name.compare("return") == 0
+      && ret.rvalue_data.name.compare(REGISTER_RETURN) == 0;
+}
+
+static bool has_self_tail_call(Function &func, Scope &scope) {
+   for (auto &expr : scope.expressions) {
+      for (size_t n = 0; n < expr.instructions.size(); ++n) {
+         Instruction &instr = expr.instructions[n];
+         if (instr.type == Instruction::FUNC_CALL && instr.func_call_name.compare(func.name) == 0
+            && is_tail_call(expr, n)) {
+            return true;
+         }
+      }
+      if (has_self_tail_call(func, *expr.scope)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+//with frame pointer omission everything is addressed off the stack pointer,
+//unless inline asm in the function refers to the frame pointer itself
+bool Code_Gen::
+uses_frame_pointer() {
+   return !omit_frame_pointer || reg_alloc.asm_uses(gen_var(REG_FRAME));
+}
+
+//emit_cond_jump jumps when its condition fails, a loop exits when this one fails
+static bool get_continue_condition(Conditional::CType exit, Conditional::CType &out) {
+   switch (exit) {
+      case Conditional::LESS_THAN: out = Conditional::GREATER_EQUAL; return true;
+      case Conditional::GREATER_EQUAL: out = Conditional::LESS_THAN; return true;
+      case Conditional::GREATER_THAN: out = Conditional::LESS_EQUAL; return true;
+      case Conditional::LESS_EQUAL: out = Conditional::GREATER_THAN; return true;
+      default: return false; //there is no jump for not equal
+   }
+}
+
+//With a profile, a loop whose body ran is rotated: its test moves to the
+//bottom, so an iteration takes one branch instead of two.
+bool Code_Gen::
+should_rotate(Scope &loop) {
+   if (!profile || profile->instrument || !loop.is_loop() || profile->iterations(loop) <= 0) {
+      return false;
+   }
+   Conditional::CType condition;
+   Expression &test = loop.expressions[0];
+   //a float test turned around would keep looping on NaN instead of leaving
+   return test.instructions.size() == 1 && test.scope->empty()
+      && test.instructions[0].func_call_name.compare("EOS_JUMP") == 0
+      && !test.instructions[0].condition.is_always_true
+      && test.instructions[0].condition.left.type != Variable::FLOAT_32BIT
+      && get_continue_condition(test.instructions[0].condition.condition, condition);
+}
+
+//-fprofile-generate: counts one more pass through here in counter id
+void Code_Gen::
+gen_profile_count(int id) {
+   if (!profile || !profile->instrument || id < 0) {
+      return;
+   }
+   Variable counter = profile->counters;
+   counter.offset = id * 4;
+   emit_inc(counter);
+}
+
+std::string Code_Gen::
+get_tail_label(Function &func) {
+   return "L" + func.name + "_tail";
+}
+
 void Code_Gen::
 gen_expression(std::string scope_name, Expression &expr) {
    Instruction prevInstr;
-   for (auto &instr : expr.instructions) {
+   bool float_result = false; //the last call returned a float, the parser types the lvalue it goes to as a pointer
+   for (size_t n = 0; n < expr.instructions.size(); ++n) {
+      Instruction &instr = expr.instructions[n];
       switch (instr.type) {
          case Instruction::BIT_OR: {
-            emit_or(instr.rvalue_data, instr.lvalue_data);
+            if (instr.lvalue_data.is_vector()) {
+               emit_vector_op(instr.type, instr.rvalue_data, instr.lvalue_data);
+            } else {
+               emit_or(instr.rvalue_data, instr.lvalue_data);
+            }
+         } break;
+         case Instruction::ADD:
+         case Instruction::MULTIPLY: {
+            emit_vector_op(instr.type, instr.rvalue_data, instr.lvalue_data);
          } break;
          case Instruction::INCREMENT: {
-            emit_inc(instr.lvalue_data);
+            if (instr.lvalue_data.type == Variable::FLOAT_32X4) {
+               emit_vector_op(Instruction::ADD, create_const_splat(Variable::FLOAT_32X4, get_float_bits(1.0f)),
+                  instr.lvalue_data);
+            } else if (instr.lvalue_data.type == Variable::INT_32X4) {
+               emit_vector_op(Instruction::ADD, create_const_splat(Variable::INT_32X4, 1), instr.lvalue_data);
+            } else {
+               emit_inc(instr.lvalue_data);
+            }
+         } break;
+         case Instruction::SHUFFLE: {
+            emit_vector_shuffle(instr.rvalue_data, instr.lvalue_data, instr.shuffle_mask);
+         } break;
+         case Instruction::LOAD: {
+            emit_vector_load(instr.rvalue_data, instr.lvalue_data);
+         } break;
+         case Instruction::STORE: {
+            emit_vector_store(instr.rvalue_data, instr.lvalue_data);
          } break;
          case Instruction::SUBROUTINE_JUMP: {
             std::string label = instr.func_call_name;
@@ -70,7 +406,14 @@ gen_expression(std::string scope_name, Expression &expr) {
                label = scope_name + "_end";
             }
 
-            if (instr.is_conditional_jump && !instr.condition.is_always_true) {
+            if (instr.func_call_name.compare("SOS_JUMP") == 0 && should_rotate(*stack_man->scope)) {
+               //a rotated loop repeats the test it starts with at the bottom
+               Conditional &test = stack_man->scope->expressions[0].instructions[0].condition;
+               Conditional::CType continue_condition = test.condition;
+               get_continue_condition(test.condition, continue_condition);
+               emit_cmp(test.right, test.left);
+               emit_cond_jump(label, continue_condition);
+            } else if (instr.is_conditional_jump && !instr.condition.is_always_true) {
                emit_cmp(instr.condition.right, instr.condition.left);
                emit_cond_jump(label, instr.condition.condition);
             } else {
@@ -80,9 +423,6 @@ gen_expression(std::string scope_name, Expression &expr) {
          } break;
          case Instruction::FUNC_CALL: {
             if (instr.func_call_name.compare("__asm__") == 0) {
-               if (instr.call_target_params[0].dqstring.find_first_of(':') == std::string::npos) {
-                  os << '\t';
-               }
                std::string final = instr.call_target_params[0].dqstring;
                while (final.find_first_of("@") != std::string::npos) {
 
@@ -91,7 +431,10 @@ gen_expression(std::string scope_name, Expression &expr) {
                      final.replace(final.find_first_of("@0"), 2, load_from_stack);
                   }
                }
-               os << final << std::endl;
+               if (final.find_first_of(':') == std::string::npos) {
+                  final = '\t' + final;
+               }
+               emit_text(final);
             } else {
                //TODO(josh) implement name mangle + getFuncByNameAndParams
                Function *cfunc = expr.scope->getFuncByName(instr.func_call_name);
@@ -100,25 +443,54 @@ gen_expression(std::string scope_name, Expression &expr) {
                   printf("Undefined reference to %s\n", instr.func_call_name.c_str());
                } else {
                   printf("Func: %s\n", cfunc->name.c_str());
+                  //the result has to come back where this function returns it
+                  bool same_return = (cfunc->return_info.ptype == Variable::FLOAT_32BIT)
+                     == (current_function && current_function->return_info.ptype == Variable::FLOAT_32BIT);
+                  if (current_function && !current_function->plain_instructions && is_tail_call(expr, n)
+                     && same_return && gen_tail_call(*cfunc, instr.call_target_params, *expr.scope)) {
+                     ++n; //the return is part of the tail call
+                     break;
+                  }
                   if (instr.call_target_params.size()) {
-                     gen_func_params(instr.call_target_params);
+                     gen_func_params(*cfunc, instr.call_target_params);
                   }
 
-                  emit_call("" + cfunc->name);
+                  float_result = cfunc->return_info.ptype == Variable::FLOAT_32BIT;
+                  bool is_exit = cfunc->name.compare("_exit") == 0;
+                  emit_call(profile && profile->instrument && is_exit ? PROFILE_EXIT : cfunc->name);
                   std::vector<Variable> plist = instr.call_target_params;
                   gen_stack_pop_params(plist);
+                  bool result_read = n + 1 < expr.instructions.size()
+                     && expr.instructions[n + 1].rvalue_data.name.compare(REGISTER_RETURN) == 0;
+                  if (cfunc->return_info.ptype == Variable::FLOAT_32BIT && !result_read) {
+                     gen_discard_float_return();
+                  }
                }
             }
          } break;
          case Instruction::ASSIGN: {
-            if (instr.lvalue_data.type == Variable::POINTER || instr.lvalue_data.type == Variable::INT_32BIT) {
+            if (instr.lvalue_data.is_vector()) {
+               //`x = x + y` starts with a copy of x onto itself
+               if (instr.rvalue_data.is_type_const || instr.rvalue_data.name.compare(instr.lvalue_data.name) != 0) {
+                  emit_vector_mov(instr.rvalue_data, instr.lvalue_data);
+               }
+            } else if (instr.lvalue_data.type == Variable::POINTER || is_integer_type(instr.lvalue_data.type)
+               || instr.lvalue_data.type == Variable::FLOAT_32BIT) {
                if (instr.lvalue_data.name.compare("return") == 0) {
-                  emit_mov(instr.rvalue_data, REG_RETURN);
-                  if (int i = gen_stack_unwind(*expr.scope) > 0) {
+                  bool is_float = current_function && current_function->return_info.ptype == Variable::FLOAT_32BIT;
+                  Variable rvalue = instr.rvalue_data;
+                  if (float_result && rvalue.name.compare(REGISTER_RETURN) == 0) {
+                     rvalue = REG_FLOAT_RETURN; //s0 with hard floats, not r0
+                  }
+                  emit_mov(rvalue, is_float ? REG_FLOAT_RETURN : REG_RETURN);
+                  int i = gen_stack_unwind(*expr.scope);
+                  if (i > 0) {
                      emit_add(create_const_int32(i), REG_STACK);
                   }
                   emit_function_footer();
                   emit_return();
+               } else if (float_result && instr.rvalue_data.name.compare(REGISTER_RETURN) == 0) {
+                  emit_mov(REG_FLOAT_RETURN, instr.lvalue_data);
                } else {
 
                   emit_mov(instr.rvalue_data, instr.lvalue_data);
@@ -134,6 +506,12 @@ gen_expression(std::string scope_name, Expression &expr) {
    }
 }
 
+//everything was reserved on entry, returning only has to free the function's frame
+int Code_Gen::
+gen_stack_unwind(Scope &scope) {
+   return get_frame_size(*stack_man->get_frame_scope(scope));
+}
+
 void Code_Gen::
 gen_scope_functions(Scope &scope) {
     for (auto &func : scope.functions) {
@@ -142,32 +520,64 @@ gen_scope_functions(Scope &scope) {
 }
 
 void Code_Gen::
-gen_scope_expressions(std::string scope_name, Scope &scope) {
-   for (auto &expr : scope.expressions) {
+gen_scope_expressions(std::string scope_name, Scope &scope, size_t first) {
+   for (size_t i = first; i < scope.expressions.size(); ++i) {
+      Expression &expr = scope.expressions[i];
       gen_expression(scope_name, expr);
       gen_scope(*expr.scope);
+      stack_man->scope = &scope;
    }
 }
 
 void Code_Gen::
 gen_function_attributes(Function &func) {
-   os << ".globl " << func.name << std::endl;
+   if (!func.is_internal) {
+      emit_text(".globl " + func.name);
+   }
+}
+
+//parameters that were given a register are copied out of their stack slots once on entry
+void Code_Gen::
+gen_param_loads(Function &func) {
+   Scope *scope = stack_man->scope;
+   stack_man->scope = func.scope;
+   for (auto &li : reg_alloc.intervals) {
+      if (li.is_param && li.reg >= 0) {
+         reg_alloc.enabled = false;
+         emit_mov(func.parameters[li.param_index], *reg_alloc.get_interval_register(li, *this));
+         reg_alloc.enabled = true;
+      }
+   }
+   stack_man->scope = scope;
 }
 
 void Code_Gen::
 gen_function(Function &func) {
+   std::vector<Variable> params = stack_man->params;
+   Reg_Alloc outer_alloc = reg_alloc;
+   Function *outer_function = current_function;
+   current_function = &func;
    stack_man->params = func.parameters;
    if (func.name.compare("__asm__") != 0) {
 
 
       if (!func.should_inline && !func.is_not_definition) {
+         reg_alloc.allocate(func, *this);
          gen_function_attributes(func);
-         os << "" << func.name << ":" << std::endl;
+         emit_label(func.name);
          if (!func.plain_instructions) {
             emit_function_header();
+            if (has_self_tail_call(func, *func.scope)) {
+               emit_label(get_tail_label(func));
+            }
          }
          stack_man->scope = func.scope;
          gen_stack_alignment(*func.scope);
+         if (!func.plain_instructions) {
+            gen_param_loads(func);
+            gen_pic_base();
+            gen_profile_count(func.scope->profile_id);
+         }
          gen_scope_expressions("" + func.name, *func.scope);
          gen_stack_unalignment(*func.scope);
          if (func.return_info.ptype == Variable::VOID) {
@@ -179,6 +589,13 @@ gen_function(Function &func) {
       }
       gen_scope_functions(*func.scope);
    }
+   stack_man->params = params;
+   reg_alloc = outer_alloc;
+   current_function = outer_function;
+   if (!current_function) {
+      print_machine_code();
+      stack_man->clear_layout();
+   }
 }
 
 void Code_Gen::
@@ -189,16 +606,455 @@ gen_scope(Scope &scope) {
    stack_man->scope = &scope;
    unsigned int scope_num = get_scope_num(&scope);
    std::string scope_name = "L" + std::string("scope_") + std::to_string(scope_num);
-   if (scope_num != 0) {
-      os << scope_name << ":" << std::endl;
-   }
-   gen_stack_alignment(scope);
-   gen_scope_expressions(scope_name, scope);
-   if (scope_num != 0) {
-      os << scope_name << "_end" << ":" << std::endl;
+   if (!scope.parent) {
+      //nothing runs outside of a function, the global scope's assignments
+      //only give its variables their initial values
+      global_scope = &scope;
+      collect_global_inits(scope);
+   } else {
+      //loops jump back to the label, so it sits after the scope's stack adjustment
+      gen_stack_alignment(scope);
+      bool rotate = should_rotate(scope);
+      if (rotate) {
+         //the first test of a rotated loop runs once, ahead of it
+         gen_expression(scope_name, scope.expressions[0]);
+      }
+      if (scope_num != 0) {
+         emit_label(scope_name);
+      }
+      gen_profile_count(scope.profile_id);
+      gen_scope_expressions(scope_name, scope, rotate ? 1 : 0);
+      if (scope_num != 0) {
+         emit_label(scope_name + "_end");
+      }
+      if (scope.is_loop()) {
+         gen_profile_count(scope.profile_id + 1);
+      }
+      gen_stack_unalignment(scope);
    }
-   gen_stack_unalignment(scope);
+   bool has_cold = false;
    for (auto &func : scope.functions) {
-      gen_function(func);
+      has_cold |= func.is_cold;
+      if (!func.is_cold) {
+         gen_function(func);
+      }
+   }
+   if (has_cold) {
+      emit_text("\t" + cold_text_section);
+      for (auto &func : scope.functions) {
+         if (func.is_cold) {
+            gen_function(func);
+         }
+      }
+      emit_text("\t" + text_section);
+   }
+   if (!current_function) {
+      print_machine_code();
+   }
+}
+
+void Code_Gen::
+emit_instr(const std::string &opcode, const std::vector<std::string> &operands) {
+   if (unreachable) {
+      return; //like the frame release after a return, until a label is jumped to
+   }
+   if (machine_code.empty()) {
+      machine_code.emplace_back();
+   }
+   machine_code.back().instrs.emplace_back();
+   Machine_Instr &instr = machine_code.back().instrs.back();
+   instr.opcode = opcode;
+   for (auto &op : operands) {
+      instr.operands.push_back(parse_operand(op));
+   }
+   unreachable = is_block_exit(instr);
+}
+
+void Code_Gen::
+emit_label(const std::string &label) {
+   machine_code.emplace_back();
+   machine_code.back().label = label;
+   unreachable = false;
+}
+
+void Code_Gen::
+emit_text(const std::string &text) {
+   if (text.find(':') != std::string::npos) {
+      unreachable = false; //a label of inline asm
+   }
+   if (machine_code.empty()) {
+      machine_code.emplace_back();
+   }
+   machine_code.back().instrs.emplace_back();
+   machine_code.back().instrs.back().text = text;
+}
+
+void Code_Gen::
+print_machine_code() {
+   for (auto &block : machine_code) {
+      if (block.label.size()) {
+         os << block.label << ":\n";
+      }
+      for (auto &instr : block.instrs) {
+         if (instr.is_text()) {
+            os << instr.text << '\n';
+            continue;
+         }
+         os << '\t' << instr.opcode;
+         for (size_t i = 0; i < instr.operands.size(); ++i) {
+            os << (i ? ", " : " ");
+            print_operand(instr.operands[i]);
+         }
+         os << '\n';
+      }
+   }
+   machine_code.clear();
+}
+
+//a variable of the global scope that has storage, constants never do
+const Variable *Code_Gen::
+get_global(const Variable &var) {
+   if (!global_scope || var.is_type_const) {
+      return nullptr;
+   }
+   if (profile && profile->instrument && var.name.compare(PROFILE_COUNTERS) == 0) {
+      return &profile->counters;
+   }
+   for (auto &v : global_scope->variables) {
+      if (!v.is_type_const && v.name.compare(var.name) == 0) {
+         return &v;
+      }
+   }
+   return nullptr;
+}
+
+//Initial values of the globals are the assignments the parser left in the
+//global scope. Nothing runs before main, so they have to be constants.
+void Code_Gen::
+collect_global_inits(Scope &scope) {
+   global_inits.clear();
+   for (auto &expr : scope.expressions) {
+      for (auto &instr : expr.instructions) {
+         Variable &val = instr.rvalue_data;
+         bool is_const = val.is_type_const || (val.type == Variable::DQString && val.name.empty());
+         if (instr.type != Instruction::ASSIGN || !is_const || !get_global(instr.lvalue_data)) {
+            printf("error: globals can only be initialized with constants\n");
+            exit(-1);
+         }
+         global_inits[instr.lvalue_data.name] = val;
+      }
+   }
+}
+
+static bool is_zero_init(const Variable &val) {
+   if (val.type == Variable::DQString) {
+      return false;
+   }
+   if (val.is_vector()) {
+      return !(val.lanes[0] | val.lanes[1] | val.lanes[2] | val.lanes[3]);
+   }
+   if (val.type == Variable::FLOAT_32BIT) {
+      return get_float_bits(val.fvalue) == 0;
+   }
+   return val.pvalue == 0;
+}
+
+static const char *get_data_directive(int size) {
+   switch (size) {
+      case 1: return "\t.byte ";
+      case 2: return "\t.short ";
+      case 8: return "\t.quad ";
+      default: return "\t.long ";
+   }
+}
+
+static long long get_data_value(long long value, int size) {
+   switch (size) {
+      case 1: return (int8_t)value;
+      case 2: return (int16_t)value;
+      case 4: return (int32_t)value;
+      default: return value;
+   }
+}
+
+bool Code_Gen::
+has_globals(bool initialized) {
+   if (!global_scope) {
+      return false;
+   }
+   if (!initialized && profile && profile->instrument && profile->num_counters) {
+      return true;
+   }
+   for (auto &var : global_scope->variables) {
+      auto init = global_inits.find(var.name);
+      bool has_value = init != global_inits.end() && !is_zero_init(init->second);
+      if (!var.is_type_const && has_value == initialized) {
+         return true;
+      }
+   }
+   return false;
+}
+
+//Globals with a value other than zero go in .data, the rest take no room in
+//the object and go in .bss. Each is as big and aligned as it would be on the
+//stack, so the backend's loads and stores work the same on both.
+void Code_Gen::
+gen_globals(bool initialized) {
+   for (auto &var : global_scope->variables) {
+      auto init = global_inits.find(var.name);
+      bool has_value = init != global_inits.end() && !is_zero_init(init->second);
+      if (var.is_type_const || has_value != initialized) {
+         continue;
+      }
+      int size = stack_man->get_var_size(var);
+      int align_log2 = 0;
+      while ((1 << align_log2) < stack_man->get_var_align(var)) {
+         align_log2++;
+      }
+      os << "\t.p2align " << align_log2 << '\n';
+      os << var.name << ":" << '\n';
+      if (!has_value) {
+         os << "\t.zero " << size << '\n';
+         continue;
+      }
+      Variable &val = init->second;
+      int value_size = size;
+      if (var.is_vector()) {
+         os << "\t.long " << val.lanes[0] << ", " << val.lanes[1] << ", " << val.lanes[2] << ", " << val.lanes[3];
+      } else if (val.type == Variable::DQString) {
+         os << get_data_directive(size) << get_rodata(val);
+      } else if (var.type == Variable::FLOAT_32BIT) {
+         float value = (val.type == Variable::FLOAT_32BIT ? val.fvalue : (float)val.pvalue);
+         os << "\t.long " << get_float_bits(value);
+         value_size = 4;
+      } else {
+         long long value = (val.type == Variable::FLOAT_32BIT ? (long long)val.fvalue : (long long)val.pvalue);
+         os << get_data_directive(size) << get_data_value(value, size);
+      }
+      os << '\n';
+      if (size > value_size) {
+         os << "\t.zero " << size - value_size << '\n';
+      }
+   }
+   if (!initialized && profile && profile->instrument && profile->num_counters) {
+      os << "\t.p2align 2" << '\n';
+      os << PROFILE_COUNTERS << ":" << '\n';
+      os << "\t.zero " << profile->num_counters * 4 << '\n';
+   }
+}
+
+static std::string escape_string(const std::string &str) {
+   std::string out;
+   for (unsigned char c : str) {
+      if (c == '"' || c == '\\') {
+         out += '\\';
+         out += c;
+      } else if (c == '\n') {
+         out += "\\n";
+      } else if (c >= 0x20 && c < 0x7F) {
+         out += c;
+      } else {
+         char oct[5];
+         snprintf(oct, sizeof(oct), "\\%03o", c);
+         out += oct;
+      }
+   }
+   return out;
+}
+
+static bool ends_with(const std::string &str, const std::string &suffix) {
+   return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+//Strings are already unique, and one that ends another string gets its
+//label placed inside that string rather than a copy of its own.
+void Code_Gen::
+gen_rodata() {
+   std::vector<size_t> strings;
+   for (size_t i = 0; i < rodata_data.size(); i++) {
+      if (rodata_data[i].type == Variable::DQString) {
+         strings.push_back(i);
+      }
+   }
+   //sorted by their reversed text, a string is a suffix of the run that follows it
+   std::sort(strings.begin(), strings.end(), [this](size_t a, size_t b) {
+      const std::string &sa = rodata_data[a].dqstring;
+      const std::string &sb = rodata_data[b].dqstring;
+      return std::lexicographical_compare(sa.rbegin(), sa.rend(), sb.rbegin(), sb.rend());
+   });
+   std::vector<int> container(rodata_data.size(), -1);
+   std::map<size_t, std::vector<size_t>> suffixes;
+   for (size_t k = 0; k < strings.size(); ++k) {
+      const std::string &str = rodata_data[strings[k]].dqstring;
+      size_t c = k;
+      while (c + 1 < strings.size() && ends_with(rodata_data[strings[c + 1]].dqstring, str)) {
+         c++;
+      }
+      if (c != k) {
+         container[strings[k]] = strings[c];
+         suffixes[strings[c]].push_back(strings[k]);
+      }
+   }
+
+   for (size_t i = 0; i < rodata_data.size(); i++) {
+      //float constants go to the literal section instead
+      if (container[i] >= 0 || rodata_data[i].type != Variable::DQString) {
+         continue;
+      }
+      os << rodata_labels[i] << ":" << '\n';
+      Variable *var = &rodata_data[i];
+      if (var->type == Variable::DQString) {
+         std::vector<size_t> &inner = suffixes[i];
+         //longest suffix first, it starts earliest in the string
+         std::sort(inner.begin(), inner.end(), [this](size_t a, size_t b) {
+            return rodata_data[a].dqstring.size() > rodata_data[b].dqstring.size();
+         });
+         size_t pos = 0;
+         for (size_t s : inner) {
+            size_t offset = var->dqstring.size() - rodata_data[s].dqstring.size();
+            if (offset > pos) {
+               os << "\t.ascii \"" << escape_string(var->dqstring.substr(pos, offset - pos)) << "\"" << '\n';
+               pos = offset;
+            }
+            os << rodata_labels[s] << ":" << '\n';
+         }
+         os << "\t.asciz \"" << escape_string(var->dqstring.substr(pos)) << "\"" << '\n';
+      }
+   }
+}
+
+//constants that have to come from memory, in a mergeable section per size
+void Code_Gen::
+gen_literals(int size) {
+   for (size_t i = 0; i < rodata_data.size(); i++) {
+      Variable &var = rodata_data[i];
+      if (size == 4 && var.type == Variable::FLOAT_32BIT) {
+         os << "\t.p2align 2" << '\n';
+         os << rodata_labels[i] << ":" << '\n';
+         os << "\t.long " << get_float_bits(var.fvalue) << '\n';
+      } else if (size == 16 && var.is_vector()) {
+         os << "\t.p2align 4" << '\n';
+         os << rodata_labels[i] << ":" << '\n';
+         os << "\t.long " << var.lanes[0] << ", " << var.lanes[1] << ", " << var.lanes[2] << ", " << var.lanes[3] << '\n';
+      }
+   }
+}
+
+bool Code_Gen::
+has_literals(int size) {
+   for (auto &var : rodata_data) {
+      if ((size == 4 && var.type == Variable::FLOAT_32BIT) || (size == 16 && var.is_vector())) {
+         return true;
+      }
+   }
+   return false;
+}
+
+//one 32-bit lane of a vector, either a scalar constant or the vector's own
+//storage at the lane's offset. Scalars stand in for every lane.
+Variable Code_Gen::
+get_lane(Variable var, int lane) {
+   if (!var.is_vector()) {
+      return var;
+   }
+   bool is_float = var.type == Variable::FLOAT_32X4;
+   if (var.is_type_const) {
+      if (is_float) {
+         Variable val = create_const_float32(0.0f);
+         memcpy(&val.fvalue, &var.lanes[lane], sizeof(val.fvalue));
+         return val;
+      }
+      return create_const_int32(var.lanes[lane]);
+   }
+   var.type = is_float ? Variable::FLOAT_32BIT : Variable::INT_32BIT;
+   var.offset += lane * 4;
+   return var;
+}
+
+void Code_Gen::
+emit_vector_mov(Variable src, Variable dst) {
+   for (int i = 0; i < 4; ++i) {
+      emit_mov(get_lane(src, i), get_lane(dst, i));
+   }
+}
+
+void Code_Gen::
+emit_vector_op(Instruction::IType op, Variable src, Variable dst) {
+   if (dst.type == Variable::FLOAT_32X4 && op != Instruction::BIT_OR && float_registers.empty()) {
+      printf("error: float4 arithmetic needs a floating point unit on this target\n");
+      exit(-1);
+   }
+   for (int i = 0; i < 4; ++i) {
+      Variable src_lane = get_lane(src, i);
+      Variable dst_lane = get_lane(dst, i);
+      if (op == Instruction::ADD) {
+         emit_add(src_lane, dst_lane);
+      } else if (op == Instruction::MULTIPLY) {
+         emit_mul(src_lane, dst_lane);
+      } else {
+         emit_or(src_lane, dst_lane);
+      }
+   }
+}
+
+//A shuffle in place writes each lane only once nothing else still needs to
+//read it. A cycle of lanes is broken by parking one of them in
+//REGISTER_INDEX, lane to lane moves go through the accumulator.
+void Code_Gen::
+emit_vector_shuffle(Variable src, Variable dst, int mask) {
+   const int PARKED = 4;
+   int from[4];
+   bool pending[4];
+   bool in_place = gen_var(get_lane(src, 0)).compare(gen_var(get_lane(dst, 0))) == 0;
+   for (int i = 0; i < 4; ++i) {
+      from[i] = (mask >> (2 * i)) & 3;
+      pending[i] = !in_place || from[i] != i;
+   }
+   bool done = false;
+   while (!done) {
+      done = true;
+      bool progress = false;
+      for (int i = 0; i < 4; ++i) {
+         if (!pending[i]) {
+            continue;
+         }
+         done = false;
+         bool still_read = false;
+         for (int j = 0; in_place && j < 4; ++j) {
+            still_read |= pending[j] && j != i && from[j] == i;
+         }
+         if (!still_read) {
+            emit_mov(from[i] == PARKED ? REG_INDEX : get_lane(src, from[i]), get_lane(dst, i));
+            pending[i] = false;
+            progress = true;
+         }
+      }
+      for (int i = 0; !done && !progress && i < 4; ++i) {
+         if (pending[i]) {
+            emit_mov(get_lane(src, i), REG_INDEX);
+            for (int j = 0; j < 4; ++j) {
+               if (pending[j] && from[j] == i) {
+                  from[j] = PARKED;
+               }
+            }
+            break;
+         }
+      }
+   }
+}
+
+void Code_Gen::
+emit_vector_load(Variable ptr, Variable dst) {
+   emit_mov(ptr, REG_INDEX);
+   for (int i = 0; i < 4; ++i) {
+      emit_mov(create_register(REGISTER_INDIRECT + std::to_string(i * 4)), get_lane(dst, i));
+   }
+}
+
+void Code_Gen::
+emit_vector_store(Variable src, Variable ptr) {
+   emit_mov(ptr, REG_INDEX);
+   for (int i = 0; i < 4; ++i) {
+      emit_mov(get_lane(src, i), create_register(REGISTER_INDIRECT + std::to_string(i * 4)));
    }
 }
@@ -3,25 +3,43 @@
 #define CODE_GEN_H
 
 #include <string>
-#include <ostream>
 #include <unordered_map>
 #include <map>
 
+#include "Asm_Buf.h"
+#include "Machine_Instr.h"
 #include "Code_Structure.h"
+#include "Reg_Alloc.h"
+#include "Profile.h"
 
 Variable create_register(std::string reg_name);
 Variable create_const_int32(int value);
+Variable create_const_float32(float value);
+Variable create_const_splat(Variable::VType type, int32_t bits);
+int get_float_bits(float value);
+int get_arg_words(const std::vector<Variable> &params, size_t n);
 
 const std::string REGISTER_STACK_POINTER = "_REG_STACK";
 const std::string REGISTER_ACCUMULATOR   = "_REGISTER_ACCUMULATOR";
 const std::string REGISTER_INDEX = "_REGISTER_INDEX";
 const std::string REGISTER_RETURN = "_REGISTER_RETURN";
 const std::string REGISTER_FRAME_POINTER = "_REG_FRAME";
+//callee-saved registers handed out by Reg_Alloc are named _REG_SAVED0, _REG_SAVED1, ...
+const std::string REGISTER_SAVED = "_REG_SAVED";
+//callee-saved floating point registers handed out by Reg_Alloc, _REG_FSAVED0, ...
+const std::string REGISTER_FLOAT_SAVED = "_REG_FSAVED";
+//where float results are returned, the same as REGISTER_RETURN unless the ABI says otherwise
+const std::string REGISTER_FLOAT_RETURN = "_REGISTER_FLOAT_RETURN";
+//slot N of the outgoing argument area at the bottom of the frame, _OUT_ARG0, _OUT_ARG1, ...
+const std::string REGISTER_OUTGOING_ARG = "_OUT_ARG";
+//memory N bytes past the address held in REGISTER_INDEX, _REG_INDIRECT0, _REG_INDIRECT4, ...
+const std::string REGISTER_INDIRECT = "_REG_INDIRECT";
 
 const Variable REG_STACK = create_register(REGISTER_STACK_POINTER);
 const Variable REG_ACCUMULATOR = create_register(REGISTER_ACCUMULATOR);
 const Variable REG_INDEX = create_register(REGISTER_INDEX);
 const Variable REG_RETURN = create_register(REGISTER_RETURN);
+const Variable REG_FLOAT_RETURN = create_register(REGISTER_FLOAT_RETURN);
 const Variable REG_FRAME = create_register(REGISTER_FRAME_POINTER);
 
 struct Code_Gen;
@@ -32,12 +50,42 @@ struct Code_Gen;
 //padding always sits under the variables on the stack
 struct StackMan {
 
+   //where a variable lives, an offset from the stack pointer inside the scope
+   //it was looked up from, or from the frame pointer, and its declared type
+   struct Frame_Slot {
+      int offset;
+      bool frame_based;
+      bool is_param;
+      Variable::VType type;
+   };
+
    std::vector<Variable> params;
    Scope *scope = nullptr;
    Code_Gen *code_gen;
    int ext_adj = 0;
+   int slot_size = 4;
+   //Every name a scope can see: its parameters, its own variables and those
+   //of the scopes around it up to the function. Laid out the first time the
+   //scope is looked in, so resolving an operand is one lookup at any depth.
+   std::unordered_map<Scope *, std::unordered_map<std::string, Frame_Slot>> frame_layout;
+   std::unordered_map<Scope *, std::vector<int>> var_slots; //byte offset of each variable from the frame top, -1 if it has none
+   std::unordered_map<Scope *, int> frame_bytes;
 
-   virtual std::string load_var(Variable var, Scope *ts = nullptr, int total_adjust = 0);
+   const Variable *get_register(Variable var);
+   //storage a variable takes on the stack or as a global, whole slots unless
+   //the backend can load and store narrower values
+   virtual int get_var_size(const Variable &var) { return var.is_vector() ? 16 : slot_size; };
+   virtual int get_var_align(const Variable &var) { return slot_size; };
+   bool is_frame_scope(Scope &scope) { return scope.is_function || !scope.parent; };
+   Scope *get_frame_scope(Scope &scope);
+   void color_slots(Scope &frame_scope);
+   int get_frame_bytes(Scope &scope);
+   void clear_layout();
+   std::unordered_map<std::string, Frame_Slot> &get_frame_layout(Scope &scope);
+   const Frame_Slot *find_slot(Variable var);
+   std::string load_var(Variable var);
+   virtual Frame_Slot get_param_slot(size_t n, Scope &scope) = 0;
+   virtual std::string format_slot(Frame_Slot slot) = 0;
 
 };
 
@@ -53,13 +101,33 @@ struct  Code_Gen {
    std::unordered_map<Scope*, unsigned int> scope_names;
    std::vector<Variable> rodata_data;
    std::vector<std::string> rodata_labels;
+   std::unordered_map<std::string, std::string> rodata_pool;
+   std::unordered_map<int, std::string> literal_pool; //float constants by bit pattern
+   std::map<std::vector<int32_t>, std::string> vector_pool; //vector constants by lane bits
    StackMan *stack_man;
+   Reg_Alloc reg_alloc;
+   std::vector<Variable> allocatable_registers;
+   std::vector<Variable> float_registers; //empty when floats live in integer registers
+   bool float_registers_caller_saved = false; //float values in registers can't live across calls
+   Function *current_function = nullptr;
+   Scope *global_scope = nullptr;
+   std::unordered_map<std::string, Variable> global_inits; //constant initializer of each global that has one
+   bool omit_frame_pointer = true;
+   bool pic = true; //rodata is addressed relative to a PIC base
+   Profile *profile = nullptr; //with -fprofile-generate or -fprofile-use
+   std::string text_section = ".text";
+   std::string cold_text_section; //where functions marked cold go
+   std::string pic_base_label;
    unsigned int ramp = 0;
    unsigned int scope_num = 0;
    int pb_num = 0;
-   std::ostream &os;
+   Asm_Buf &os;
+   //code is built up here and only printed once the outermost function is
+   //done, so it can still be rewritten
+   std::vector<Machine_Basic_Block> machine_code;
+   bool unreachable = false; //the block has jumped or returned, the rest of it never runs
 
-   Code_Gen(std::ostream &ost) : os(ost) {
+   Code_Gen(Asm_Buf &ost) : os(ost) {
 
    }
 
@@ -71,7 +139,29 @@ struct  Code_Gen {
       return std::string("L0$pb") + std::to_string(pb_num - 1);
    }
 
+   //a branch target of its own, numbered along with the scopes
+   std::string get_local_label() {
+      return std::string("Lscope_") + std::to_string(scope_num++);
+   }
+
    std::string get_rodata(Variable var) {
+      //identical string literals and constants share one copy
+      if (var.type == Variable::DQString) {
+         auto pooled = rodata_pool.find(var.dqstring);
+         if (pooled != rodata_pool.end()) {
+            return pooled->second;
+         }
+      } else if (var.type == Variable::FLOAT_32BIT) {
+         auto pooled = literal_pool.find(get_float_bits(var.fvalue));
+         if (pooled != literal_pool.end()) {
+            return pooled->second;
+         }
+      } else if (var.is_vector()) {
+         auto pooled = vector_pool.find(std::vector<int32_t>(var.lanes, var.lanes + 4));
+         if (pooled != vector_pool.end()) {
+            return pooled->second;
+         }
+      }
       std::string ref_str = "L";
       if (var.type == Variable::DQString) {
          ref_str += "str";
@@ -79,10 +169,19 @@ struct  Code_Gen {
          ref_str += "flt";
       } else if (var.type == Variable::INT_32BIT) {
          ref_str += "int";
+      } else if (var.is_vector()) {
+         ref_str += "vec";
       }
       ref_str += std::to_string(ramp++);
       rodata_data.push_back(var);
       rodata_labels.push_back(ref_str);
+      if (var.type == Variable::DQString) {
+         rodata_pool[var.dqstring] = ref_str;
+      } else if (var.type == Variable::FLOAT_32BIT) {
+         literal_pool[get_float_bits(var.fvalue)] = ref_str;
+      } else if (var.is_vector()) {
+         vector_pool[std::vector<int32_t>(var.lanes, var.lanes + 4)] = ref_str;
+      }
       return ref_str;
    }
 
@@ -90,21 +189,56 @@ struct  Code_Gen {
       return scope_num++;
    }
 
+   std::string get_tail_label(Function &func);
+   bool uses_frame_pointer();
+
    void gen_scope(Scope &scope);
    void gen_expression(std::string scope_name, Expression &expr);
-   void gen_scope_expressions(std::string scope_name, Scope &scope);
+   void gen_scope_expressions(std::string scope_name, Scope &scope, size_t first = 0);
    void gen_scope_functions(Scope &scope);
    void gen_function(Function &func);
-   virtual void gen_func_params(std::vector<Variable> &plist);
+   virtual void gen_param_loads(Function &func);
+   virtual void gen_func_params(Function &func, std::vector<Variable> &plist);
+   virtual void gen_pic_base() {};
    virtual void gen_function_attributes(Function &func);
    virtual void gen_stack_alignment(Scope &scope) {};
    virtual void gen_stack_unalignment(Scope &scope) {};
    virtual void gen_stack_pop_params(std::vector<Variable> &plist) {};
-   virtual int gen_stack_unwind(Scope &scope) = 0;
+   int gen_stack_unwind(Scope &scope);
+   virtual int get_frame_size(Scope &scope) {
+      return stack_man->is_frame_scope(scope) ? stack_man->get_frame_bytes(scope) : 0;
+   };
+   //lowers `return func(plist);` to a jump, returns false if the backend cannot
+   virtual bool gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope) { return false; };
 
    virtual std::string gen_var(Variable var) = 0;
+   //a global's storage as an operand, var.offset bytes in
+   virtual std::string gen_global(Variable var) { return ""; };
+   const Variable *get_global(const Variable &var);
+   void collect_global_inits(Scope &scope);
+   void gen_globals(bool initialized);
+   bool has_globals(bool initialized);
+
+   virtual void gen_rodata();
+   void gen_literals(int size);
+   bool has_literals(int size);
+   //called after a call whose float result nobody reads
+   virtual void gen_discard_float_return() {};
+   virtual void gen_profile_count(int id);
+   bool should_rotate(Scope &loop);
+   //-fprofile-generate: PROFILE_EXIT takes the place of _exit, it writes the counters out first
+   virtual void gen_profile_exit() {};
 
-   virtual void gen_rodata() = 0;
+   //operands are given as the backend writes them and kept split into their parts
+   virtual void emit_instr(const std::string &opcode, const std::vector<std::string> &operands = {});
+   //jumps and returns that never fall through to the next instruction
+   virtual bool is_block_exit(const Machine_Instr &instr) { return false; };
+   void emit_label(const std::string &label);
+   //directives and inline asm, printed as they are
+   void emit_text(const std::string &text);
+   virtual Machine_Operand parse_operand(const std::string &op) { return parse_att_operand(op); };
+   virtual void print_operand(const Machine_Operand &op) { print_att_operand(os, op); };
+   void print_machine_code();
 
    virtual void emit_cmp(Variable src0, Variable src1) = 0;
    virtual void emit_inc(Variable dst) = 0;
@@ -114,6 +248,7 @@ struct  Code_Gen {
    virtual void emit_sub(Variable src, Variable dst) = 0;
    virtual void emit_add(Variable src, Variable dst) = 0;
    virtual void emit_or(Variable src, Variable dst) = 0;
+   virtual void emit_mul(Variable src, Variable dst) = 0;
    virtual void emit_call(std::string label) = 0;
    virtual void emit_jump(std::string label) = 0;
    virtual void emit_cond_jump(std::string label, Conditional::CType condition) = 0;
@@ -121,6 +256,15 @@ struct  Code_Gen {
    virtual void emit_function_header() = 0;
    virtual void emit_function_footer() = 0;
 
+   //float4 and int4, lane by lane with the scalar instructions unless the
+   //backend has SIMD registers to do them in
+   Variable get_lane(Variable var, int lane);
+   virtual void emit_vector_mov(Variable src, Variable dst);
+   virtual void emit_vector_op(Instruction::IType op, Variable src, Variable dst);
+   virtual void emit_vector_shuffle(Variable src, Variable dst, int mask);
+   virtual void emit_vector_load(Variable ptr, Variable dst);
+   virtual void emit_vector_store(Variable src, Variable ptr);
+
 };
 
 
@@ -16,6 +16,8 @@ struct Variable {
       INT_32BIT,
       INT_64BIT,
       FLOAT_32BIT,
+      FLOAT_32X4,
+      INT_32X4,
       POINTER,
       DEREFERENCED_POINTER,
       UNKNOWN
@@ -27,10 +29,21 @@ struct Variable {
    VType ptype; //used when type is a pointer
    intptr_t pvalue;
    float fvalue;
+   int32_t lanes[4] = {0, 0, 0, 0}; //bits of each lane of a vector constant
+   int offset = 0; //byte offset into the variable's storage, picks out one lane of a vector
    bool is_type_const = false;
    bool is_ptype_const = false;
+
+   bool is_vector() const {
+      return type == FLOAT_32X4 || type == INT_32X4;
+   }
 };
 
+inline bool is_integer_type(Variable::VType type) {
+   return type == Variable::CHAR || type == Variable::INT_8BIT || type == Variable::INT_16BIT
+      || type == Variable::INT_32BIT || type == Variable::INT_64BIT;
+}
+
 struct Scope;
 
 struct Function {
@@ -40,6 +53,8 @@ struct Function {
    bool should_inline = false;
    bool plain_instructions = false;
    bool is_not_definition = false;
+   bool is_internal = false; //only called from inside the program, so not exported
+   bool is_cold = false; //laid out in the cold text section, see Function_Layout
    Variable return_info;
    Function();
 };
@@ -65,7 +80,12 @@ struct Instruction {
       SUBROUTINE_JUMP, //used mainly for loops
       ASSIGN,
       INCREMENT,
-      BIT_OR
+      BIT_OR,
+      ADD,
+      MULTIPLY,
+      SHUFFLE,
+      LOAD, //vector from the address in rvalue_data
+      STORE //vector to the address in lvalue_data
    };
    
    IType type;
@@ -75,6 +95,7 @@ struct Instruction {
    Variable rvalue_data;
    bool is_conditional_jump = false;
    Conditional condition;
+   int shuffle_mask = 0; //lane i of the result is source lane (mask >> 2 * i) & 3
 };
 
 
@@ -102,6 +123,7 @@ struct Scope {
    Scope *parent = nullptr;
    bool is_function = false;
    Function *function;
+   int profile_id = -1; //first of its execution counters, see Profile
    
    Scope(Scope *p = nullptr) {
       parent = p;
@@ -119,6 +141,14 @@ struct Scope {
             return true;
          }
       }
+
+      if (is_function) {
+         for (auto &f : function->parameters) {
+            if (f.name.compare(name) == 0) {
+               return true;
+            }
+         }
+      }
       
       return (parent ? parent->contains_symbol(name) : false);
    }
@@ -161,6 +191,18 @@ struct Scope {
    bool empty() {
       return !functions.size() && !expressions.size();
    }
+
+   //a while loop's body, which ends by jumping back to its start
+   bool is_loop() {
+      for (auto &expr : expressions) {
+         for (auto &instr : expr.instructions) {
+            if (instr.type == Instruction::SUBROUTINE_JUMP && instr.func_call_name.compare("SOS_JUMP") == 0) {
+               return true;
+            }
+         }
+      }
+      return false;
+   }
 };
 
 
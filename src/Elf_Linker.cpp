@@ -0,0 +1,451 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unordered_set>
+#include <sys/stat.h>
+
+#include "Elf_Linker.h"
+
+static const uint32_t LOAD_BASE = 0x08048000;
+static const uint32_t PAGE_SIZE = 0x1000;
+static const uint32_t HEADERS_SIZE = 52 + 2 * 32; //ELF header and two program headers
+
+//output sections, in address order
+enum Out_Section { OUT_TEXT, OUT_RODATA, OUT_DATA, OUT_BSS, OUT_COUNT };
+static const char *out_names[] = { ".text", ".rodata", ".data", ".bss" };
+
+static Out_Section get_out_section(const Elf_Section &sec) {
+   if (sec.type == ELF_SHT_NOBITS) {
+      return OUT_BSS;
+   }
+   if (sec.flags & ELF_SHF_EXECINSTR) {
+      return OUT_TEXT;
+   }
+   return (sec.flags & ELF_SHF_WRITE) ? OUT_DATA : OUT_RODATA;
+}
+
+//.text.unlikely of every object goes after all the code that runs
+static bool is_cold_text(const Elf_Section &sec) {
+   return sec.name.compare(0, 14, ".text.unlikely") == 0;
+}
+
+static uint32_t align_up(uint32_t val, uint32_t align) {
+   return (val + align - 1) & ~(align - 1);
+}
+
+bool Elf_Linker::fail(const std::string &msg) {
+   error = msg;
+   return false;
+}
+
+void Elf_Linker::add_object(const Elf_Object &obj, const std::string &name) {
+   inputs.push_back(Input{name, obj, true, {}});
+}
+
+//objects are always linked, archive members only when needed
+bool Elf_Linker::add_file(const std::string &path) {
+   std::ifstream t(path, std::ios::binary);
+   if (!t.good()) {
+      return fail("can't open " + path);
+   }
+   std::vector<uint8_t> data((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+   if (data.size() >= 8 && memcmp(data.data(), "!<arch>\n", 8) == 0) {
+      return read_archive(data, path);
+   }
+   Input in{path, Elf_Object(), true, {}};
+   if (!read_object(data.data(), data.size(), path, in.obj)) {
+      return false;
+   }
+   inputs.push_back(in);
+   return true;
+}
+
+//GNU and BSD style ar archives, the symbol index is ignored
+bool Elf_Linker::read_archive(const std::vector<uint8_t> &data, const std::string &path) {
+   std::string long_names;
+   size_t pos = 8;
+   while (pos + 60 <= data.size()) {
+      const char *header = (const char *)&data[pos];
+      std::string name(header, 16);
+      size_t size = strtoul(std::string(header + 48, 10).c_str(), nullptr, 10);
+      size_t start = pos + 60;
+      if (start + size > data.size()) {
+         return fail(path + ": truncated archive");
+      }
+      pos = align_up(start + size, 2);
+      name = name.substr(0, name.find_last_not_of(' ') + 1);
+      if (name.compare("/") == 0 || name.compare("/SYM64/") == 0 || name.compare(0, 9, "__.SYMDEF") == 0) {
+         continue;
+      }
+      if (name.compare("//") == 0) {
+         long_names.assign((const char *)&data[start], size);
+         continue;
+      }
+      if (name.compare(0, 3, "#1/") == 0) {
+         size_t len = strtoul(name.c_str() + 3, nullptr, 10);
+         name.assign((const char *)&data[start], len);
+         name = name.substr(0, name.find('\0'));
+         start += len;
+         size -= len;
+      } else if (name[0] == '/') {
+         size_t off = strtoul(name.c_str() + 1, nullptr, 10);
+         name = long_names.substr(off, long_names.find('\n', off) - off);
+      }
+      if (name.size() && name.back() == '/') {
+         name.pop_back();
+      }
+      Input in{path + "(" + name + ")", Elf_Object(), false, {}};
+      if (!read_object(&data[start], size, in.name, in.obj)) {
+         return false;
+      }
+      inputs.push_back(in);
+   }
+   return true;
+}
+
+//Only allocated sections are kept, debug info and comments are dropped
+//along with their relocations. Relocations stay REL, the addend in the data.
+bool Elf_Linker::read_object(const uint8_t *data, size_t size, const std::string &name, Elf_Object &obj) {
+   if (size < 52 || memcmp(data, "\x7F" "ELF\x01\x01", 6) != 0) {
+      return fail(name + ": not an ELF32 little endian file");
+   }
+   if (elf_get16(data + 16) != 1 || elf_get16(data + 18) != ELF_EM_386) {
+      return fail(name + ": not an i386 relocatable object");
+   }
+   uint32_t shoff = elf_get32(data + 32);
+   uint16_t shnum = elf_get16(data + 48);
+   if (shoff + shnum * 40 > size) {
+      return fail(name + ": truncated");
+   }
+   auto header = [&](int i) { return data + shoff + i * 40; };
+
+   std::vector<int> kept(shnum, -1);
+   for (int i = 0; i < shnum; ++i) {
+      const uint8_t *sh = header(i);
+      uint32_t type = elf_get32(sh + 4);
+      uint32_t flags = elf_get32(sh + 8);
+      if ((type != ELF_SHT_PROGBITS && type != ELF_SHT_NOBITS) || !(flags & ELF_SHF_ALLOC)) {
+         continue;
+      }
+      Elf_Section sec;
+      sec.type = type;
+      sec.flags = flags;
+      sec.align = elf_get32(sh + 32) ? elf_get32(sh + 32) : 1;
+      uint32_t offset = elf_get32(sh + 16);
+      uint32_t sec_size = elf_get32(sh + 20);
+      if (type == ELF_SHT_NOBITS) {
+         sec.nobits_size = sec_size;
+      } else if (offset + sec_size > size) {
+         return fail(name + ": truncated section");
+      } else {
+         sec.data.assign(data + offset, data + offset + sec_size);
+      }
+      kept[i] = obj.sections.size();
+      obj.sections.push_back(sec);
+   }
+
+   for (int i = 0; i < shnum; ++i) {
+      const uint8_t *sh = header(i);
+      uint32_t type = elf_get32(sh + 4);
+      if (type == ELF_SHT_SYMTAB) {
+         const uint8_t *strtab = data + elf_get32(header(elf_get32(sh + 24)) + 16);
+         uint32_t count = elf_get32(sh + 20) / 16;
+         const uint8_t *sym = data + elf_get32(sh + 16);
+         for (uint32_t n = 0; n < count; ++n, sym += 16) {
+            Elf_Symbol s;
+            s.name = (const char *)strtab + elf_get32(sym);
+            s.value = elf_get32(sym + 4);
+            uint8_t bind = sym[12] >> 4;
+            s.global = bind == 1;
+            s.weak = bind == 2;
+            uint16_t shndx = elf_get16(sym + 14);
+            if (shndx == 0) {
+               s.section = ELF_SECTION_UNDEF;
+            } else if (shndx == 0xFFF1) {
+               s.section = ELF_SECTION_ABS;
+            } else if (shndx == 0xFFF2) {
+               return fail(name + ": common symbol '" + s.name + "' is not supported");
+            } else {
+               s.section = (shndx < shnum ? kept[shndx] : -1);
+               if (s.section < 0) {
+                  //defined in a dropped section, nothing allocated can refer to it
+                  s.section = ELF_SECTION_ABS;
+                  s.global = s.weak = false;
+               }
+            }
+            obj.symbols.push_back(s);
+         }
+      } else if (type == 4) {
+         return fail(name + ": RELA relocations are not supported");
+      }
+   }
+
+   for (int i = 0; i < shnum; ++i) {
+      const uint8_t *sh = header(i);
+      if (elf_get32(sh + 4) != ELF_SHT_REL) {
+         continue;
+      }
+      uint32_t target = elf_get32(sh + 28);
+      if (target >= shnum || kept[target] < 0) {
+         continue;
+      }
+      uint32_t count = elf_get32(sh + 20) / 8;
+      const uint8_t *rel = data + elf_get32(sh + 16);
+      for (uint32_t n = 0; n < count; ++n, rel += 8) {
+         uint32_t info = elf_get32(rel + 4);
+         uint8_t type = info & 0xFF;
+         if (type != ELF_R_386_32 && type != ELF_R_386_PC32) {
+            return fail(name + ": unsupported relocation type " + std::to_string(type));
+         }
+         if ((info >> 8) >= obj.symbols.size()) {
+            return fail(name + ": bad relocation symbol");
+         }
+         obj.sections[kept[target]].relocs.push_back(Elf_Reloc{elf_get32(rel), (int)(info >> 8), type});
+      }
+   }
+   return true;
+}
+
+bool Elf_Linker::define_globals(int input) {
+   Elf_Object &obj = inputs[input].obj;
+   for (size_t i = 0; i < obj.symbols.size(); ++i) {
+      Elf_Symbol &sym = obj.symbols[i];
+      if ((!sym.global && !sym.weak) || sym.section == ELF_SECTION_UNDEF) {
+         continue;
+      }
+      auto found = globals.find(sym.name);
+      if (found == globals.end()) {
+         globals[sym.name] = Definition{input, (int)i};
+         continue;
+      }
+      const Elf_Symbol &prev = inputs[found->second.input].obj.symbols[found->second.symbol];
+      if (!sym.weak && !prev.weak) {
+         return fail("multiple definition of '" + sym.name + "' in " + inputs[input].name
+            + " and " + inputs[found->second.input].name);
+      }
+      if (prev.weak && !sym.weak) {
+         found->second = Definition{input, (int)i};
+      }
+   }
+   return true;
+}
+
+bool Elf_Linker::resolve(Input &in, int sym_index, uint32_t &address) {
+   const Elf_Symbol *sym = &in.obj.symbols[sym_index];
+   const Input *def = &in;
+   if (sym->section == ELF_SECTION_UNDEF || sym->global) {
+      auto found = globals.find(sym->name);
+      if (found == globals.end()) {
+         if (sym->weak) {
+            address = 0;
+            return true;
+         }
+         return fail("undefined reference to '" + sym->name + "' in " + in.name);
+      }
+      def = &inputs[found->second.input];
+      sym = &def->obj.symbols[found->second.symbol];
+   }
+   address = sym->value + (sym->section == ELF_SECTION_ABS ? 0 : def->addresses[sym->section]);
+   return true;
+}
+
+bool Elf_Linker::link(const std::string &path, const std::string &entry) {
+   std::vector<uint8_t> file;
+   if (!link_image(file, entry)) {
+      return false;
+   }
+   FILE *f = fopen(path.c_str(), "wb");
+   if (!f) {
+      return fail("can't write " + path);
+   }
+   bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+   if (fclose(f) != 0 || !ok) {
+      return fail("can't write " + path);
+   }
+   chmod(path.c_str(), 0755);
+   return true;
+}
+
+bool Elf_Linker::link_image(std::vector<uint8_t> &file, const std::string &entry) {
+   for (size_t i = 0; i < inputs.size(); ++i) {
+      if (inputs[i].linked && !define_globals(i)) {
+         return false;
+      }
+   }
+   //pull in archive members until nothing more is needed
+   bool changed = true;
+   while (changed) {
+      changed = false;
+      std::unordered_set<std::string> needed;
+      for (auto &in : inputs) {
+         for (auto &sym : in.obj.symbols) {
+            if (in.linked && sym.section == ELF_SECTION_UNDEF && !sym.weak && !globals.count(sym.name)) {
+               needed.insert(sym.name);
+            }
+         }
+      }
+      for (size_t i = 0; i < inputs.size() && needed.size(); ++i) {
+         if (inputs[i].linked) {
+            continue;
+         }
+         for (auto &sym : inputs[i].obj.symbols) {
+            if (sym.global && sym.section != ELF_SECTION_UNDEF && needed.count(sym.name)) {
+               inputs[i].linked = changed = true;
+               break;
+            }
+         }
+         if (inputs[i].linked && !define_globals(i)) {
+            return false;
+         }
+      }
+   }
+
+   //Text and rodata share the first segment with the headers, data starts
+   //on a new page so it can be writable, bss follows it in memory only.
+   bool has_data = false;
+   for (auto &in : inputs) {
+      for (auto &sec : in.obj.sections) {
+         has_data |= in.linked && get_out_section(sec) >= OUT_DATA;
+      }
+   }
+   file.assign(HEADERS_SIZE, 0);
+   uint32_t out_start[OUT_COUNT];
+   uint32_t out_end[OUT_COUNT];
+   uint32_t data_offset = 0;
+   uint32_t mem_end = 0;
+   for (int out = 0; out < OUT_COUNT; ++out) {
+      if (out == OUT_DATA && has_data) {
+         data_offset = align_up(file.size(), PAGE_SIZE);
+         file.resize(data_offset, 0);
+      }
+      if (out == OUT_BSS) {
+         mem_end = file.size();
+      }
+      out_start[out] = (out == OUT_BSS ? mem_end : file.size());
+      for (int cold = 0; cold < 2; ++cold) {
+         for (auto &in : inputs) {
+            if (!in.linked) {
+               continue;
+            }
+            in.addresses.resize(in.obj.sections.size());
+            for (size_t s = 0; s < in.obj.sections.size(); ++s) {
+               Elf_Section &sec = in.obj.sections[s];
+               if (get_out_section(sec) != out || is_cold_text(sec) != (cold == 1)) {
+                  continue;
+               }
+               if (out == OUT_BSS) {
+                  mem_end = align_up(mem_end, sec.align);
+                  in.addresses[s] = LOAD_BASE + mem_end;
+                  mem_end += sec.nobits_size;
+               } else {
+                  file.resize(align_up(file.size(), sec.align), out == OUT_TEXT ? 0x90 : 0);
+                  in.addresses[s] = LOAD_BASE + file.size();
+                  file.insert(file.end(), sec.data.begin(), sec.data.end());
+               }
+            }
+         }
+      }
+      out_end[out] = (out == OUT_BSS ? mem_end : file.size());
+   }
+
+   for (auto &in : inputs) {
+      if (!in.linked) {
+         continue;
+      }
+      for (size_t s = 0; s < in.obj.sections.size(); ++s) {
+         for (auto &r : in.obj.sections[s].relocs) {
+            uint32_t target;
+            if (!resolve(in, r.symbol, target)) {
+               return false;
+            }
+            uint32_t place = in.addresses[s] + r.offset;
+            uint8_t *field = &file[place - LOAD_BASE];
+            uint32_t value = elf_get32(field) + target;
+            if (r.type == ELF_R_386_PC32) {
+               value -= place;
+            }
+            elf_set32(field, value);
+         }
+      }
+   }
+
+   auto start = globals.find(entry);
+   if (start == globals.end()) {
+      return fail("no entry point '" + entry + "'");
+   }
+   uint32_t entry_addr = 0;
+   if (!resolve(inputs[start->second.input], start->second.symbol, entry_addr)) {
+      return false;
+   }
+
+   //section headers only so that tools can find their way around
+   std::vector<uint8_t> shstrtab(1, 0);
+   std::vector<uint8_t> sh(40, 0);
+   int shnum = 1;
+   for (int out = 0; out < OUT_COUNT; ++out) {
+      if (out_end[out] == out_start[out]) {
+         continue;
+      }
+      elf_put32(sh, shstrtab.size());
+      shstrtab.insert(shstrtab.end(), out_names[out], out_names[out] + strlen(out_names[out]) + 1);
+      elf_put32(sh, out == OUT_BSS ? ELF_SHT_NOBITS : ELF_SHT_PROGBITS);
+      elf_put32(sh, ELF_SHF_ALLOC | (out == OUT_TEXT ? ELF_SHF_EXECINSTR : 0) | (out >= OUT_DATA ? ELF_SHF_WRITE : 0));
+      elf_put32(sh, LOAD_BASE + out_start[out]);
+      elf_put32(sh, out == OUT_BSS ? out_end[OUT_DATA] : out_start[out]);
+      elf_put32(sh, out_end[out] - out_start[out]);
+      elf_put32(sh, 0);
+      elf_put32(sh, 0);
+      elf_put32(sh, 16);
+      elf_put32(sh, 0);
+      shnum++;
+   }
+   elf_put32(sh, shstrtab.size());
+   const char shstrtab_name[] = ".shstrtab";
+   shstrtab.insert(shstrtab.end(), shstrtab_name, shstrtab_name + sizeof(shstrtab_name));
+   elf_put32(sh, ELF_SHT_STRTAB);
+   for (int i = 0; i < 2; ++i) {
+      elf_put32(sh, 0);
+   }
+   elf_put32(sh, file.size());
+   elf_put32(sh, shstrtab.size());
+   for (int i = 0; i < 4; ++i) {
+      elf_put32(sh, i == 2 ? 1 : 0);
+   }
+   shnum++;
+   file.insert(file.end(), shstrtab.begin(), shstrtab.end());
+   file.resize(align_up(file.size(), 4), 0);
+   uint32_t shoff = file.size();
+   file.insert(file.end(), sh.begin(), sh.end());
+
+   std::vector<uint8_t> headers = { 0x7F, 'E', 'L', 'F', 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+   elf_put16(headers, 2); //ET_EXEC
+   elf_put16(headers, ELF_EM_386);
+   elf_put32(headers, 1);
+   elf_put32(headers, entry_addr);
+   elf_put32(headers, 52); //e_phoff
+   elf_put32(headers, shoff);
+   elf_put32(headers, 0);
+   elf_put16(headers, 52);
+   elf_put16(headers, 32);
+   elf_put16(headers, has_data ? 2 : 1);
+   elf_put16(headers, 40);
+   elf_put16(headers, shnum);
+   elf_put16(headers, shnum - 1);
+   //PT_LOAD for the headers, text and rodata, read and execute, then the
+   //writable one for data and bss
+   uint32_t text_end = out_end[OUT_RODATA];
+   uint32_t phdrs[2][8] = {
+      { 1, 0, LOAD_BASE, LOAD_BASE, text_end, text_end, 5, PAGE_SIZE },
+      { 1, data_offset, LOAD_BASE + data_offset, LOAD_BASE + data_offset,
+         out_end[OUT_DATA] - data_offset, out_end[OUT_BSS] - data_offset, 6, PAGE_SIZE },
+   };
+   for (auto &ph : phdrs) {
+      for (uint32_t field : ph) {
+         elf_put32(headers, field);
+      }
+   }
+   std::copy(headers.begin(), headers.end(), file.begin());
+   return true;
+}
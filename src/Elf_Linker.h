@@ -0,0 +1,47 @@
+
+#ifndef ELF_LINKER_H
+#define ELF_LINKER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Elf_Writer.h"
+
+//A static linker for ELF32 i386, enough for a program's object plus the
+//archives it names. Archive members are only linked in when they define
+//something still undefined. The output is a non-PIE executable with one
+//read/execute segment for code and constants and one read/write segment.
+struct Elf_Linker {
+
+   struct Input {
+      std::string name;
+      Elf_Object obj;
+      bool linked;
+      std::vector<uint32_t> addresses; //of each section, once laid out
+   };
+
+   //where a global symbol is defined, input and symbol index
+   struct Definition {
+      int input;
+      int symbol;
+   };
+
+   std::vector<Input> inputs;
+   std::unordered_map<std::string, Definition> globals;
+   std::string error;
+
+   void add_object(const Elf_Object &obj, const std::string &name);
+   bool add_file(const std::string &path);
+   bool link(const std::string &path, const std::string &entry = "_start");
+   //the executable's file contents, for callers that don't want a file
+   bool link_image(std::vector<uint8_t> &file, const std::string &entry = "_start");
+
+   bool fail(const std::string &msg);
+   bool read_object(const uint8_t *data, size_t size, const std::string &name, Elf_Object &obj);
+   bool read_archive(const std::vector<uint8_t> &data, const std::string &path);
+   bool define_globals(int input);
+   bool resolve(Input &in, int sym_index, uint32_t &address);
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <algorithm>
+
+#include "Elf_Writer.h"
+
+int Elf_Object::get_section(const std::string &name) {
+   for (size_t i = 0; i < sections.size(); ++i) {
+      if (sections[i].name.compare(name) == 0) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+//symbols are created on first mention, undefined until a label defines them
+int Elf_Object::get_symbol(const std::string &name) {
+   auto found = symbol_index.find(name);
+   if (found != symbol_index.end()) {
+      return found->second;
+   }
+   Elf_Symbol sym;
+   sym.name = name;
+   symbols.push_back(sym);
+   symbol_index[name] = symbols.size() - 1;
+   return symbols.size() - 1;
+}
+
+static void pad_to(std::vector<uint8_t> &out, uint32_t align) {
+   while (out.size() % align) {
+      out.push_back(0);
+   }
+}
+
+static uint32_t add_string(std::vector<uint8_t> &table, const std::string &str) {
+   uint32_t pos = table.size();
+   table.insert(table.end(), str.begin(), str.end());
+   table.push_back(0);
+   return pos;
+}
+
+struct Section_Header {
+   uint32_t name, type, flags, offset, size, link, info, align, entsize;
+};
+
+//File layout: the header, every section's contents, then the section
+//header table. Sections are numbered from 1 in the order they were
+//created, the relocation and symbol tables come after them.
+bool Elf_Object::write(const std::string &path, uint16_t machine) {
+   std::vector<uint8_t> file(52, 0);
+   std::vector<uint8_t> shstrtab(1, 0);
+   std::vector<Section_Header> headers(1, Section_Header{0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+   for (auto &sec : sections) {
+      pad_to(file, sec.align);
+      uint32_t size = (sec.type == ELF_SHT_NOBITS ? sec.nobits_size : sec.data.size());
+      headers.push_back(Section_Header{add_string(shstrtab, sec.name), sec.type, sec.flags,
+         (uint32_t)file.size(), size, 0, 0, sec.align, sec.entsize});
+      file.insert(file.end(), sec.data.begin(), sec.data.end());
+   }
+
+   //locals have to come before globals in the symbol table
+   std::vector<int> order;
+   std::vector<int> index(symbols.size(), 0);
+   for (int pass = 0; pass < 2; ++pass) {
+      for (size_t i = 0; i < symbols.size(); ++i) {
+         if ((symbols[i].global || symbols[i].weak) == (pass == 1)) {
+            index[i] = order.size() + 1;
+            order.push_back(i);
+         }
+      }
+   }
+   uint32_t first_global = 1;
+   std::vector<uint8_t> symtab(16, 0);
+   std::vector<uint8_t> strtab(1, 0);
+   for (int i : order) {
+      Elf_Symbol &sym = symbols[i];
+      if (!sym.global && !sym.weak) {
+         first_global++;
+      }
+      elf_put32(symtab, add_string(strtab, sym.name));
+      elf_put32(symtab, sym.value);
+      elf_put32(symtab, 0);
+      symtab.push_back((sym.weak ? 2 : sym.global ? 1 : 0) << 4); //STB_WEAK, STB_GLOBAL or STB_LOCAL, STT_NOTYPE
+      symtab.push_back(0);
+      elf_put16(symtab, sym.section == ELF_SECTION_ABS ? 0xFFF1 : sym.section < 0 ? 0 : sym.section + 1);
+   }
+
+   uint32_t symtab_index = sections.size() + 1;
+   for (size_t s = 0; s < sections.size(); ++s) {
+      if (sections[s].relocs.empty()) {
+         continue;
+      }
+      symtab_index++;
+   }
+   for (size_t s = 0; s < sections.size(); ++s) {
+      if (sections[s].relocs.empty()) {
+         continue;
+      }
+      std::vector<uint8_t> rel;
+      for (auto &r : sections[s].relocs) {
+         elf_put32(rel, r.offset);
+         elf_put32(rel, (index[r.symbol] << 8) | r.type);
+      }
+      pad_to(file, 4);
+      headers.push_back(Section_Header{add_string(shstrtab, ".rel" + sections[s].name), ELF_SHT_REL, 0,
+         (uint32_t)file.size(), (uint32_t)rel.size(), symtab_index, (uint32_t)s + 1, 4, 8});
+      file.insert(file.end(), rel.begin(), rel.end());
+   }
+
+   pad_to(file, 4);
+   headers.push_back(Section_Header{add_string(shstrtab, ".symtab"), ELF_SHT_SYMTAB, 0,
+      (uint32_t)file.size(), (uint32_t)symtab.size(), symtab_index + 1, first_global, 4, 16});
+   file.insert(file.end(), symtab.begin(), symtab.end());
+   headers.push_back(Section_Header{add_string(shstrtab, ".strtab"), ELF_SHT_STRTAB, 0,
+      (uint32_t)file.size(), (uint32_t)strtab.size(), 0, 0, 1, 0});
+   file.insert(file.end(), strtab.begin(), strtab.end());
+   uint32_t shstrtab_name = add_string(shstrtab, ".shstrtab");
+   headers.push_back(Section_Header{shstrtab_name, ELF_SHT_STRTAB, 0,
+      (uint32_t)file.size(), (uint32_t)shstrtab.size(), 0, 0, 1, 0});
+   file.insert(file.end(), shstrtab.begin(), shstrtab.end());
+
+   pad_to(file, 4);
+   uint32_t shoff = file.size();
+   for (auto &h : headers) {
+      elf_put32(file, h.name);
+      elf_put32(file, h.type);
+      elf_put32(file, h.flags);
+      elf_put32(file, 0); //sh_addr
+      elf_put32(file, h.offset);
+      elf_put32(file, h.size);
+      elf_put32(file, h.link);
+      elf_put32(file, h.info);
+      elf_put32(file, h.align);
+      elf_put32(file, h.entsize);
+   }
+
+   std::vector<uint8_t> ehdr = { 0x7F, 'E', 'L', 'F', 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+   elf_put16(ehdr, 1); //ET_REL
+   elf_put16(ehdr, machine);
+   elf_put32(ehdr, 1); //EV_CURRENT
+   elf_put32(ehdr, 0); //e_entry
+   elf_put32(ehdr, 0); //e_phoff
+   elf_put32(ehdr, shoff);
+   elf_put32(ehdr, 0); //e_flags
+   elf_put16(ehdr, 52);
+   elf_put16(ehdr, 0);
+   elf_put16(ehdr, 0);
+   elf_put16(ehdr, 40);
+   elf_put16(ehdr, headers.size());
+   elf_put16(ehdr, headers.size() - 1); //.shstrtab is last
+   std::copy(ehdr.begin(), ehdr.end(), file.begin());
+
+   FILE *f = fopen(path.c_str(), "wb");
+   if (!f) {
+      return false;
+   }
+   bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+   return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,96 @@
+
+#ifndef ELF_WRITER_H
+#define ELF_WRITER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+//The few ELF constants the object writer needs, the host may not have <elf.h>
+enum {
+   ELF_EM_386 = 3,
+
+   ELF_SHT_PROGBITS = 1,
+   ELF_SHT_SYMTAB = 2,
+   ELF_SHT_STRTAB = 3,
+   ELF_SHT_NOBITS = 8,
+   ELF_SHT_REL = 9,
+
+   ELF_SHF_WRITE = 0x1,
+   ELF_SHF_ALLOC = 0x2,
+   ELF_SHF_EXECINSTR = 0x4,
+   ELF_SHF_MERGE = 0x10,
+   ELF_SHF_STRINGS = 0x20,
+
+   ELF_R_386_32 = 1,
+   ELF_R_386_PC32 = 2,
+};
+
+inline void elf_put16(std::vector<uint8_t> &out, uint16_t val) {
+   out.push_back(val & 0xFF);
+   out.push_back(val >> 8);
+}
+
+inline void elf_put32(std::vector<uint8_t> &out, uint32_t val) {
+   for (int i = 0; i < 4; ++i) {
+      out.push_back((val >> (8 * i)) & 0xFF);
+   }
+}
+
+inline uint16_t elf_get16(const uint8_t *p) {
+   return p[0] | (p[1] << 8);
+}
+
+inline uint32_t elf_get32(const uint8_t *p) {
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void elf_set32(uint8_t *p, uint32_t val) {
+   for (int i = 0; i < 4; ++i) {
+      p[i] = (val >> (8 * i)) & 0xFF;
+   }
+}
+
+struct Elf_Reloc {
+   uint32_t offset;
+   int symbol;
+   uint8_t type;
+};
+
+struct Elf_Section {
+   std::string name;
+   uint32_t type = ELF_SHT_PROGBITS;
+   uint32_t flags = 0;
+   uint32_t entsize = 0;
+   uint32_t align = 1;
+   std::vector<uint8_t> data;
+   uint32_t nobits_size = 0; //size of a SHT_NOBITS section, it has no data
+   std::vector<Elf_Reloc> relocs;
+};
+
+const int ELF_SECTION_UNDEF = -1;
+const int ELF_SECTION_ABS = -2;
+
+//section is ELF_SECTION_UNDEF until a label defines the symbol
+struct Elf_Symbol {
+   std::string name;
+   int section = ELF_SECTION_UNDEF;
+   uint32_t value = 0;
+   bool global = false;
+   bool weak = false;
+};
+
+//A relocatable object, built up by the built-in assembler and written out
+//as ELF32. Relocations are REL, the addend sits in the relocated field.
+struct Elf_Object {
+   std::vector<Elf_Section> sections;
+   std::vector<Elf_Symbol> symbols;
+   std::unordered_map<std::string, int> symbol_index;
+
+   int get_section(const std::string &name);
+   int get_symbol(const std::string &name);
+   bool write(const std::string &path, uint16_t machine);
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include <algorithm>
+
+#include "Function_Layout.h"
+#include "Whole_Program.h"
+
+//the calls of each function and how often they happen
+void Function_Layout::
+collect_calls(int caller, Scope &scope, long long count) {
+   for (auto &expr : scope.expressions) {
+      for (auto &instr : expr.instructions) {
+         if (instr.type != Instruction::FUNC_CALL) {
+            continue;
+         }
+         //error handling, nothing comes back from it
+         if (!profile && instr.func_call_name.compare("_exit") == 0 && !is_entry_point(functions[caller]->name)) {
+            is_cold[caller] = true;
+         }
+         auto it = index.find(instr.func_call_name);
+         if (it == index.end() || it->second == caller
+            || expr.scope->getFuncByName(instr.func_call_name) != functions[it->second]) {
+            continue;
+         }
+         calls[std::make_pair(std::min(caller, it->second), std::max(caller, it->second))] += count;
+         if (!profile) {
+            heat[it->second] += count;
+         }
+      }
+      Scope &inner = *expr.scope;
+      long long inner_count = -1;
+      if (profile && inner.is_loop()) {
+         inner_count = profile->iterations(inner);
+      } else if (profile && inner.profile_id >= 0) {
+         inner_count = profile->entries(inner); //an inlined copy
+      }
+      if (inner_count < 0) {
+         inner_count = inner.is_loop() ? std::min(count * 10, 10000LL) : count;
+      }
+      collect_calls(caller, inner, inner_count);
+   }
+}
+
+std::vector<int> Function_Layout::
+get_order() {
+   std::vector<std::vector<int>> chains(functions.size());
+   std::vector<int> chain_of(functions.size());
+   for (size_t f = 0; f < functions.size(); ++f) {
+      chains[f].push_back(f);
+      chain_of[f] = f;
+   }
+   std::vector<std::pair<std::pair<int, int>, long long>> edges(calls.begin(), calls.end());
+   std::stable_sort(edges.begin(), edges.end(), [](const std::pair<std::pair<int, int>, long long> &a,
+      const std::pair<std::pair<int, int>, long long> &b) {
+      return a.second > b.second;
+   });
+   for (auto &edge : edges) {
+      int a = edge.first.first;
+      int b = edge.first.second;
+      if (edge.second <= 0 || is_cold[a] || is_cold[b] || chain_of[a] == chain_of[b]) {
+         continue;
+      }
+      std::vector<int> &first = chains[chain_of[a]];
+      std::vector<int> &second = chains[chain_of[b]];
+      //a goes to the end of its chain and b to the start of its own, as near as they can
+      size_t pos_a = std::find(first.begin(), first.end(), a) - first.begin();
+      if (pos_a < first.size() - 1 - pos_a) {
+         std::reverse(first.begin(), first.end());
+      }
+      size_t pos_b = std::find(second.begin(), second.end(), b) - second.begin();
+      if (pos_b > second.size() - 1 - pos_b) {
+         std::reverse(second.begin(), second.end());
+      }
+      for (int f : second) {
+         chain_of[f] = chain_of[a];
+      }
+      first.insert(first.end(), second.begin(), second.end());
+      second.clear();
+   }
+
+   std::vector<std::pair<long long, int>> hot_chains;
+   for (size_t c = 0; c < chains.size(); ++c) {
+      if (chains[c].empty() || is_cold[chains[c][0]]) {
+         continue;
+      }
+      long long chain_heat = 0;
+      for (int f : chains[c]) {
+         chain_heat += heat[f];
+      }
+      hot_chains.push_back(std::make_pair(chain_heat, c));
+   }
+   std::stable_sort(hot_chains.begin(), hot_chains.end(), [](const std::pair<long long, int> &a,
+      const std::pair<long long, int> &b) {
+      return a.first > b.first;
+   });
+   std::vector<int> order;
+   for (auto &chain : hot_chains) {
+      order.insert(order.end(), chains[chain.second].begin(), chains[chain.second].end());
+   }
+   for (size_t f = 0; f < functions.size(); ++f) {
+      if (is_cold[f]) {
+         order.push_back(f);
+      }
+   }
+   return order;
+}
+
+//Only the functions of the global scope move, each into a place another
+//one left, asm and prototypes stay where they were written.
+void Function_Layout::
+arrange(Scope &scope) {
+   for (auto &func : scope.functions) {
+      if (func.plain_instructions || func.is_not_definition || func.should_inline || func.name.compare("__asm__") == 0) {
+         continue;
+      }
+      index[func.name] = functions.size();
+      functions.push_back(&func);
+   }
+   heat.assign(functions.size(), 0);
+   is_cold.assign(functions.size(), false);
+   for (size_t f = 0; f < functions.size(); ++f) {
+      long long count = profile ? profile->entries(*functions[f]->scope) : -1;
+      if (count >= 0) {
+         heat[f] = count;
+         is_cold[f] = count == 0;
+      }
+      collect_calls(f, *functions[f]->scope, count >= 0 ? count : 1);
+   }
+
+   std::vector<int> order = get_order();
+   std::vector<Function> arranged;
+   arranged.reserve(scope.functions.size());
+   size_t next = 0;
+   for (auto &func : scope.functions) {
+      auto it = index.find(func.name);
+      if (it == index.end() || functions[it->second] != &func) {
+         arranged.push_back(func);
+         continue;
+      }
+      int f = order[next++];
+      arranged.push_back(*functions[f]);
+      arranged.back().is_cold = is_cold[f];
+   }
+   scope.functions.swap(arranged);
+   for (auto &func : scope.functions) {
+      func.scope->function = &func;
+   }
+   functions.clear(); //they moved
+}
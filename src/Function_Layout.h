@@ -0,0 +1,37 @@
+
+#ifndef FUNCTION_LAYOUT_H
+#define FUNCTION_LAYOUT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+#include "Code_Structure.h"
+#include "Profile.h"
+
+//Function ordering for -freorder-functions.
+//Functions are laid out Pettis-Hansen style: starting with every function
+//in a chain of its own, the chains of the two ends of the most frequent
+//call are joined, turned so that caller and callee end up as close as they
+//can, down to the least frequent one. The busiest chains come first. Call
+//frequencies come from the profile when there is one and are estimated
+//from the call sites otherwise, ten times as many in a loop.
+//Functions that never ran, or without a profile ones that end in _exit,
+//are cold and move to the target's cold text section, out of the way.
+struct Function_Layout {
+   Profile *profile = nullptr; //counts from -fprofile-use, if any
+   std::vector<Function *> functions; //the ones that move, in program order
+   std::unordered_map<std::string, int> index;
+   std::map<std::pair<int, int>, long long> calls; //between two functions, either way
+   std::vector<long long> heat; //calls of each function
+   std::vector<bool> is_cold;
+
+   void arrange(Scope &scope);
+
+private:
+   void collect_calls(int caller, Scope &scope, long long count);
+   std::vector<int> get_order();
+};
+
+#endif
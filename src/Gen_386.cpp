@@ -1,74 +1,258 @@
+#include <cmath>
+#include <algorithm>
+
 #include "Gen_386.h"
+#include "Gen_SSE.h"
 
 // const Variable REG_FRAME = create_register("_REG_FRAME");
 
-void Gen_386::
-gen_rodata() {
-   for (size_t i = 0; i < rodata_data.size(); i++) {
-      os << rodata_labels[i] << ":" << std::endl;
-      Variable *var = &rodata_data[i];
-      if (var->type == Variable::DQString) {
-          os << "\t.asciz \"";
-          for (char c : var->dqstring) {
-            if (c >= 0x20 && c < 0x7F) {
-               os << c;
-            } else if (c == '\n') {
-               os << "\\n";
-            }
-          }
-          os << "\"" << std::endl;
-      }
+//64-bit parameters take two argument words, low half first
+StackMan::Frame_Slot StackMan_i386::get_param_slot(size_t n, Scope &scope) {
+   int words = get_arg_words(params, n);
+   if (code_gen->uses_frame_pointer()) {
+      return { words * 4 + 8, true, true, params[n].type }; // +8 accounts for push %ebp and 4 byte return address
+   }
+   //+4 for the return address, then everything pushed or reserved since entry
+   int offset = words * 4 + 4 + code_gen->reg_alloc.saved_registers.size() * 4 + code_gen->gen_stack_unwind(scope);
+   return { offset, false, true, params[n].type };
+}
+
+std::string StackMan_i386::format_slot(Frame_Slot slot) {
+   return std::to_string(slot.offset) + (slot.frame_based ? "(%ebp)" : "(%esp)");
+}
+
+static int get_type_size(Variable::VType type) {
+   switch (type) {
+      case Variable::CHAR:
+      case Variable::INT_8BIT: return 1;
+      case Variable::INT_16BIT: return 2;
+      case Variable::INT_64BIT: return 8;
+      default: return 4;
+   }
+}
+
+//locals take their natural size, 64-bit values are 4-byte aligned like long long in the i386 ABI
+int StackMan_i386::get_var_size(const Variable &var) {
+   return var.is_vector() ? 16 : get_type_size(var.type);
+}
+
+int StackMan_i386::get_var_align(const Variable &var) {
+   return std::min(get_var_size(var), 4);
+}
+
+static bool is_memory_operand(const std::string &op) {
+   return op.size() && op[0] != '%' && op[0] != '$';
+}
+
+static std::string get_size_suffix(int size) {
+   return size == 1 ? "b" : (size == 2 ? "w" : "l");
+}
+
+//char is unsigned, the sized integers are signed
+static std::string get_extend_op(Variable::VType type) {
+   switch (type) {
+      case Variable::CHAR: return "movzbl";
+      case Variable::INT_8BIT: return "movsbl";
+      default: return "movswl";
    }
 }
 
+//%al, %ax and the like, empty for %esi, %edi and %ebp which have no byte form
+static std::string get_sub_register(const std::string &reg, int size) {
+   if (size == 2) {
+      return "%" + reg.substr(2);
+   }
+   if (reg.size() == 4 && reg[3] == 'x') {
+      return "%" + reg.substr(2, 1) + "l";
+   }
+   return "";
+}
+
+//Frames are sized so that %esp is 16-byte aligned at every call: the
+//function's frame makes up for the return address, saved registers and
+//frame pointer. It holds the variables of every block in the function, and
+//the outgoing argument area sits at its bottom. Blocks have no frame of
+//their own. Leaf functions make no calls, so they reserve only variables.
+int Gen_386::get_frame_size(Scope &scope) {
+   if (!stack_man->is_frame_scope(scope)) {
+      return 0;
+   }
+   int size = stack_man->get_frame_bytes(scope);
+   if (scope.is_function && reg_alloc.pic_base_spilled) {
+      size += 4; //the PIC base's slot, right above the outgoing arguments
+   }
+   if (!reg_alloc.has_calls || (!scope.is_function && size == 0)) {
+      return size;
+   }
+   size += reg_alloc.max_call_words * 4;
+   int entry = 0;
+   if (scope.is_function) {
+      entry = 4 + reg_alloc.saved_registers.size() * 4 + (uses_frame_pointer() ? 4 : 0);
+   }
+   return ((size + entry + 15) & ~15) - entry;
+}
+
 void Gen_386::gen_stack_alignment(Scope &scope) {
-   int padding = 16 - ((scope.variables.size() * 4) % 16);
-   if (padding == 16) padding = 0;
-   int stack_adj = scope.variables.size() * 4 + padding;
-   if (scope.variables.size() > 0) {
+   int stack_adj = get_frame_size(scope);
+   if (stack_adj > 0) {
       printf("stack_align %d\n", stack_adj);
       emit_sub(create_const_int32(stack_adj), REG_STACK);
    }
 }
 
 void Gen_386::gen_stack_unalignment(Scope &scope) {
-   int padding = 16 - ((scope.variables.size() * 4) % 16);
-   if (padding == 16) padding = 0;
-   int stack_adj = scope.variables.size() * 4 + padding;
-   if (scope.variables.size() > 0) {
+   int stack_adj = get_frame_size(scope);
+   if (stack_adj > 0) {
       emit_add(create_const_int32(stack_adj), REG_STACK);
    }
 }
 
-void Gen_386::gen_stack_pop_params(std::vector<Variable> &plist) {
-   unsigned int stack_align = (16 - (plist.size() * 4));
-   stack_align += plist.size() * 4;
-   if (plist.size() == 0) stack_align = 0;
-   if (plist.size()) {
-      emit_add(create_const_int32(stack_align), REG_STACK);
+//functions that reuse rodata compute the PIC base once on entry, into the
+//callee-saved register Reg_Alloc gave it or else into its frame slot
+void Gen_386::gen_pic_base() {
+   const Variable *base = reg_alloc.get_pic_base(*this);
+   if (!base && !reg_alloc.pic_base_spilled) {
+      return;
+   }
+   pic_base_label = get_new_label();
+   emit_call(pic_base_label);
+   emit_label(pic_base_label);
+   if (base) {
+      emit_pop(*base);
+      return;
    }
+   emit_pop(REG_INDEX);
+   emit_instr("movl", { "%ecx", gen_pic_slot() });
 }
 
-int Gen_386::gen_stack_unwind(Scope &scope) {
-   int padding = 16 - ((scope.variables.size() * 4) % 16);
-   if (padding == 16) padding = 0;
-   int stack_adj = scope.variables.size() * 4 + padding;
+std::string Gen_386::gen_pic_slot() {
+   int offset = (reg_alloc.has_calls ? reg_alloc.max_call_words * 4 : 0) + stack_man->ext_adj;
+   return std::to_string(offset) + "(%esp)";
+}
 
-   if (scope.variables.size() == 0) {
-      stack_adj = 0;
+//the register holding the PIC base, reloaded into %ecx when it was spilled
+const Variable *Gen_386::load_pic_base() {
+   const Variable *base = reg_alloc.get_pic_base(*this);
+   if (base || !reg_alloc.pic_base_spilled) {
+      return base;
    }
-   //printf("Stack_adj: %d\n", stack_adj);
-   if (scope.is_function) {
-      return stack_adj;
+   emit_instr("movl", { gen_pic_slot(), "%ecx" });
+   return &REG_INDEX;
+}
+
+//arguments are stored straight into the outgoing area instead of being pushed
+void Gen_386::gen_func_params(Function &func, std::vector<Variable> &plist) {
+   for (size_t i = 0; i < plist.size(); ++i) {
+      int word = get_arg_words(func.parameters, i);
+      Variable low = create_register(REGISTER_OUTGOING_ARG + std::to_string(word));
+      if (get_arg_words(func.parameters, i + 1) - word == 1) {
+         emit_mov(plist[i], low);
+         continue;
+      }
+      Variable high = create_register(REGISTER_OUTGOING_ARG + std::to_string(word + 1));
+      if (plist[i].is_type_const) {
+         emit_instr("movl", { gen_half(plist[i], false), gen_var(low) });
+         emit_instr("movl", { gen_half(plist[i], true), gen_var(high) });
+         continue;
+      }
+      emit_load_wide(plist[i]);
+      emit_instr("movl", { "%eax", gen_var(low) });
+      emit_instr("movl", { "%edx", gen_var(high) });
+   }
+}
+
+//The arguments are rewritten into our own incoming argument slots, so the
+//callee can only take as many arguments as we were given.
+bool Gen_386::gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope) {
+   std::vector<Variable> &params = current_function->parameters;
+   if (plist.size() > params.size()) {
+      return false;
+   }
+   //the slots are rewritten a word at a time
+   for (size_t i = 0; i < plist.size(); ++i) {
+      if ((i < func.parameters.size() && func.parameters[i].type == Variable::INT_64BIT)
+         || params[i].type == Variable::INT_64BIT) {
+         return false;
+      }
+   }
+
+   //an argument passed straight through from its own slot needs no rewrite
+   std::vector<bool> in_place(plist.size(), false);
+   for (size_t i = 0; i < plist.size(); ++i) {
+      in_place[i] = plist[i].name.compare(params[i].name) == 0 && !stack_man->get_register(plist[i]);
+   }
+
+   //every argument is evaluated before any slot is overwritten, they may read each other
+   int adj = 0;
+   for (int i = plist.size() - 1; i >= 0; i--) {
+      if (in_place[i]) {
+         continue;
+      }
+      stack_man->ext_adj = adj;
+      emit_push(plist[i]);
+      adj += 4;
+   }
+   reg_alloc.enabled = false;
+   for (size_t i = 0; i < plist.size(); ++i) {
+      if (in_place[i]) {
+         continue;
+      }
+      //pop addresses its destination after %esp has moved up
+      adj -= 4;
+      stack_man->ext_adj = adj;
+      emit_pop(params[i]);
+   }
+   stack_man->ext_adj = 0;
+   reg_alloc.enabled = true;
+
+   int stack_adj = gen_stack_unwind(scope);
+   if (stack_adj > 0) {
+      emit_add(create_const_int32(stack_adj), REG_STACK);
+   }
+   if (func.name.compare(current_function->name) == 0) {
+      //self recursion keeps the frame and loops back past the prologue
+      emit_jump(get_tail_label(func));
+   } else {
+      emit_function_footer();
+      emit_jump(func.name);
+   }
+   return true;
+}
+
+//the caller has to pop a float result off the x87 stack even if it ignores it
+void Gen_386::gen_discard_float_return() {
+   emit_instr("fstp", { "%st(0)" });
+}
+
+static bool is_xmm_operand(const std::string &op) {
+   return op.compare(0, 4, "%xmm") == 0;
+}
+
+//a float constant as an SSE source operand, out of the literal pool
+std::string Gen_386::gen_float_const(Variable var) {
+   if (var.type != Variable::FLOAT_32BIT) {
+      var = create_const_float32(var.pvalue);
+   }
+   if (!pic) {
+      return get_rodata(var);
+   }
+   const Variable *base = load_pic_base();
+   if (base) {
+      return get_rodata(var) + " - " + pic_base_label + "(" + gen_var(*base) + ")";
    }
-   //printf("ret: %d\n", stack_adj);
-   return (scope.parent ? gen_stack_unwind(*scope.parent) + stack_adj : stack_adj);
+   //no base to address it off, build the bits in %eax instead
+   emit_instr("movl", { "$" + std::to_string(get_float_bits(var.fvalue)), "%eax" });
+   return gen_var(REG_ACCUMULATOR);
 }
 
 std::string  Gen_386::gen_var(Variable var) {
 
    if (var.name.compare(REGISTER_RETURN) == 0) {
       return "%eax";
+   } else if (var.name.compare(REGISTER_FLOAT_RETURN) == 0) {
+      return "%st";
+   } else if (var.name.compare(0, REGISTER_FLOAT_SAVED.size(), REGISTER_FLOAT_SAVED) == 0) {
+      return "%xmm" + std::to_string(2 + std::stoi(var.name.substr(REGISTER_FLOAT_SAVED.size())));
    } else if (var.name.compare(REGISTER_ACCUMULATOR) == 0) {
       return "%eax";
    } else if (var.name.compare(REGISTER_INDEX) == 0) {
@@ -77,18 +261,34 @@ std::string  Gen_386::gen_var(Variable var) {
       return "%esp";
    } else if (var.name.compare(REGISTER_FRAME_POINTER) == 0) {
       return "%ebp";
+   } else if (var.name.compare(0, REGISTER_SAVED.size(), REGISTER_SAVED) == 0) {
+      static const char *saved[] = { "%ebx", "%esi", "%edi" };
+      return saved[std::stoi(var.name.substr(REGISTER_SAVED.size()))];
+   } else if (var.name.compare(0, REGISTER_OUTGOING_ARG.size(), REGISTER_OUTGOING_ARG) == 0) {
+      return std::to_string(std::stoi(var.name.substr(REGISTER_OUTGOING_ARG.size())) * 4) + "(%esp)";
+   } else if (var.name.compare(0, REGISTER_INDIRECT.size(), REGISTER_INDIRECT) == 0) {
+      return var.name.substr(REGISTER_INDIRECT.size()) + "(%ecx)";
    }
 
-   else if (var.is_type_const && var.type == Variable::INT_32BIT) {
+   else if (var.is_type_const && var.type == Variable::INT_64BIT) {
+      return gen_half(var, false);
+   } else if (var.is_type_const && is_integer_type(var.type)) {
       return std::string("$") + std::to_string(var.pvalue);
    } else if (var.is_type_const && var.type == Variable::FLOAT_32BIT) {
-      float val = var.fvalue;
-      return std::string("$") + std::to_string(*(int *)&val);
+      return std::string("$") + std::to_string(get_float_bits(var.fvalue));
    } else if (var.type == Variable::DQString) {
+      if (!pic) {
+         return "$" + get_rodata(var);
+      }
+      const Variable *base = load_pic_base();
+      if (base) {
+         emit_instr("lea", { get_rodata(var) + " - " + pic_base_label + "(" + gen_var(*base) + ")", "%eax" });
+         return gen_var(REG_ACCUMULATOR);
+      }
       emit_call(get_new_label());
-      os << get_old_label() << ":" << std::endl;
+      emit_label(get_old_label());
       emit_pop(REG_INDEX);
-      os << '\t' << "lea " << get_rodata(var) << " - " << get_old_label() << "(%ecx), %eax" << std::endl;
+      emit_instr("lea", { get_rodata(var) + " - " + get_old_label() + "(%ecx)", "%eax" });
       return gen_var(REG_ACCUMULATOR);
    } else {
        return stack_man->load_var(var);
@@ -96,93 +296,612 @@ std::string  Gen_386::gen_var(Variable var) {
 }
 
 void Gen_386::emit_cmp(Variable src0, Variable src1) {
+   float_compare = src1.type == Variable::FLOAT_32BIT;
+   if (float_compare) {
+      std::string left_s = gen_var(src1);
+      if (!is_xmm_operand(left_s)) {
+         emit_instr("movss", { left_s, "%xmm0" });
+         left_s = "%xmm0";
+      }
+      std::string right_s = src0.is_type_const ? gen_float_const(src0) : gen_var(src0);
+      if (right_s[0] == '%' && !is_xmm_operand(right_s)) {
+         emit_instr("movd", { right_s, "%xmm1" });
+         right_s = "%xmm1";
+      }
+      emit_instr("ucomiss", { right_s, left_s });
+      return;
+   }
+   wide_compare = get_mem_type(src0) == Variable::INT_64BIT || get_mem_type(src1) == Variable::INT_64BIT;
+   if (wide_compare) {
+      wide_left = src1;
+      wide_right = src0;
+      return;
+   }
    std::string dst_s = gen_var(src1);
    //std::string src_s = gen_var(src0);
    emit_mov(src0, REG_ACCUMULATOR);
-   os << '\t' << "cmp " << "%eax" << ", " << dst_s << std::endl;
+   Variable::VType left_type = get_mem_type(src1);
+   if (is_memory_operand(dst_s) && get_type_size(left_type) < 4) {
+      emit_instr(get_extend_op(left_type), { dst_s, "%ecx" });
+      dst_s = "%ecx";
+   }
+   emit_instr("cmp", { "%eax", dst_s });
 }
 
 void Gen_386::emit_inc(Variable dst) {
+   if (dst.type == Variable::FLOAT_32BIT) {
+      std::string dst_s = gen_var(dst);
+      std::string one_s = gen_float_const(create_const_float32(1.0f));
+      if (one_s[0] == '%') {
+         emit_instr("movd", { one_s, "%xmm1" });
+         one_s = "%xmm1";
+      }
+      if (is_xmm_operand(dst_s)) {
+         emit_instr("addss", { one_s, dst_s });
+         return;
+      }
+      emit_instr("movss", { dst_s, "%xmm0" });
+      emit_instr("addss", { one_s, "%xmm0" });
+      emit_instr("movss", { "%xmm0", dst_s });
+      return;
+   }
    emit_add(create_const_int32(1), dst);
 }
 
 void Gen_386::emit_push(Variable src) {
    std::string src_s = gen_var(src);
-   os << '\t' << "push " << src_s << std::endl;
+   Variable::VType type = get_mem_type(src);
+   if (is_memory_operand(src_s) && get_type_size(type) < 4) {
+      emit_instr(get_extend_op(type), { src_s, "%eax" });
+      src_s = "%eax";
+   }
+   if (is_xmm_operand(src_s)) {
+      emit_instr("sub", { "$4", "%esp" });
+      emit_instr("movss", { src_s, "(%esp)" });
+      return;
+   }
+   emit_instr("push", { src_s });
 }
 
 void Gen_386::emit_pop(Variable dst) {
    std::string dst_s = gen_var(dst);
-   os << '\t' << "pop " << dst_s << std::endl;
+   emit_instr("pop", { dst_s });
+}
+
+//Moves that involve an XMM register or the x87 return value. Float results
+//come back in st(0) under cdecl, which only talks to memory, so a value in
+//an XMM register goes through a temporary stack slot.
+void Gen_386::emit_float_mov(Variable src, std::string src_s, Variable dst, std::string dst_s) {
+   bool src_st = src.name.compare(REGISTER_FLOAT_RETURN) == 0;
+   bool dst_st = dst.name.compare(REGISTER_FLOAT_RETURN) == 0;
+   if (src_st && dst_st) {
+      return;
+   }
+   if (dst_st) {
+      if (src.is_type_const || src_s[0] == '%') {
+         if (src.is_type_const) {
+            emit_instr("push", { src_s });
+         } else if (is_xmm_operand(src_s)) {
+            emit_instr("sub", { "$4", "%esp" });
+            emit_instr("movss", { src_s, "(%esp)" });
+         } else {
+            emit_instr("push", { src_s });
+         }
+         emit_instr("flds", { "(%esp)" });
+         emit_instr("add", { "$4", "%esp" });
+      } else {
+         emit_instr("flds", { src_s });
+      }
+      return;
+   }
+   if (src_st) {
+      if (is_xmm_operand(dst_s)) {
+         emit_instr("sub", { "$4", "%esp" });
+         emit_instr("fstps", { "(%esp)" });
+         emit_instr("movss", { "(%esp)", dst_s });
+         emit_instr("add", { "$4", "%esp" });
+      } else if (dst_s[0] == '%') {
+         emit_instr("sub", { "$4", "%esp" });
+         emit_instr("fstps", { "(%esp)" });
+         emit_instr("pop", { dst_s });
+      } else {
+         emit_instr("fstps", { dst_s });
+      }
+      return;
+   }
+   if (is_xmm_operand(dst_s)) {
+      if (src.is_type_const) {
+         if (src.type == Variable::FLOAT_32BIT && src.fvalue == 0.0f && !std::signbit(src.fvalue)) {
+            emit_instr("xorps", { dst_s, dst_s });
+            return;
+         }
+         src_s = gen_float_const(src);
+      }
+      if (is_xmm_operand(src_s)) {
+         if (src_s.compare(dst_s) != 0) {
+            emit_instr("movaps", { src_s, dst_s });
+         }
+      } else if (src_s[0] == '%') {
+         emit_instr("movd", { src_s, dst_s });
+      } else {
+         emit_instr("movss", { src_s, dst_s });
+      }
+      return;
+   }
+   //only the source is an XMM register
+   if (dst_s[0] == '%') {
+      emit_instr("movd", { src_s, dst_s });
+   } else {
+      emit_instr("movss", { src_s, dst_s });
+   }
 }
 
 void Gen_386::emit_mov(Variable src, Variable dst) {
+   if (get_mem_type(dst) == Variable::INT_64BIT) {
+      if (src.is_type_const) {
+         emit_instr("movl", { gen_half(src, false), gen_half(dst, false) });
+         emit_instr("movl", { gen_half(src, true), gen_half(dst, true) });
+         return;
+      }
+      emit_load_wide(src);
+      emit_instr("movl", { "%eax", gen_half(dst, false) });
+      emit_instr("movl", { "%edx", gen_half(dst, true) });
+      return;
+   }
+   if (dst.name.compare(REGISTER_RETURN) == 0 && get_mem_type(src) == Variable::INT_64BIT) {
+      emit_load_wide(src);
+      return;
+   }
    std::string dst_s = gen_var(dst);
-   std::string src_s = gen_var(src);
-   os << '\t' << "movl " << src_s << ", " << dst_s << std::endl;
+   std::string src_s = src.is_type_const ? "" : gen_var(src);
+   if (is_xmm_operand(src_s) || is_xmm_operand(dst_s) || src.name.compare(REGISTER_FLOAT_RETURN) == 0
+      || dst.name.compare(REGISTER_FLOAT_RETURN) == 0) {
+      if (src.is_type_const && !is_xmm_operand(dst_s)) {
+         src_s = gen_var(src);
+      }
+      emit_float_mov(src, src_s, dst, dst_s);
+      return;
+   }
+   if (src.is_type_const) {
+      src_s = gen_var(src);
+   }
+   Variable::VType src_type = get_mem_type(src);
+   if (!is_memory_operand(dst_s) && is_memory_operand(src_s) && get_type_size(src_type) < 4) {
+      emit_instr(get_extend_op(src_type), { src_s, dst_s });
+      return;
+   }
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 4;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("mov" + get_size_suffix(size), { src_s, dst_s });
+}
+
+//The declared type of a variable that lives in memory. Registers hold
+//narrow values widened, so they and constants count as INT_32BIT.
+Variable::VType Gen_386::get_mem_type(Variable var) {
+   if (var.is_type_const || var.is_vector() || stack_man->get_register(var)) {
+      return Variable::INT_32BIT;
+   }
+   const StackMan::Frame_Slot *slot = stack_man->find_slot(var);
+   if (slot) {
+      return slot->type;
+   }
+   const Variable *global = get_global(var);
+   return global ? global->type : Variable::INT_32BIT;
+}
+
+//Gets an integer source ready for an instruction that writes dst_s. Narrow
+//values in memory are widened into %eax, as is anything in memory when the
+//destination is too. A narrow destination takes the source cut to its size.
+std::string Gen_386::gen_int_source(Variable src, std::string src_s, std::string dst_s, int dst_size) {
+   bool dst_memory = is_memory_operand(dst_s);
+   if (is_memory_operand(src_s)) {
+      Variable::VType src_type = get_mem_type(src);
+      if (get_type_size(src_type) < 4) {
+         emit_instr(get_extend_op(src_type), { src_s, "%eax" });
+         src_s = "%eax";
+      } else if (dst_memory) {
+         //no memory to memory moves, go through the accumulator
+         emit_instr("movl", { src_s, "%eax" });
+         src_s = "%eax";
+      }
+   }
+   if (!dst_memory || dst_size >= 4) {
+      return src_s;
+   }
+   if (src.is_type_const) {
+      return "$" + std::to_string(dst_size == 1 ? (int8_t)src.pvalue : (int16_t)src.pvalue);
+   }
+   std::string sub = get_sub_register(src_s, dst_size);
+   if (sub.empty()) {
+      emit_instr("movl", { src_s, "%eax" });
+      sub = get_sub_register("%eax", dst_size);
+   }
+   return sub;
+}
+
+//the low or high 32 bits of a 64-bit constant or stack variable
+std::string Gen_386::gen_half(Variable var, bool high) {
+   if (var.is_type_const) {
+      int64_t value = var.pvalue;
+      return "$" + std::to_string((int32_t)(high ? value >> 32 : value));
+   }
+   if (high) {
+      var.offset += 4;
+   }
+   return gen_var(var);
+}
+
+//any integer value into %edx:%eax, sign extended when it is narrower
+void Gen_386::emit_load_wide(Variable src) {
+   if (src.name.compare(REGISTER_RETURN) == 0) {
+      return; //cdecl returns 64-bit values in %edx:%eax
+   }
+   if (src.is_type_const || get_mem_type(src) == Variable::INT_64BIT) {
+      emit_instr("movl", { gen_half(src, false), "%eax" });
+      emit_instr("movl", { gen_half(src, true), "%edx" });
+      return;
+   }
+   emit_mov(src, REG_ACCUMULATOR);
+   emit_instr("cltd");
+}
+
+//64-bit arithmetic a half at a time, the carry or borrow goes into the high half
+void Gen_386::emit_wide_op(std::string low_op, std::string high_op, Variable src, Variable dst) {
+   if (src.is_type_const) {
+      emit_instr(low_op, { gen_half(src, false), gen_half(dst, false) });
+      emit_instr(high_op, { gen_half(src, true), gen_half(dst, true) });
+      return;
+   }
+   emit_load_wide(src);
+   emit_instr(low_op, { "%eax", gen_half(dst, false) });
+   emit_instr(high_op, { "%edx", gen_half(dst, true) });
+}
+
+//the low 64 bits of the product: the full product of the low halves plus
+//both cross products, which only reach the high half
+void Gen_386::emit_wide_mul(Variable src, Variable dst) {
+   emit_load_wide(src);
+   std::string dst_low = gen_half(dst, false);
+   std::string dst_high = gen_half(dst, true);
+   emit_instr("imull", { dst_low, "%edx" });
+   emit_instr("movl", { "%edx", "%ecx" });
+   emit_instr("movl", { dst_high, "%edx" });
+   emit_instr("imull", { "%eax", "%edx" });
+   emit_instr("addl", { "%edx", "%ecx" });
+   emit_instr("mull", { dst_low });
+   emit_instr("addl", { "%ecx", "%edx" });
+   emit_instr("movl", { "%eax", dst_low });
+   emit_instr("movl", { "%edx", dst_high });
 }
 
 void Gen_386::emit_sub(Variable src, Variable dst) {
+   if (get_mem_type(dst) == Variable::INT_64BIT) {
+      emit_wide_op("subl", "sbbl", src, dst);
+      return;
+   }
    std::string dst_s = gen_var(dst);
    std::string src_s = gen_var(src);
-   os << '\t' << "sub " << src_s << ", " << dst_s << std::endl;
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 4;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("sub" + get_size_suffix(size), { src_s, dst_s });
 }
 
 void Gen_386::emit_add(Variable src, Variable dst) {
+   if (get_mem_type(dst) == Variable::INT_64BIT) {
+      emit_wide_op("addl", "adcl", src, dst);
+      return;
+   }
    std::string dst_s = gen_var(dst);
    std::string src_s = gen_var(src);
-   os << '\t' << "add " << src_s << ", " << dst_s << std::endl;
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 4;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("add" + get_size_suffix(size), { src_s, dst_s });
 }
 
 void Gen_386::emit_or(Variable src, Variable dst) {
+   if (get_mem_type(dst) == Variable::INT_64BIT) {
+      emit_wide_op("orl", "orl", src, dst);
+      return;
+   }
+   std::string dst_s = gen_var(dst);
+   std::string src_s = gen_var(src);
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 4;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("or" + get_size_suffix(size), { src_s, dst_s });
+}
+
+//imul only writes a register, narrow operands are widened first
+void Gen_386::emit_mul(Variable src, Variable dst) {
+   if (get_mem_type(dst) == Variable::INT_64BIT) {
+      emit_wide_mul(src, dst);
+      return;
+   }
    std::string dst_s = gen_var(dst);
    std::string src_s = gen_var(src);
-   os << '\t' << "orl " << src_s << ", " << dst_s << std::endl;
+   Variable::VType src_type = get_mem_type(src);
+   if (is_memory_operand(src_s) && get_type_size(src_type) < 4) {
+      emit_instr(get_extend_op(src_type), { src_s, "%ecx" });
+      src_s = "%ecx";
+   }
+   if (dst_s[0] == '%') {
+      emit_instr("imull", { src_s, dst_s });
+      return;
+   }
+   Variable::VType dst_type = get_mem_type(dst);
+   int size = get_type_size(dst_type);
+   emit_instr(size < 4 ? get_extend_op(dst_type) : "movl", { dst_s, "%eax" });
+   emit_instr("imull", { src_s, "%eax" });
+   emit_instr("mov" + get_size_suffix(size), { size < 4 ? get_sub_register("%eax", size) : "%eax", dst_s });
 }
 
 void Gen_386::emit_call(std::string label) {
-   os << '\t' << "call " << label << std::endl;
+   emit_instr("call", { label });
 }
 
 void Gen_386::emit_jump(std::string label) {
-   os << '\t' << "jmp " << label << std::endl;
+   emit_instr("jmp", { label });
 }
 
 void Gen_386::emit_cond_jump(std::string label, Conditional::CType condition) {
-   os << '\t';
+   if (wide_compare) {
+      emit_wide_cond_jump(label, condition);
+      return;
+   }
+   if (float_compare) {
+      //ucomiss sets the flags like an unsigned compare, and an unordered
+      //result, a NaN on either side, fails every condition
+      emit_instr("jp", { label });
+      std::string jump;
+      switch (condition) {
+         case Conditional::EQUAL: {
+            jump = "jne";
+         } break;
+
+         case Conditional::GREATER_THAN: {
+            jump = "jbe";
+         } break;
+
+         case Conditional::LESS_THAN: {
+            jump = "jae";
+         } break;
+         case Conditional::GREATER_EQUAL: {
+            jump = "jb";
+         } break;
+
+         case Conditional::LESS_EQUAL: {
+            jump = "ja";
+         } break;
+      }
+      emit_instr(jump, { label });
+      return;
+   }
+   std::string jump;
    //instruction should check the reverse case to work properly, i think
    switch (condition) {
       case Conditional::EQUAL: {
-         os << "jne ";
+         jump = "jne";
       } break;
 
       case Conditional::GREATER_THAN: {
-         os << "jle ";
+         jump = "jle";
       } break;
 
       case Conditional::LESS_THAN: {
-         os << "jge ";
+         jump = "jge";
       } break;
       case Conditional::GREATER_EQUAL: {
-         os << "jl ";
+         jump = "jl";
       } break;
 
       case Conditional::LESS_EQUAL: {
-         os << "jg ";
+         jump = "jg";
       } break;
    }
-   os << label << std::endl;
+   emit_instr(jump, { label });
+}
+
+//A 64-bit compare is decided by the high halves, signed, and only when those
+//are equal by the low halves, unsigned. Like the others it jumps when the
+//condition fails. One side goes into %edx:%eax, the other has to be a
+//constant or in memory, either way the flags are those of left - right.
+void Gen_386::emit_wide_cond_jump(std::string label, Conditional::CType condition) {
+   wide_compare = false;
+   bool load_left = wide_right.is_type_const || get_mem_type(wide_right) == Variable::INT_64BIT;
+   emit_load_wide(load_left ? wide_left : wide_right);
+   Variable other = load_left ? wide_right : wide_left;
+   auto emit_half_cmp = [&](const char *reg, bool high) {
+      std::string other_s = gen_half(other, high);
+      if (load_left) {
+         emit_instr("cmpl", { other_s, reg });
+      } else {
+         emit_instr("cmpl", { reg, other_s });
+      }
+   };
+
+   const char *high_fail = "jne";
+   const char *high_pass = nullptr;
+   const char *low_fail = "jne";
+   switch (condition) {
+      case Conditional::EQUAL: {
+      } break;
+      case Conditional::GREATER_THAN: {
+         high_fail = "jl";
+         high_pass = "jg";
+         low_fail = "jbe";
+      } break;
+      case Conditional::LESS_THAN: {
+         high_fail = "jg";
+         high_pass = "jl";
+         low_fail = "jae";
+      } break;
+      case Conditional::GREATER_EQUAL: {
+         high_fail = "jl";
+         high_pass = "jg";
+         low_fail = "jb";
+      } break;
+      case Conditional::LESS_EQUAL: {
+         high_fail = "jg";
+         high_pass = "jl";
+         low_fail = "ja";
+      } break;
+   }
+   std::string pass_label = get_local_label();
+   emit_half_cmp("%edx", true);
+   emit_instr(high_fail, { label });
+   if (high_pass) {
+      emit_instr(high_pass, { pass_label });
+   }
+   emit_half_cmp("%eax", false);
+   emit_instr(low_fail, { label });
+   emit_label(pass_label);
 }
 
 void Gen_386::emit_return() {
-   os << '\t' << "ret" << std::endl;
+   emit_instr("ret");
+}
+
+bool Gen_386::is_block_exit(const Machine_Instr &instr) {
+   return instr.opcode.compare("jmp") == 0 || instr.opcode.compare("ret") == 0;
 }
 
 void Gen_386::emit_function_header() {
-   emit_push(REG_FRAME);
-   emit_mov(REG_STACK, REG_FRAME);
+   if (uses_frame_pointer()) {
+      emit_push(REG_FRAME);
+      emit_mov(REG_STACK, REG_FRAME);
+   }
+   for (int r : reg_alloc.saved_registers) {
+      emit_push(allocatable_registers[r]);
+   }
 }
 
 void Gen_386::emit_function_footer() {
-   emit_pop(REG_FRAME);
+   for (auto r = reg_alloc.saved_registers.rbegin(); r != reg_alloc.saved_registers.rend(); ++r) {
+      emit_pop(allocatable_registers[*r]);
+   }
+   if (uses_frame_pointer()) {
+      emit_pop(REG_FRAME);
+   }
+}
+
+//vector constants come out of the literal pool, addressed like strings
+std::string Gen_386::gen_vector_operand(Variable var) {
+   if (!var.is_type_const) {
+      return gen_var(var);
+   }
+   if (!pic) {
+      return get_rodata(var);
+   }
+   const Variable *base = load_pic_base();
+   if (base) {
+      return get_rodata(var) + " - " + pic_base_label + "(" + gen_var(*base) + ")";
+   }
+   emit_call(get_new_label());
+   emit_label(get_old_label());
+   emit_pop(REG_INDEX);
+   return get_rodata(var) + " - " + get_old_label() + "(%ecx)";
+}
+
+//globals are addressed like the literal pool, absolutely or off the PIC base
+std::string Gen_386::gen_global(Variable var) {
+   std::string sym = var.name + (var.offset ? "+" + std::to_string(var.offset) : "");
+   if (!pic) {
+      return sym;
+   }
+   const Variable *base = load_pic_base();
+   if (base) {
+      return sym + " - " + pic_base_label + "(" + gen_var(*base) + ")";
+   }
+   emit_call(get_new_label());
+   emit_label(get_old_label());
+   emit_pop(REG_INDEX);
+   return sym + " - " + get_old_label() + "(%ecx)";
+}
+
+std::string Gen_386::gen_pointer_register(Variable ptr) {
+   std::string ptr_s = gen_var(ptr);
+   if (ptr_s[0] != '%') {
+      emit_mov(ptr, REG_INDEX);
+      ptr_s = gen_var(REG_INDEX);
+   }
+   return ptr_s;
+}
+
+void Gen_386::emit_vector_mov(Variable src, Variable dst) {
+   if (src.is_vector()) {
+      std::string src_s = gen_vector_operand(src);
+      emit_sse_mov(*this, src_s, gen_var(dst));
+   } else {
+      emit_sse_splat(*this, gen_var(src), gen_var(dst));
+   }
+}
+
+void Gen_386::emit_vector_op(Instruction::IType op, Variable src, Variable dst) {
+   if (op == Instruction::MULTIPLY && dst.type == Variable::INT_32X4) {
+      std::string src_lanes[4];
+      std::string dst_lanes[4];
+      for (int i = 0; i < 4; ++i) {
+         src_lanes[i] = gen_var(get_lane(src, i));
+         dst_lanes[i] = gen_var(get_lane(dst, i));
+      }
+      emit_sse_int_mul(*this, src_lanes, dst_lanes);
+      return;
+   }
+   std::string src_s = gen_vector_operand(src);
+   emit_sse_op(*this, op, dst.type == Variable::FLOAT_32X4, src_s, gen_var(dst));
+}
+
+void Gen_386::emit_vector_shuffle(Variable src, Variable dst, int mask) {
+   emit_sse_shuffle(*this, dst.type == Variable::FLOAT_32X4, mask, gen_var(src), gen_var(dst));
+}
+
+void Gen_386::emit_vector_load(Variable ptr, Variable dst) {
+   std::string ptr_s = gen_pointer_register(ptr);
+   emit_sse_mov(*this, "(" + ptr_s + ")", gen_var(dst));
+}
+
+void Gen_386::emit_vector_store(Variable src, Variable ptr) {
+   std::string ptr_s = gen_pointer_register(ptr);
+   emit_sse_mov(*this, gen_var(src), "(" + ptr_s + ")");
+}
+
+//Called like _exit. Opens the profile, writes the counters into it through
+//the platform library and only then exits with the status it was given.
+void Gen_386::gen_profile_exit() {
+   Variable path;
+   path.type = Variable::DQString;
+   path.dqstring = profile->path;
+   std::string base = get_new_label();
+   auto load_address = [&](const std::string &sym) {
+      if (pic) {
+         emit_instr("lea", { sym + " - " + base + "(%ebx)", "%eax" });
+      } else {
+         emit_instr("movl", { "$" + sym, "%eax" });
+      }
+   };
+   emit_label(PROFILE_EXIT);
+   emit_instr("push", { "%ebx" });
+   emit_instr("sub", { "$24", "%esp" });
+   if (pic) {
+      emit_call(base);
+      emit_label(base);
+      emit_instr("pop", { "%ebx" });
+   }
+   load_address(get_rodata(path));
+   emit_instr("movl", { "%eax", "0(%esp)" });
+   emit_instr("movl", { "$" + std::to_string(profile->open_flags), "4(%esp)" });
+   emit_instr("movl", { "$420", "8(%esp)" }); //rw-r--r--
+   emit_call("_open");
+   emit_instr("movl", { "%eax", "12(%esp)" });
+   emit_instr("movl", { "%eax", "0(%esp)" });
+   load_address(PROFILE_COUNTERS);
+   emit_instr("movl", { "%eax", "4(%esp)" });
+   emit_instr("movl", { "$" + std::to_string(profile->num_counters * 4), "8(%esp)" });
+   emit_call("_write");
+   emit_instr("movl", { "12(%esp)", "%eax" });
+   emit_instr("movl", { "%eax", "0(%esp)" });
+   emit_call("_close");
+   emit_instr("movl", { "32(%esp)", "%eax" }); //the status, past the return address and the frame
+   emit_instr("movl", { "%eax", "0(%esp)" });
+   emit_call("_exit");
+   print_machine_code();
 }
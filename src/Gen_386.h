@@ -10,76 +10,54 @@
 //padding always sits under the variables on the stack
 struct StackMan_i386 : public StackMan {
 
-   std::string load_var(Variable var, Scope *ts = nullptr, int total_adjust = 0) {
-
-      if (ext_adj) {
-         total_adjust = ext_adj;
-         ext_adj = 0;
-      }
-
-      int stack_loc = 0;
-      for (size_t i = 0; i < params.size(); ++i) {
-         if (params[i].name.compare(var.name) == 0) {
-            stack_loc = i * 4 + 8;// +8 accounts for push %ebp and 4 byte return address
-            return std::to_string(stack_loc) + "(%ebp)";
-         }
-      }
-
-
-      if (scope && !ts) {
-
-         for (size_t i = 0; i < scope->variables.size(); ++i) {
-
-            if (scope->variables[i].name.compare(var.name) == 0) {
-               int padding = 16 - ((scope->variables.size() * 4) % 16);
-               if (padding == 16) padding = 0;
-               stack_loc = i * 4 + padding + total_adjust;
-               return std::to_string(stack_loc) + "(%esp)";
-            }
-         }
-      } else if (ts) {
-         printf("TS\n");
-         for (size_t i = 0; i < ts->variables.size(); ++i) {
-
-            if (ts->variables[i].name.compare(var.name) == 0) {
-               int padding = 16 - ((ts->variables.size() * 4) % 16);
-               if (padding == 16) padding = 0;
-               stack_loc = i * 4 + padding + total_adjust;
-               return std::to_string(stack_loc) + "(%esp)";
-            }
-         }
-      }
-      Scope *sc = (ts ? ts : scope);
-      int padding = 16 - ((sc->variables.size() * 4) % 16);
-      if (padding == 16) padding = 0;
-      int adj = padding + sc->variables.size() * 4;
-      if (sc->variables.size() == 0) {
-         adj = 0;
-      }
-      adj += total_adjust;
-      if ((ts ? !ts->parent : !scope->parent)) {
-         return "";
-      }
-      return (scope->is_function ? ""
-         : (ts ? (ts->is_function ? "" : load_var(var, ts->parent, adj)) : load_var(var, scope->parent, adj)));
-   }
+   virtual Frame_Slot get_param_slot(size_t n, Scope &scope);
+   virtual std::string format_slot(Frame_Slot slot);
+   virtual int get_var_size(const Variable &var);
+   virtual int get_var_align(const Variable &var);
 
 };
 
 struct Gen_386 : public Code_Gen {
 
-   Gen_386(std::ostream &ost) : Code_Gen(ost) {
+   Gen_386(Asm_Buf &ost) : Code_Gen(ost) {
       stack_man = new StackMan_i386();
       stack_man->code_gen = this;
+      for (int i = 0; i < 3; ++i) {
+         allocatable_registers.push_back(create_register(REGISTER_SAVED + std::to_string(i)));
+      }
+      //%xmm2-%xmm7, cdecl preserves none of them across calls
+      for (int i = 0; i < 6; ++i) {
+         float_registers.push_back(create_register(REGISTER_FLOAT_SAVED + std::to_string(i)));
+      }
+      float_registers_caller_saved = true;
    }
 
+   bool float_compare = false; //the last emit_cmp was a ucomiss
+   bool wide_compare = false; //the last emit_cmp was of 64-bit values, left for emit_cond_jump
+   Variable wide_left;
+   Variable wide_right;
+
    virtual std::string gen_var(Variable var);
+   virtual std::string gen_global(Variable var);
+   virtual void gen_profile_exit();
    virtual void gen_stack_alignment(Scope &scope);
    virtual void gen_stack_unalignment(Scope &scope);
-   virtual void gen_stack_pop_params(std::vector<Variable> &plist);
-   virtual int gen_stack_unwind(Scope &scope);
-
-   virtual void gen_rodata();
+   virtual void gen_func_params(Function &func, std::vector<Variable> &plist);
+   virtual void gen_pic_base();
+   const Variable *load_pic_base();
+   std::string gen_pic_slot();
+   virtual int get_frame_size(Scope &scope);
+   virtual bool gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope);
+   virtual void gen_discard_float_return();
+   void emit_float_mov(Variable src, std::string src_s, Variable dst, std::string dst_s);
+   std::string gen_float_const(Variable var);
+   Variable::VType get_mem_type(Variable var);
+   std::string gen_int_source(Variable src, std::string src_s, std::string dst_s, int dst_size);
+   std::string gen_half(Variable var, bool high);
+   void emit_load_wide(Variable src);
+   void emit_wide_op(std::string low_op, std::string high_op, Variable src, Variable dst);
+   void emit_wide_mul(Variable src, Variable dst);
+   void emit_wide_cond_jump(std::string label, Conditional::CType condition);
 
    virtual void emit_cmp(Variable src0, Variable src1);
    virtual void emit_inc(Variable dst);
@@ -89,12 +67,22 @@ struct Gen_386 : public Code_Gen {
    virtual void emit_sub(Variable src, Variable dst);
    virtual void emit_add(Variable src, Variable dst);
    virtual void emit_or(Variable src, Variable dst);
+   virtual void emit_mul(Variable src, Variable dst);
    virtual void emit_call(std::string label);
    virtual void emit_jump(std::string label);
    virtual void emit_cond_jump(std::string label, Conditional::CType condition);
    virtual void emit_return();
+   virtual bool is_block_exit(const Machine_Instr &instr);
    virtual void emit_function_header();
    virtual void emit_function_footer();
+
+   std::string gen_vector_operand(Variable var);
+   std::string gen_pointer_register(Variable ptr);
+   virtual void emit_vector_mov(Variable src, Variable dst);
+   virtual void emit_vector_op(Instruction::IType op, Variable src, Variable dst);
+   virtual void emit_vector_shuffle(Variable src, Variable dst, int mask);
+   virtual void emit_vector_load(Variable ptr, Variable dst);
+   virtual void emit_vector_store(Variable src, Variable ptr);
 };
 
 
@@ -1,3 +1,7 @@
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+
 #include "Gen_ARM.h"
 
 const Variable REG_LINK = create_register("_REG_LINK");
@@ -11,84 +15,210 @@ const Variable ARM_ARGS[] = {
    REG_ARG2,
    REG_ARG3
 };
+//s0-s15 with the hard-float ABI, _ARM_ARG_S0, _ARM_ARG_S1, ...
+const std::string ARM_VFP_ARG = "_ARM_ARG_S";
+//scratch registers for float arithmetic, both caller-saved
+const Variable REG_FLOAT_ACCUMULATOR = create_register("_ARM_FLOAT_ACC");
+const Variable REG_FLOAT_SCRATCH = create_register("_ARM_FLOAT_SCRATCH");
 
-void Gen_ARM::
-gen_rodata() {
-   for (size_t i = 0; i < rodata_data.size(); i++) {
-      os << rodata_labels[i] << ":" << std::endl;
-      Variable *var = &rodata_data[i];
-      if (var->type == Variable::DQString) {
-          os << "\t.asciz \"";
-          for (char c : var->dqstring) {
-            if (c >= 0x20 && c < 0x7F) {
-               os << c;
-            } else if (c == '\n') {
-               os << "\\n";
-            }
-          }
-          os << "\"" << std::endl;
+static int get_stack_args(int num_args) {
+   return num_args > ARM_REGISTER_ARGS ? num_args - ARM_REGISTER_ARGS : 0;
+}
+
+//the slot in the outgoing area an argument location refers to, -1 for registers
+static int get_outgoing_index(const Variable &loc) {
+   if (loc.name.compare(0, REGISTER_OUTGOING_ARG.size(), REGISTER_OUTGOING_ARG) != 0) {
+      return -1;
+   }
+   return std::stoi(loc.name.substr(REGISTER_OUTGOING_ARG.size()));
+}
+
+//Integer arguments take r0-r3, with the hard-float ABI float arguments take
+//s0-s15 independently, everything else goes on the stack in order.
+Variable Gen_ARM::
+get_arg_location(std::vector<Variable> &list, size_t n) {
+   int core = 0;
+   int vfp = 0;
+   int stack = 0;
+   Variable loc;
+   for (size_t i = 0; i <= n && i < list.size(); ++i) {
+      bool is_float = hard_float && list[i].type == Variable::FLOAT_32BIT;
+      if (is_float && vfp < 16) {
+         loc = create_register(ARM_VFP_ARG + std::to_string(vfp++));
+      } else if (!is_float && core < ARM_REGISTER_ARGS) {
+         loc = ARM_ARGS[core++];
+      } else {
+         loc = create_register(REGISTER_OUTGOING_ARG + std::to_string(stack++));
       }
    }
+   return loc;
 }
 
+//register arguments get home slots in the order they appear
 int Gen_ARM::
-gen_stack_unwind(Scope &scope) {
-   int stack_adj = scope.variables.size() * 4;
+get_home_index(std::vector<Variable> &list, size_t n) {
+   int index = 0;
+   for (size_t i = 0; i < n && i < list.size(); ++i) {
+      if (get_outgoing_index(get_arg_location(list, i)) < 0) {
+         index++;
+      }
+   }
+   return index;
+}
+
+StackMan::Frame_Slot StackMan_ARM::
+get_param_slot(size_t n, Scope &scope) {
+   Gen_ARM *arm = (Gen_ARM *)code_gen;
+   int stack_index = get_outgoing_index(arm->get_arg_location(params, n));
+   if (stack_index < 0) {
+      Scope *fs = code_gen->current_function->scope;
+      int home = arm->get_home_index(params, n);
+      int vars = get_frame_bytes(*fs);
+      return { code_gen->gen_stack_unwind(scope) - vars - (home + 1) * 4, false, true, params[n].type };
+   }
+   //stack arguments sit right above the registers pushed on entry
+   return { stack_index * 4 + arm->get_push_size() + code_gen->gen_stack_unwind(scope), false, true, params[n].type };
+}
+
+std::string StackMan_ARM::
+format_slot(Frame_Slot slot) {
+   return "[sp, #" + std::to_string(slot.offset) + "]";
+}
 
-   if (scope.variables.size() == 0) {
-      stack_adj = 0;
+//AAPCS keeps sp 8-byte aligned at every call. The function's frame makes up
+//for the registers pushed on entry and holds the variables of all its blocks.
+//Leaf functions reserve only their variables and argument homes.
+int Gen_ARM::
+get_frame_size(Scope &scope) {
+   if (!stack_man->is_frame_scope(scope)) {
+      return 0;
+   }
+   int size = stack_man->get_frame_bytes(scope);
+   if (scope.is_function && current_function) {
+      size += get_home_index(current_function->parameters, current_function->parameters.size()) * 4;
    }
-   if (scope.is_function) {
-      return stack_adj;
+   if (!reg_alloc.has_calls || (!scope.is_function && size == 0)) {
+      return size;
    }
-   return (scope.parent ? gen_stack_unwind(*scope.parent) + stack_adj : stack_adj);
+   size += get_stack_args(reg_alloc.max_call_args) * 4;
+   int entry = scope.is_function ? get_push_size() : 0;
+   return ((size + entry + 7) & ~7) - entry;
 }
 
 void Gen_ARM::
-gen_func_params(std::vector<Variable> &plist) {
-   if (plist.size() < 1) {
-      printf("Plist empty\n");
-      return;
+gen_stack_alignment(Scope &scope) {
+   int stack_adj = get_frame_size(scope);
+   if (stack_adj > 0) {
+      emit_sub(create_const_int32(stack_adj), REG_STACK);
    }
-   int size = plist.size();
-   if (size > 5) {
-      //TODO(josh) stack stuff
+}
+
+void Gen_ARM::
+gen_stack_unalignment(Scope &scope) {
+   int stack_adj = get_frame_size(scope);
+   if (stack_adj > 0) {
+      emit_add(create_const_int32(stack_adj), REG_STACK);
    }
-   for (size_t i = 0; i < (plist.size() > 4 ? 4 : plist.size()); ++i) {
-      emit_mov(plist[i], ARM_ARGS[i]);
+}
+
+//stack arguments are stored first, storing goes through r2
+void Gen_ARM::
+gen_func_params(Function &func, std::vector<Variable> &plist) {
+   for (size_t i = 0; i < plist.size(); ++i) {
+      Variable loc = get_arg_location(plist, i);
+      if (get_outgoing_index(loc) >= 0) {
+         emit_mov(plist[i], loc);
+      }
+   }
+   for (size_t i = 0; i < plist.size(); ++i) {
+      Variable loc = get_arg_location(plist, i);
+      if (get_outgoing_index(loc) < 0) {
+         emit_mov(plist[i], loc);
+      }
    }
 }
 
+//register arguments move straight into the register Reg_Alloc gave them, or
+//are stored to their home slot; arguments nobody reads are left alone
+void Gen_ARM::
+gen_param_loads(Function &func) {
+   Scope *scope = stack_man->scope;
+   stack_man->scope = func.scope;
+   for (auto &li : reg_alloc.intervals) {
+      if (!li.is_param) {
+         continue;
+      }
+      Variable loc = get_arg_location(func.parameters, li.param_index);
+      if (get_outgoing_index(loc) < 0) {
+         emit_mov(loc, func.parameters[li.param_index]);
+      } else if (li.reg >= 0) {
+         reg_alloc.enabled = false;
+         emit_mov(func.parameters[li.param_index], *reg_alloc.get_interval_register(li, *this));
+         reg_alloc.enabled = true;
+      }
+   }
+   stack_man->scope = scope;
+}
+
+//Thumb can't pop straight into lr, so r3 carries it back and at most 3
+//arguments fit. Self recursion keeps the frame and can use all four.
+bool Gen_ARM::
+gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope) {
+   bool self = func.name.compare(current_function->name) == 0;
+   for (size_t i = 0; i < plist.size(); ++i) {
+      Variable loc = get_arg_location(plist, i);
+      if (get_outgoing_index(loc) >= 0 || (!self && needs_frame() && loc.name.compare(ARM_ARGS[3].name) == 0)) {
+         return false;
+      }
+   }
+   gen_func_params(func, plist);
+   int stack_adj = gen_stack_unwind(scope);
+   if (stack_adj > 0) {
+      emit_add(create_const_int32(stack_adj), REG_STACK);
+   }
+   if (self) {
+      emit_jump(get_tail_label(func));
+   } else {
+      if (needs_frame()) {
+         emit_vfp_restore();
+         emit_instr("pop", { get_push_list(gen_var(ARM_ARGS[3])) });
+         emit_mov(ARM_ARGS[3], REG_LINK);
+      }
+      emit_jump(func.name);
+   }
+   emit_text("\t.ltorg");
+   return true;
+}
+
 void Gen_ARM::
 gen_function_attributes(Function &func) {
-   os << "\t.align 2" << std::endl;
-   os << "\t.globl " << func.name << std::endl;
-   os << "\t.code 16" << std::endl;
-   os << "\t.thumb_func" << std::endl;
-   os << "\t.type " << func.name << ", %function" << std::endl;
+   emit_text("\t.align 2");
+   if (!func.is_internal) {
+      emit_text("\t.globl " + func.name);
+   }
+   emit_text("\t.code 16");
+   emit_text("\t.thumb_func");
+   emit_text("\t.type " + func.name + ", %function");
 }
 
-bool is_reg(Variable var) {
-   if (var.name.compare(ARM_ARGS[0].name) == 0) {
-      return true;
-   } else if (var.name.compare(ARM_ARGS[1].name) == 0) {
-      return true;
-   } else if (var.name.compare(ARM_ARGS[2].name) == 0) {
-      return true;
-   } else if (var.name.compare(ARM_ARGS[3].name) == 0) {
-      return true;
-   } else if (var.name.compare(REGISTER_RETURN) == 0) {
-      return true;
-   } else if (var.name.compare(REGISTER_ACCUMULATOR) == 0) {
-      return true;
-   } else if (var.name.compare(REGISTER_INDEX) == 0) {
-      return true;
-   } else if (var.name.compare(REGISTER_FRAME_POINTER) == 0) {
-      return true;
-   } else if (var.name.compare(REGISTER_STACK_POINTER) == 0) {
-      return true;
-   } else if (var.name.compare(REG_LINK.name) == 0) {
-      return true;
+static bool is_vfp_operand(const std::string &op) {
+   return op.size() > 1 && op[0] == 's' && isdigit(op[1]);
+}
+
+//anything that is not a memory operand, immediate, literal pool load or VFP
+//register is a core register
+static bool is_reg_operand(const std::string &op) {
+   return op.size() && op[0] != '[' && op[0] != '#' && op[0] != '=' && !is_vfp_operand(op);
+}
+
+//vmov.f32 takes +-(16..31)/16 * 2^(-3..4) as an immediate
+static bool is_vfp_immediate(float val) {
+   for (int e = -3; e <= 4; ++e) {
+      for (int n = 16; n < 32; ++n) {
+         if (std::fabs(val) == ldexpf(n / 16.0f, e)) {
+            return true;
+         }
+      }
    }
    return false;
 }
@@ -105,6 +235,16 @@ std::string Gen_ARM::gen_var(Variable var) {
       return "r3";
    } else if (var.name.compare(REGISTER_RETURN) == 0) {
       return "r0";
+   } else if (var.name.compare(REGISTER_FLOAT_RETURN) == 0) {
+      return hard_float ? "s0" : "r0";
+   } else if (var.name.compare(REG_FLOAT_ACCUMULATOR.name) == 0) {
+      return "s15";
+   } else if (var.name.compare(REG_FLOAT_SCRATCH.name) == 0) {
+      return "s14";
+   } else if (var.name.compare(0, ARM_VFP_ARG.size(), ARM_VFP_ARG) == 0) {
+      return "s" + var.name.substr(ARM_VFP_ARG.size());
+   } else if (var.name.compare(0, REGISTER_FLOAT_SAVED.size(), REGISTER_FLOAT_SAVED) == 0) {
+      return "s" + std::to_string(16 + std::stoi(var.name.substr(REGISTER_FLOAT_SAVED.size())));
    } else if (var.name.compare(REGISTER_ACCUMULATOR) == 0) {
       return "r2";
    } else if (var.name.compare(REGISTER_INDEX) == 0) {
@@ -115,13 +255,18 @@ std::string Gen_ARM::gen_var(Variable var) {
       return "r13";
    } else if (var.name.compare(REG_LINK.name) == 0) {
       return "r14";
+   } else if (var.name.compare(0, REGISTER_SAVED.size(), REGISTER_SAVED) == 0) {
+      return "r" + std::to_string(4 + std::stoi(var.name.substr(REGISTER_SAVED.size())));
+   } else if (var.name.compare(0, REGISTER_OUTGOING_ARG.size(), REGISTER_OUTGOING_ARG) == 0) {
+      return "[sp, #" + std::to_string(std::stoi(var.name.substr(REGISTER_OUTGOING_ARG.size())) * 4) + "]";
+   } else if (var.name.compare(0, REGISTER_INDIRECT.size(), REGISTER_INDIRECT) == 0) {
+      return "[r3, #" + var.name.substr(REGISTER_INDIRECT.size()) + "]";
    }
 
-   else if (var.is_type_const && var.type == Variable::INT_32BIT) {
+   else if (var.is_type_const && is_integer_type(var.type)) {
       return std::string("#") + std::to_string(var.pvalue);
    } else if (var.is_type_const && var.type == Variable::FLOAT_32BIT) {
-      float val = var.fvalue;
-      return std::string("#") + std::to_string(*(int *)&val);
+      return std::string("#") + std::to_string(get_float_bits(var.fvalue));
    } else if (var.type == Variable::DQString) {
       return "=" + get_rodata(var);
    } else {
@@ -129,100 +274,431 @@ std::string Gen_ARM::gen_var(Variable var) {
    }
 }
 
+//[symbol, #offset], which emit_instr turns into an address in ip
+std::string Gen_ARM::gen_global(Variable var) {
+   return "[" + var.name + (var.offset ? ", #" + std::to_string(var.offset) : "") + "]";
+}
+
+//Loads and stores only take a register as the base, a global's address goes
+//into ip right before the one instruction that uses it. Nothing else touches
+//ip, so both operands of an emitter can be globals.
+void Gen_ARM::emit_instr(const std::string &opcode, const std::vector<std::string> &operands) {
+   std::vector<std::string> ops = operands;
+   for (auto &op : ops) {
+      if (op.size() && op[0] == '[') {
+         Machine_Operand mem = parse_arm_operand(op);
+         if (parse_arm_operand(mem.reg).kind != Machine_Operand::REGISTER) {
+            Code_Gen::emit_instr("ldr", { "ip", "=" + mem.reg });
+            op = "[ip" + op.substr(1 + mem.reg.size());
+         }
+      }
+   }
+   Code_Gen::emit_instr(opcode, ops);
+}
+
 void Gen_ARM::emit_cmp(Variable src0, Variable src1) {
-   std::string dst_s = gen_var(src1);
-   //std::string src_s = gen_var(src0);
-   // emit_mov(src0, REG_ACCUMULATOR);
-   os << '\t' << "cmp " << dst_s << ", " << dst_s << ", " << gen_var(src0) << std::endl;
+   if (hard_float && src1.type == Variable::FLOAT_32BIT) {
+      std::string left_s = gen_var(src1);
+      if (!is_vfp_operand(left_s)) {
+         emit_mov(src1, REG_FLOAT_ACCUMULATOR);
+         left_s = gen_var(REG_FLOAT_ACCUMULATOR);
+      }
+      emit_mov(src0, REG_FLOAT_SCRATCH);
+      emit_instr("vcmp.f32", { left_s, gen_var(REG_FLOAT_SCRATCH) });
+      emit_instr("vmrs", { "APSR_nzcv", "fpscr" });
+      return;
+   }
+   std::string left_s = gen_var(src1);
+   if (!is_reg_operand(left_s)) {
+      emit_mov(src1, REG_INDEX);
+      left_s = gen_var(REG_INDEX);
+   }
+   std::string right_s = gen_var(src0);
+   if (!is_reg_operand(right_s) && !(src0.is_type_const && src0.pvalue >= 0 && src0.pvalue <= 255)) {
+      emit_mov(src0, REG_ACCUMULATOR);
+      right_s = gen_var(REG_ACCUMULATOR);
+   }
+   emit_instr("cmp", { left_s, right_s });
 }
 
 void Gen_ARM::emit_inc(Variable dst) {
+   if (hard_float && dst.type == Variable::FLOAT_32BIT) {
+      std::string dst_s = gen_var(dst);
+      std::string acc_s = dst_s;
+      if (!is_vfp_operand(dst_s)) {
+         emit_mov(dst, REG_FLOAT_ACCUMULATOR);
+         acc_s = gen_var(REG_FLOAT_ACCUMULATOR);
+      }
+      emit_mov(create_const_int32(1), REG_FLOAT_SCRATCH);
+      emit_instr("vadd.f32", { acc_s, acc_s, gen_var(REG_FLOAT_SCRATCH) });
+      if (acc_s != dst_s) {
+         emit_mov(REG_FLOAT_ACCUMULATOR, dst);
+      }
+      return;
+   }
    emit_add(create_const_int32(1), dst);
 }
 
 void Gen_ARM::emit_push(Variable src) {
-   // std::string src_s = gen_var(src);
-   //os << '\t' << "push " << src_s << std::endl;
-   emit_mov(src, REG_ACCUMULATOR);
-   os << '\t' << "push " << "{" << gen_var(REG_ACCUMULATOR) << "}" << std::endl;
+   std::string src_s = gen_var(src);
+   if (!is_reg_operand(src_s)) {
+      emit_mov(src, REG_ACCUMULATOR);
+      src_s = gen_var(REG_ACCUMULATOR);
+   }
+   emit_instr("push", { "{ " + src_s + " }" });
 }
 
 void Gen_ARM::emit_pop(Variable dst) {
    std::string dst_s = gen_var(dst);
-   os << '\t' << "pop " << "{ " << dst_s << " }" << std::endl;
+   emit_instr("pop", { "{ " + dst_s + " }" });
 }
 
-void Gen_ARM::emit_mov(Variable src, Variable dst) {
-   std::string instr = "ldr ";
-   if ((is_reg(src) && is_reg(dst)) || (src.is_type_const)) {
-      instr = "mov ";
+//moves where either side is a VFP register, constants are converted to float
+void Gen_ARM::emit_vfp_mov(Variable src, std::string src_s, std::string dst_s) {
+   if (src.is_type_const) {
+      float val = (src.type == Variable::FLOAT_32BIT ? src.fvalue : (float)src.pvalue);
+      if (is_vfp_immediate(val)) {
+         char imm[32];
+         snprintf(imm, sizeof(imm), "#%.9g", val); //exact, to_string rounds to six decimals
+         emit_instr("vmov.f32", { dst_s, imm });
+         return;
+      }
+      std::string acc_s = gen_var(REG_ACCUMULATOR);
+      emit_instr("ldr", { acc_s, "=" + std::to_string(get_float_bits(val)) });
+      emit_instr("vmov", { dst_s, acc_s });
+   } else if (is_vfp_operand(src_s) && is_vfp_operand(dst_s)) {
+      if (src_s != dst_s) {
+         emit_instr("vmov.f32", { dst_s, src_s });
+      }
+   } else if (is_vfp_operand(dst_s)) {
+      if (is_reg_operand(src_s)) {
+         emit_instr("vmov", { dst_s, src_s });
+      } else {
+         emit_instr("vldr", { dst_s, src_s });
+      }
+   } else if (is_reg_operand(dst_s)) {
+      emit_instr("vmov", { dst_s, src_s });
+   } else {
+      emit_instr("vstr", { src_s, dst_s });
    }
+}
+
+void Gen_ARM::emit_mov(Variable src, Variable dst) {
    std::string dst_s = gen_var(dst);
    std::string src_s = gen_var(src);
-   os << '\t' << instr << dst_s << ", " << src_s << std::endl;
+   if (is_vfp_operand(src_s) || is_vfp_operand(dst_s)) {
+      emit_vfp_mov(src, src_s, dst_s);
+      return;
+   }
+   std::string instr = "ldr";
+   if (is_reg_operand(src_s) || src.is_type_const) {
+      instr = "mov";
+   }
+   if (src.is_type_const && (is_integer_type(src.type) || src.type == Variable::FLOAT_32BIT)) {
+      int value = (src.type == Variable::FLOAT_32BIT ? get_float_bits(src.fvalue) : src.pvalue);
+      if (value < 0 || value > 255) {
+         //thumb moves only take 8-bit immediates, larger ones come from the literal pool
+         src_s = "=" + std::to_string(value);
+         instr = "ldr";
+      }
+   }
+   if (!is_reg_operand(dst_s)) {
+      //stores need the value in a register first
+      if (!is_reg_operand(src_s)) {
+         std::string acc_s = gen_var(REG_ACCUMULATOR);
+         emit_instr(instr, { acc_s, src_s });
+         src_s = acc_s;
+      }
+      emit_instr("str", { src_s, dst_s });
+      return;
+   }
+   emit_instr(instr, { dst_s, src_s });
 }
 
-void Gen_ARM::emit_sub(Variable src, Variable dst) {
+//ARM only does arithmetic on registers, memory operands are loaded into r3
+//and stored back
+void Gen_ARM::emit_arith(std::string op, Variable src, Variable dst) {
    std::string dst_s = gen_var(dst);
    std::string src_s = gen_var(src);
-   os << '\t' << "sub " << dst_s << ", " << dst_s << ", " << src_s << std::endl;
+   if (!is_reg_operand(src_s) && !(src.is_type_const && src.pvalue >= 0 && src.pvalue <= 255)) {
+      emit_mov(src, REG_ACCUMULATOR);
+      src_s = gen_var(REG_ACCUMULATOR);
+   }
+   if (!is_reg_operand(dst_s)) {
+      std::string index_s = gen_var(REG_INDEX);
+      emit_instr("ldr", { index_s, dst_s });
+      emit_instr(op, { index_s, index_s, src_s });
+      emit_instr("str", { index_s, dst_s });
+      return;
+   }
+   emit_instr(op, { dst_s, dst_s, src_s });
+}
+
+void Gen_ARM::emit_sub(Variable src, Variable dst) {
+   emit_arith("sub", src, dst);
 }
 
 void Gen_ARM::emit_add(Variable src, Variable dst) {
-   std::string dst_s = gen_var(dst);
-   std::string src_s = gen_var(src);
-   os << '\t' << "add " << dst_s << ", " << dst_s << ", " << src_s << std::endl;
+   emit_arith("add", src, dst);
 }
 
 void Gen_ARM::emit_or(Variable src, Variable dst) {
-   std::string dst_s = gen_var(dst);
-   std::string src_s = gen_var(src);
-   os << '\t' << "or " << dst_s << ", " << dst_s << ", " << src_s << std::endl;
+   emit_arith("orr", src, dst);
+}
+
+//mul takes no immediate, the multiplier always goes in a register
+void Gen_ARM::emit_mul(Variable src, Variable dst) {
+   if (!is_reg_operand(gen_var(src))) {
+      emit_mov(src, REG_ACCUMULATOR);
+      src = REG_ACCUMULATOR;
+   }
+   emit_arith("mul", src, dst);
 }
 
 void Gen_ARM::emit_call(std::string label) {
-   os << '\t' << "bl " << label << std::endl;
+   emit_instr("bl", { label });
 }
 
 void Gen_ARM::emit_jump(std::string label) {
-   os << '\t' << "b " << label << std::endl;
+   emit_instr("b", { label });
 }
 
 void Gen_ARM::emit_cond_jump(std::string label, Conditional::CType condition) {
-   os << '\t';
+   std::string jump;
    //instruction should check the reverse case to work properly, i think
    switch (condition) {
       case Conditional::EQUAL: {
-         os << "bne ";
+         jump = "bne";
       } break;
 
       case Conditional::GREATER_THAN: {
-         os << "ble ";
+         jump = "ble";
       } break;
 
       case Conditional::LESS_THAN: {
-         os << "bge ";
+         jump = "bge";
       } break;
       case Conditional::GREATER_EQUAL: {
-         os << "blt ";
+         jump = "blt";
       } break;
 
       case Conditional::LESS_EQUAL: {
-         os << "bgt ";
+         jump = "bgt";
       } break;
    }
-   os << label << std::endl;
+   emit_instr(jump, { label });
 }
 
+//with a frame the footer has already returned through pc, the literal pool
+//goes after the return so it is never executed
 void Gen_ARM::emit_return() {
-   os << '\t' << "mov pc, " << gen_var(REG_LINK) << std::endl;
+   if (!needs_frame()) {
+      emit_instr("bx", { gen_var(REG_LINK) });
+   }
+   emit_text("\t.ltorg");
+}
+
+//popping into pc returns as well
+bool Gen_ARM::is_block_exit(const Machine_Instr &instr) {
+   if (instr.opcode.compare("pop") == 0) {
+      return instr.operands.size() && instr.operands[0].symbol.find("pc") != std::string::npos;
+   }
+   return instr.opcode.compare("b") == 0 || instr.opcode.compare("bx") == 0;
+}
+
+//leaf functions that don't touch r4-r7 keep lr live and need no frame at all
+bool Gen_ARM::needs_frame() {
+   return reg_alloc.has_calls || reg_alloc.saved_registers.size() || reg_alloc.saved_float_registers.size()
+      || uses_frame_pointer();
+}
+
+int Gen_ARM::get_push_size() {
+   if (!needs_frame()) {
+      return 0;
+   }
+   return (reg_alloc.saved_registers.size() + (uses_frame_pointer() ? 1 : 0) + 1 + get_vfp_save_count()) * 4;
+}
+
+//vpush takes a consecutive range, so everything from s16 up to the highest
+//callee-saved VFP register used is preserved
+int Gen_ARM::get_vfp_save_count() {
+   int count = 0;
+   for (int r : reg_alloc.saved_float_registers) {
+      count = std::max(count, r + 1);
+   }
+   return count;
+}
+
+static std::string get_vfp_range(int count) {
+   if (count == 1) {
+      return "{ s16 }";
+   }
+   return "{ s16-s" + std::to_string(15 + count) + " }";
+}
+
+void Gen_ARM::emit_vfp_save() {
+   if (get_vfp_save_count()) {
+      emit_instr("vpush", { get_vfp_range(get_vfp_save_count()) });
+   }
+}
+
+void Gen_ARM::emit_vfp_restore() {
+   if (get_vfp_save_count()) {
+      emit_instr("vpop", { get_vfp_range(get_vfp_save_count()) });
+   }
+}
+
+//only the callee-saved registers the function touches are preserved
+std::string Gen_ARM::get_push_list(std::string last) {
+   std::string list = "{ ";
+   for (int r : reg_alloc.saved_registers) {
+      list += gen_var(allocatable_registers[r]) + ", ";
+   }
+   if (uses_frame_pointer()) {
+      list += gen_var(REG_FRAME) + ", ";
+   }
+   return list + last + " }";
 }
 
 void Gen_ARM::emit_function_header() {
-   os << '\t' << "push " << " { r4, r5, r6, r7, lr }" << std::endl;
+   if (needs_frame()) {
+      emit_instr("push", { get_push_list("lr") });
+   }
+   if (uses_frame_pointer()) {
+      //r7 points at its own saved copy, the saved lr sits right above
+      emit_instr("add", { gen_var(REG_FRAME), "sp", "#" + std::to_string(reg_alloc.saved_registers.size() * 4) });
+   }
+   emit_vfp_save();
 }
 
 void Gen_ARM::emit_function_footer() {
-   os << '\t' << "pop " << " { r4, r5, r6, r7, pc }" << std::endl;
-   os << '\t' << ".ltorg" << std::endl;
+   if (needs_frame()) {
+      emit_vfp_restore();
+      emit_instr("pop", { get_push_list("pc") });
+   }
+}
+
+//Vectors live in memory and go through q0 and q1, which are s0-s7 and only
+//hold arguments around calls. Without hard-float there is no NEON either and
+//Code_Gen does them a lane at a time.
+static std::string get_neon_pair(int q) {
+   return "d" + std::to_string(q * 2) + "-d" + std::to_string(q * 2 + 1);
+}
+
+void Gen_ARM::emit_neon_load(Variable var, int q) {
+   if (var.is_type_const) {
+      emit_instr("ldr", { gen_var(REG_INDEX), "=" + get_rodata(var) });
+      emit_instr("vld1.32", { "{ " + get_neon_pair(q) + " }", "[" + gen_var(REG_INDEX) + "]" });
+      return;
+   }
+   emit_instr("vldr", { "d" + std::to_string(q * 2), gen_var(get_lane(var, 0)) });
+   emit_instr("vldr", { "d" + std::to_string(q * 2 + 1), gen_var(get_lane(var, 2)) });
+}
+
+void Gen_ARM::emit_neon_store(Variable var, int q) {
+   emit_instr("vstr", { "d" + std::to_string(q * 2), gen_var(get_lane(var, 0)) });
+   emit_instr("vstr", { "d" + std::to_string(q * 2 + 1), gen_var(get_lane(var, 2)) });
+}
+
+std::string Gen_ARM::gen_pointer_register(Variable ptr) {
+   std::string ptr_s = gen_var(ptr);
+   if (!is_reg_operand(ptr_s)) {
+      emit_mov(ptr, REG_INDEX);
+      ptr_s = gen_var(REG_INDEX);
+   }
+   return ptr_s;
+}
+
+void Gen_ARM::emit_vector_mov(Variable src, Variable dst) {
+   if (!hard_float) {
+      Code_Gen::emit_vector_mov(src, dst);
+      return;
+   }
+   if (src.is_vector()) {
+      emit_neon_load(src, 0);
+   } else {
+      emit_mov(src, REG_ACCUMULATOR);
+      emit_instr("vdup.32", { "q0", gen_var(REG_ACCUMULATOR) });
+   }
+   emit_neon_store(dst, 0);
+}
+
+void Gen_ARM::emit_vector_op(Instruction::IType op, Variable src, Variable dst) {
+   if (!hard_float) {
+      Code_Gen::emit_vector_op(op, src, dst);
+      return;
+   }
+   bool is_float = dst.type == Variable::FLOAT_32X4;
+   std::string instr = "vorr";
+   if (op == Instruction::ADD) {
+      instr = is_float ? "vadd.f32" : "vadd.i32";
+   } else if (op == Instruction::MULTIPLY) {
+      instr = is_float ? "vmul.f32" : "vmul.i32";
+   }
+   emit_neon_load(dst, 0);
+   emit_neon_load(src, 1);
+   emit_instr(instr, { "q0", "q0", "q1" });
+   emit_neon_store(dst, 0);
+}
+
+//NEON has no general 32-bit lane shuffle, q1's lanes are picked one at a
+//time through the single precision registers that alias them
+void Gen_ARM::emit_vector_shuffle(Variable src, Variable dst, int mask) {
+   if (!hard_float) {
+      Code_Gen::emit_vector_shuffle(src, dst, mask);
+      return;
+   }
+   emit_neon_load(src, 1);
+   for (int i = 0; i < 4; ++i) {
+      emit_instr("vmov.f32", { "s" + std::to_string(i), "s" + std::to_string(4 + ((mask >> (2 * i)) & 3)) });
+   }
+   emit_neon_store(dst, 0);
+}
+
+void Gen_ARM::emit_vector_load(Variable ptr, Variable dst) {
+   if (!hard_float) {
+      Code_Gen::emit_vector_load(ptr, dst);
+      return;
+   }
+   std::string ptr_s = gen_pointer_register(ptr);
+   emit_instr("vld1.32", { "{ " + get_neon_pair(0) + " }", "[" + ptr_s + "]" });
+   emit_neon_store(dst, 0);
+}
+
+void Gen_ARM::emit_vector_store(Variable src, Variable ptr) {
+   if (!hard_float) {
+      Code_Gen::emit_vector_store(src, ptr);
+      return;
+   }
+   emit_neon_load(src, 0);
+   std::string ptr_s = gen_pointer_register(ptr);
+   emit_instr("vst1.32", { "{ " + get_neon_pair(0) + " }", "[" + ptr_s + "]" });
+}
+
+//Called like _exit. Opens the profile, writes the counters into it through
+//the platform library and only then exits with the status it was given.
+void Gen_ARM::gen_profile_exit() {
+   Variable path;
+   path.type = Variable::DQString;
+   path.dqstring = profile->path;
+   emit_text("\t.align 2");
+   emit_text("\t.code 16");
+   emit_text("\t.thumb_func");
+   emit_label(PROFILE_EXIT);
+   emit_instr("push", { "{ r4, r5, r6, lr }" });
+   emit_instr("mov", { "r4", "r0" });
+   emit_instr("ldr", { "r0", "=" + get_rodata(path) });
+   emit_instr("ldr", { "r1", "=" + std::to_string(profile->open_flags) });
+   emit_instr("ldr", { "r2", "=420" }); //rw-r--r--
+   emit_call("_open");
+   emit_instr("mov", { "r5", "r0" });
+   emit_instr("ldr", { "r1", "=" + PROFILE_COUNTERS });
+   emit_instr("ldr", { "r2", "=" + std::to_string(profile->num_counters * 4) });
+   emit_call("_write");
+   emit_instr("mov", { "r0", "r5" });
+   emit_call("_close");
+   emit_instr("mov", { "r0", "r4" });
+   emit_call("_exit");
+   emit_text("\t.ltorg");
+   print_machine_code();
 }
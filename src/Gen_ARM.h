@@ -4,77 +4,52 @@
 
 #include "Code_Gen.h"
 
-struct StackMan_ARM : public StackMan {
-
-   std::string load_var(Variable var, Scope *ts = nullptr, int total_adjust = 0) {
+//the first four arguments travel in r0-r3, the rest on the stack
+const int ARM_REGISTER_ARGS = 4;
 
-      if (ext_adj) {
-         total_adjust = ext_adj;
-         ext_adj = 0;
-      }
-
-      int stack_loc = 0;
-      for (size_t i = 0; i < params.size(); ++i) {
-         if (params[i].name.compare(var.name) == 0) {
-            stack_loc = i * 4 + 8;// +8 accounts for push %ebp and 4 byte return address
-            return "[" + code_gen->gen_var(REG_FRAME) + ", #" + std::to_string(stack_loc) + "]";
-         }
-      }
+//Everything is addressed off sp: variables sit at the top of each scope's
+//frame, the function's frame also holds home slots for r0-r3 under its
+//variables, and the outgoing stack arguments sit at the bottom.
+struct StackMan_ARM : public StackMan {
 
-
-      if (scope && !ts) {
-
-         for (size_t i = 0; i < scope->variables.size(); ++i) {
-
-            if (scope->variables[i].name.compare(var.name) == 0) {
-               int padding = 16 - ((scope->variables.size() * 4) % 16);
-               if (padding == 16) padding = 0;
-               stack_loc = i * 4 + padding + total_adjust;
-               return "[" + code_gen->gen_var(REG_FRAME) + ", #" + std::to_string(stack_loc) + "]";
-            }
-         }
-      } else if (ts) {
-         printf("TS\n");
-         for (size_t i = 0; i < ts->variables.size(); ++i) {
-
-            if (ts->variables[i].name.compare(var.name) == 0) {
-               int padding = 16 - ((ts->variables.size() * 4) % 16);
-               if (padding == 16) padding = 0;
-               stack_loc = i * 4 + padding + total_adjust;
-               return "[" + code_gen->gen_var(REG_FRAME) + ", #" + std::to_string(stack_loc) + "]";
-            }
-         }
-      }
-      Scope *sc = (ts ? ts : scope);
-      int padding = 16 - ((sc->variables.size() * 4) % 16);
-      if (padding == 16) padding = 0;
-      int adj = padding + sc->variables.size() * 4;
-      if (sc->variables.size() == 0) {
-         adj = 0;
-      }
-      adj += total_adjust;
-      if ((ts ? !ts->parent : !scope->parent)) {
-         return "";
-      }
-      return (scope->is_function ? ""
-         : (ts ? (ts->is_function ? "" : load_var(var, ts->parent, adj)) : load_var(var, scope->parent, adj)));
-   }
+   virtual Frame_Slot get_param_slot(size_t n, Scope &scope);
+   virtual std::string format_slot(Frame_Slot slot);
 
 };
 
 struct Gen_ARM : public Code_Gen {
 
-   Gen_ARM(std::ostream &ost) : Code_Gen(ost) {
+   bool hard_float = false; //floats live in VFP registers and are passed in s0-s15
+
+   Gen_ARM(Asm_Buf &ost, bool use_hard_float = false) : Code_Gen(ost) {
       stack_man = new StackMan_ARM();
       stack_man->code_gen = this;
+      pic = false; //strings are loaded from the literal pool
+      hard_float = use_hard_float;
+      //r4-r6, r7 is the thumb frame pointer
+      for (int i = 0; i < 3; ++i) {
+         allocatable_registers.push_back(create_register(REGISTER_SAVED + std::to_string(i)));
+      }
+      //s16-s31 are callee-saved
+      for (int i = 0; hard_float && i < 16; ++i) {
+         float_registers.push_back(create_register(REGISTER_FLOAT_SAVED + std::to_string(i)));
+      }
    }
 
    virtual std::string gen_var(Variable var);
-
-   virtual void gen_rodata();
-   virtual void gen_func_params(std::vector<Variable> &plist);
+   virtual std::string gen_global(Variable var);
+   virtual void gen_profile_exit();
+   virtual void emit_instr(const std::string &opcode, const std::vector<std::string> &operands = {});
+   virtual Machine_Operand parse_operand(const std::string &op) { return parse_arm_operand(op); };
+   virtual void print_operand(const Machine_Operand &op) { print_arm_operand(os, op); };
+
+   virtual void gen_stack_alignment(Scope &scope);
+   virtual void gen_stack_unalignment(Scope &scope);
+   virtual void gen_func_params(Function &func, std::vector<Variable> &plist);
+   virtual void gen_param_loads(Function &func);
    virtual void gen_function_attributes(Function &func);
-   virtual int gen_stack_unwind(Scope &scope);
+   virtual int get_frame_size(Scope &scope);
+   virtual bool gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope);
 
    virtual void emit_cmp(Variable src0, Variable src1);
    virtual void emit_inc(Variable dst);
@@ -84,12 +59,34 @@ struct Gen_ARM : public Code_Gen {
    virtual void emit_sub(Variable src, Variable dst);
    virtual void emit_add(Variable src, Variable dst);
    virtual void emit_or(Variable src, Variable dst);
+   virtual void emit_mul(Variable src, Variable dst);
    virtual void emit_call(std::string label);
    virtual void emit_jump(std::string label);
    virtual void emit_cond_jump(std::string label, Conditional::CType condition);
    virtual void emit_return();
+   virtual bool is_block_exit(const Machine_Instr &instr);
+   bool needs_frame();
+   int get_push_size();
+   int get_vfp_save_count();
+   Variable get_arg_location(std::vector<Variable> &list, size_t n);
+   int get_home_index(std::vector<Variable> &list, size_t n);
+   void emit_vfp_mov(Variable src, std::string src_s, std::string dst_s);
+   void emit_arith(std::string op, Variable src, Variable dst);
+   void emit_vfp_save();
+   void emit_vfp_restore();
+   std::string get_push_list(std::string last);
+
    virtual void emit_function_header();
    virtual void emit_function_footer();
+
+   void emit_neon_load(Variable var, int q);
+   void emit_neon_store(Variable var, int q);
+   std::string gen_pointer_register(Variable ptr);
+   virtual void emit_vector_mov(Variable src, Variable dst);
+   virtual void emit_vector_op(Instruction::IType op, Variable src, Variable dst);
+   virtual void emit_vector_shuffle(Variable src, Variable dst, int mask);
+   virtual void emit_vector_load(Variable ptr, Variable dst);
+   virtual void emit_vector_store(Variable src, Variable ptr);
 };
 
 
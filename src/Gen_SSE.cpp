@@ -0,0 +1,47 @@
+#include "Gen_SSE.h"
+
+void emit_sse_mov(Code_Gen &gen, const std::string &src_s, const std::string &dst_s) {
+   gen.emit_instr("movups", { src_s, "%xmm0" });
+   gen.emit_instr("movups", { "%xmm0", dst_s });
+}
+
+void emit_sse_splat(Code_Gen &gen, const std::string &src_s, const std::string &dst_s) {
+   if (src_s.compare(0, 4, "%xmm") == 0) {
+      gen.emit_instr("pshufd", { "$0", src_s, "%xmm0" });
+   } else {
+      gen.emit_instr("movd", { src_s, "%xmm0" });
+      gen.emit_instr("pshufd", { "$0", "%xmm0", "%xmm0" });
+   }
+   gen.emit_instr("movups", { "%xmm0", dst_s });
+}
+
+void emit_sse_op(Code_Gen &gen, Instruction::IType op, bool is_float, const std::string &src_s,
+   const std::string &dst_s) {
+   std::string instr;
+   if (op == Instruction::ADD) {
+      instr = is_float ? "addps" : "paddd";
+   } else if (op == Instruction::MULTIPLY) {
+      instr = "mulps";
+   } else {
+      instr = is_float ? "orps" : "por";
+   }
+   gen.emit_instr("movups", { dst_s, "%xmm0" });
+   gen.emit_instr("movups", { src_s, "%xmm1" });
+   gen.emit_instr(instr, { "%xmm1", "%xmm0" });
+   gen.emit_instr("movups", { "%xmm0", dst_s });
+}
+
+void emit_sse_shuffle(Code_Gen &gen, bool is_float, int mask, const std::string &src_s, const std::string &dst_s) {
+   gen.emit_instr("movups", { src_s, "%xmm0" });
+   //shufps takes its upper two lanes from the source, the same register here
+   gen.emit_instr(is_float ? "shufps" : "pshufd", { "$" + std::to_string(mask), "%xmm0", "%xmm0" });
+   gen.emit_instr("movups", { "%xmm0", dst_s });
+}
+
+void emit_sse_int_mul(Code_Gen &gen, const std::string src_lanes[4], const std::string dst_lanes[4]) {
+   for (int i = 0; i < 4; ++i) {
+      gen.emit_instr("movl", { dst_lanes[i], "%eax" });
+      gen.emit_instr("imull", { src_lanes[i], "%eax" });
+      gen.emit_instr("movl", { "%eax", dst_lanes[i] });
+   }
+}
@@ -0,0 +1,20 @@
+#ifndef GEN_SSE_H
+#define GEN_SSE_H
+
+#include <string>
+
+#include "Code_Gen.h"
+
+//float4 and int4 for the x86 backends. Vectors live in memory and stack slots
+//are only 4 or 8-byte aligned, so every vector is moved through %xmm0 and
+//%xmm1 with movups. The backend resolves the operands: memory, an XMM
+//register, or for a splat any scalar operand movd can read.
+void emit_sse_mov(Code_Gen &gen, const std::string &src_s, const std::string &dst_s);
+void emit_sse_splat(Code_Gen &gen, const std::string &src_s, const std::string &dst_s);
+void emit_sse_op(Code_Gen &gen, Instruction::IType op, bool is_float, const std::string &src_s,
+   const std::string &dst_s);
+void emit_sse_shuffle(Code_Gen &gen, bool is_float, int mask, const std::string &src_s, const std::string &dst_s);
+//SSE2 has no 32-bit lane multiply, int4 is multiplied a lane at a time in %eax
+void emit_sse_int_mul(Code_Gen &gen, const std::string src_lanes[4], const std::string dst_lanes[4]);
+
+#endif
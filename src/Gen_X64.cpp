@@ -0,0 +1,661 @@
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+
+#include "Gen_X64.h"
+#include "Gen_SSE.h"
+
+const Variable X64_ARGS[] = {
+   create_register("_X64_ARG_RDI"),
+   create_register("_X64_ARG_RSI"),
+   create_register("_X64_ARG_RDX"),
+   create_register("_X64_ARG_RCX"),
+   create_register("_X64_ARG_R8"),
+   create_register("_X64_ARG_R9")
+};
+
+//float arguments, _X64_ARG_XMM0 to _X64_ARG_XMM7
+const std::string X64_FLOAT_ARG = "_X64_ARG_XMM";
+
+//nothing goes on the stack before six arguments went to registers, floats included
+static int get_stack_args(int num_args) {
+   return num_args > X64_REGISTER_ARGS ? num_args - X64_REGISTER_ARGS : 0;
+}
+
+//the slot in the outgoing area an argument location refers to, -1 for registers
+static int get_outgoing_index(const Variable &loc) {
+   if (loc.name.compare(0, REGISTER_OUTGOING_ARG.size(), REGISTER_OUTGOING_ARG) != 0) {
+      return -1;
+   }
+   return std::stoi(loc.name.substr(REGISTER_OUTGOING_ARG.size()));
+}
+
+//Integer arguments take %rdi, %rsi, %rdx, %rcx, %r8 and %r9, float arguments
+//take %xmm0-%xmm7 independently, everything else goes on the stack in order.
+Variable Gen_X64::get_arg_location(std::vector<Variable> &list, size_t n) {
+   int core = 0;
+   int sse = 0;
+   int stack = 0;
+   Variable loc;
+   for (size_t i = 0; i <= n && i < list.size(); ++i) {
+      bool is_float = list[i].type == Variable::FLOAT_32BIT;
+      if (is_float && sse < X64_FLOAT_REGISTER_ARGS) {
+         loc = create_register(X64_FLOAT_ARG + std::to_string(sse++));
+      } else if (!is_float && core < X64_REGISTER_ARGS) {
+         loc = X64_ARGS[core++];
+      } else {
+         loc = create_register(REGISTER_OUTGOING_ARG + std::to_string(stack++));
+      }
+   }
+   return loc;
+}
+
+//register arguments get home slots in the order they appear
+int Gen_X64::get_home_index(std::vector<Variable> &list, size_t n) {
+   int index = 0;
+   for (size_t i = 0; i < n && i < list.size(); ++i) {
+      if (get_outgoing_index(get_arg_location(list, i)) < 0) {
+         index++;
+      }
+   }
+   return index;
+}
+
+StackMan::Frame_Slot StackMan_X64::get_param_slot(size_t n, Scope &scope) {
+   Gen_X64 *x64 = (Gen_X64 *)code_gen;
+   int stack_index = get_outgoing_index(x64->get_arg_location(params, n));
+   if (stack_index < 0) {
+      Scope *fs = code_gen->current_function->scope;
+      int home = x64->get_home_index(params, n);
+      int vars = get_frame_bytes(*fs);
+      return { code_gen->gen_stack_unwind(scope) - vars - (home + 1) * 8, false, true, params[n].type };
+   }
+   if (code_gen->uses_frame_pointer()) {
+      return { stack_index * 8 + 16, true, true, params[n].type }; // +16 accounts for push %rbp and 8 byte return address
+   }
+   //+8 for the return address, then everything pushed or reserved since entry
+   int offset = stack_index * 8 + 8 + code_gen->reg_alloc.saved_registers.size() * 8 + code_gen->gen_stack_unwind(scope);
+   return { offset, false, true, params[n].type };
+}
+
+std::string StackMan_X64::format_slot(Frame_Slot slot) {
+   return std::to_string(slot.offset) + (slot.frame_based ? "(%rbp)" : "(%rsp)");
+}
+
+//int is a quad here, only the narrow types are smaller
+static int get_type_size(Variable::VType type) {
+   switch (type) {
+      case Variable::CHAR:
+      case Variable::INT_8BIT: return 1;
+      case Variable::INT_16BIT: return 2;
+      default: return 8;
+   }
+}
+
+//narrow locals take their natural size, so they wrap like they do on i386
+int StackMan_X64::get_var_size(const Variable &var) {
+   return var.is_vector() ? 16 : get_type_size(var.type);
+}
+
+int StackMan_X64::get_var_align(const Variable &var) {
+   return std::min(get_var_size(var), 8);
+}
+
+static bool is_memory_operand(const std::string &op) {
+   return op.size() && op[0] != '%' && op[0] != '$';
+}
+
+static std::string get_size_suffix(int size) {
+   return size == 1 ? "b" : (size == 2 ? "w" : "q");
+}
+
+//char is unsigned, the sized integers are signed
+static std::string get_extend_op(Variable::VType type) {
+   switch (type) {
+      case Variable::CHAR: return "movzbq";
+      case Variable::INT_8BIT: return "movsbq";
+      default: return "movswq";
+   }
+}
+
+//%al, %sil, %r12b and the like, every register has byte and word forms
+static std::string get_sub_register(const std::string &reg, int size) {
+   if (isdigit(reg[2])) {
+      return reg + (size == 1 ? "b" : "w");
+   }
+   if (reg[3] == 'x') {
+      return "%" + (size == 1 ? reg.substr(2, 1) + "l" : reg.substr(2));
+   }
+   return "%" + reg.substr(2) + (size == 1 ? "l" : "");
+}
+
+//Same layout as Gen_386 with 8 byte slots: %rsp is 16-byte aligned at every
+//call, and the outgoing area only holds the arguments past the sixth. The
+//function's frame also holds the home slots of its register arguments,
+//under the variables of all its blocks.
+int Gen_X64::get_frame_size(Scope &scope) {
+   if (!stack_man->is_frame_scope(scope)) {
+      return 0;
+   }
+   int size = stack_man->get_frame_bytes(scope);
+   if (scope.is_function && current_function) {
+      size += get_home_index(current_function->parameters, current_function->parameters.size()) * 8;
+   }
+   if (!reg_alloc.has_calls || (!scope.is_function && size == 0)) {
+      return size;
+   }
+   size += get_stack_args(reg_alloc.max_call_args) * 8;
+   int entry = 0;
+   if (scope.is_function) {
+      entry = 8 + reg_alloc.saved_registers.size() * 8 + (uses_frame_pointer() ? 8 : 0);
+   }
+   return ((size + entry + 15) & ~15) - entry;
+}
+
+void Gen_X64::gen_stack_alignment(Scope &scope) {
+   int stack_adj = get_frame_size(scope);
+   if (stack_adj > 0) {
+      emit_sub(create_const_int32(stack_adj), REG_STACK);
+   }
+}
+
+void Gen_X64::gen_stack_unalignment(Scope &scope) {
+   int stack_adj = get_frame_size(scope);
+   if (stack_adj > 0) {
+      emit_add(create_const_int32(stack_adj), REG_STACK);
+   }
+}
+
+void Gen_X64::gen_func_params(Function &func, std::vector<Variable> &plist) {
+   for (size_t i = 0; i < plist.size(); ++i) {
+      emit_mov(plist[i], get_arg_location(plist, i));
+   }
+}
+
+//register arguments move straight into the register Reg_Alloc gave them, or
+//are stored to their home slot; arguments nobody reads are left alone.
+//Narrow ones never get a register and are always stored.
+void Gen_X64::gen_param_loads(Function &func) {
+   Scope *scope = stack_man->scope;
+   stack_man->scope = func.scope;
+   for (size_t i = 0; i < func.parameters.size(); ++i) {
+      Variable loc = get_arg_location(func.parameters, i);
+      if (stack_man->get_var_size(func.parameters[i]) < stack_man->slot_size && get_outgoing_index(loc) < 0) {
+         emit_mov(loc, func.parameters[i]);
+      }
+   }
+   for (auto &li : reg_alloc.intervals) {
+      if (!li.is_param) {
+         continue;
+      }
+      Variable loc = get_arg_location(func.parameters, li.param_index);
+      if (get_outgoing_index(loc) < 0) {
+         emit_mov(loc, func.parameters[li.param_index]);
+      } else if (li.reg >= 0) {
+         reg_alloc.enabled = false;
+         emit_mov(func.parameters[li.param_index], *reg_alloc.get_interval_register(li, *this));
+         reg_alloc.enabled = true;
+      }
+   }
+   stack_man->scope = scope;
+}
+
+//Arguments in registers survive the epilogue, so any call that needs no
+//stack arguments can become a jump.
+bool Gen_X64::gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope) {
+   for (size_t i = 0; i < plist.size(); ++i) {
+      if (get_outgoing_index(get_arg_location(plist, i)) >= 0) {
+         return false;
+      }
+   }
+   gen_func_params(func, plist);
+
+   int stack_adj = gen_stack_unwind(scope);
+   if (stack_adj > 0) {
+      emit_add(create_const_int32(stack_adj), REG_STACK);
+   }
+   if (func.name.compare(current_function->name) == 0) {
+      //self recursion keeps the frame and loops back past the prologue
+      emit_jump(get_tail_label(func));
+   } else {
+      emit_function_footer();
+      emit_jump(func.name);
+   }
+   return true;
+}
+
+static bool is_reg_operand(const std::string &op) {
+   return op.size() && op[0] == '%';
+}
+
+static bool is_xmm_operand(const std::string &op) {
+   return op.compare(0, 4, "%xmm") == 0;
+}
+
+//a float constant as an SSE source operand, out of the literal pool
+std::string Gen_X64::gen_float_const(Variable var) {
+   if (var.type != Variable::FLOAT_32BIT) {
+      var = create_const_float32(var.pvalue);
+   }
+   return get_rodata(var) + "(%rip)";
+}
+
+std::string  Gen_X64::gen_var(Variable var) {
+
+   if (var.name.compare(REGISTER_RETURN) == 0) {
+      return "%rax";
+   } else if (var.name.compare(REGISTER_FLOAT_RETURN) == 0) {
+      return "%xmm0";
+   } else if (var.name.compare(0, REGISTER_FLOAT_SAVED.size(), REGISTER_FLOAT_SAVED) == 0) {
+      return "%xmm" + std::to_string(8 + std::stoi(var.name.substr(REGISTER_FLOAT_SAVED.size())));
+   } else if (var.name.compare(0, X64_FLOAT_ARG.size(), X64_FLOAT_ARG) == 0) {
+      return "%xmm" + var.name.substr(X64_FLOAT_ARG.size());
+   } else if (var.name.compare(REGISTER_ACCUMULATOR) == 0) {
+      return "%rax";
+   } else if (var.name.compare(REGISTER_INDEX) == 0) {
+      return "%r11";
+   } else if (var.name.compare(REGISTER_STACK_POINTER) == 0) {
+      return "%rsp";
+   } else if (var.name.compare(REGISTER_FRAME_POINTER) == 0) {
+      return "%rbp";
+   } else if (var.name.compare(0, REGISTER_SAVED.size(), REGISTER_SAVED) == 0) {
+      static const char *saved[] = { "%rbx", "%r12", "%r13", "%r14", "%r15" };
+      return saved[std::stoi(var.name.substr(REGISTER_SAVED.size()))];
+   } else if (var.name.compare(0, REGISTER_OUTGOING_ARG.size(), REGISTER_OUTGOING_ARG) == 0) {
+      return std::to_string(std::stoi(var.name.substr(REGISTER_OUTGOING_ARG.size())) * 8) + "(%rsp)";
+   } else if (var.name.compare(0, REGISTER_INDIRECT.size(), REGISTER_INDIRECT) == 0) {
+      return var.name.substr(REGISTER_INDIRECT.size()) + "(%r11)";
+   }
+
+   for (int i = 0; i < X64_REGISTER_ARGS; ++i) {
+      if (var.name.compare(X64_ARGS[i].name) == 0) {
+         static const char *args[] = { "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9" };
+         return args[i];
+      }
+   }
+
+   if (var.is_type_const && is_integer_type(var.type)) {
+      return std::string("$") + std::to_string(var.pvalue);
+   } else if (var.is_type_const && var.type == Variable::FLOAT_32BIT) {
+      return std::string("$") + std::to_string(get_float_bits(var.fvalue));
+   } else if (var.type == Variable::DQString) {
+      emit_instr("leaq", { get_rodata(var) + "(%rip)", "%rax" });
+      return gen_var(REG_ACCUMULATOR);
+   } else {
+       return stack_man->load_var(var);
+   }
+}
+
+void Gen_X64::emit_cmp(Variable src0, Variable src1) {
+   float_compare = src1.type == Variable::FLOAT_32BIT;
+   if (float_compare) {
+      std::string left_s = gen_var(src1);
+      if (!is_xmm_operand(left_s)) {
+         emit_instr("movss", { left_s, "%xmm0" });
+         left_s = "%xmm0";
+      }
+      std::string right_s = src0.is_type_const ? gen_float_const(src0) : gen_var(src0);
+      if (is_reg_operand(right_s) && !is_xmm_operand(right_s)) {
+         emit_instr("movq", { right_s, "%xmm1" });
+         right_s = "%xmm1";
+      }
+      emit_instr("ucomiss", { right_s, left_s });
+      return;
+   }
+   std::string dst_s = gen_var(src1);
+   emit_mov(src0, REG_ACCUMULATOR);
+   Variable::VType left_type = get_mem_type(src1);
+   if (is_memory_operand(dst_s) && get_type_size(left_type) < 8) {
+      emit_instr(get_extend_op(left_type), { dst_s, "%r11" });
+      dst_s = "%r11";
+   }
+   emit_instr("cmpq", { "%rax", dst_s });
+}
+
+void Gen_X64::emit_inc(Variable dst) {
+   if (dst.type == Variable::FLOAT_32BIT) {
+      std::string dst_s = gen_var(dst);
+      std::string one_s = gen_float_const(create_const_float32(1.0f));
+      if (is_xmm_operand(dst_s)) {
+         emit_instr("addss", { one_s, dst_s });
+         return;
+      }
+      emit_instr("movss", { dst_s, "%xmm0" });
+      emit_instr("addss", { one_s, "%xmm0" });
+      emit_instr("movss", { "%xmm0", dst_s });
+      return;
+   }
+   emit_add(create_const_int32(1), dst);
+}
+
+void Gen_X64::emit_push(Variable src) {
+   std::string src_s = gen_var(src);
+   emit_instr("pushq", { src_s });
+}
+
+void Gen_X64::emit_pop(Variable dst) {
+   std::string dst_s = gen_var(dst);
+   emit_instr("popq", { dst_s });
+}
+
+//Moves that involve an XMM register. A float in memory is the low half of
+//its slot, in an integer register the low half of the register.
+void Gen_X64::emit_float_mov(Variable src, std::string src_s, std::string dst_s) {
+   if (is_xmm_operand(dst_s)) {
+      if (src.is_type_const) {
+         if (src.type == Variable::FLOAT_32BIT && src.fvalue == 0.0f && !std::signbit(src.fvalue)) {
+            emit_instr("xorps", { dst_s, dst_s });
+            return;
+         }
+         src_s = gen_float_const(src);
+      }
+      if (is_xmm_operand(src_s)) {
+         if (src_s.compare(dst_s) != 0) {
+            emit_instr("movaps", { src_s, dst_s });
+         }
+      } else if (is_reg_operand(src_s)) {
+         emit_instr("movq", { src_s, dst_s });
+      } else {
+         emit_instr("movss", { src_s, dst_s });
+      }
+      return;
+   }
+   //only the source is an XMM register
+   if (is_reg_operand(dst_s)) {
+      emit_instr("movq", { src_s, dst_s });
+   } else {
+      emit_instr("movss", { src_s, dst_s });
+   }
+}
+
+void Gen_X64::emit_mov(Variable src, Variable dst) {
+   std::string dst_s = gen_var(dst);
+   //string literals are the only unnamed strings, registers carry no type
+   if (src.name.empty() && src.type == Variable::DQString && is_reg_operand(dst_s)) {
+      emit_instr("leaq", { get_rodata(src) + "(%rip)", dst_s });
+      return;
+   }
+   std::string src_s = src.is_type_const && is_xmm_operand(dst_s) ? "" : gen_var(src);
+   if (is_xmm_operand(src_s) || is_xmm_operand(dst_s)) {
+      emit_float_mov(src, src_s, dst_s);
+      return;
+   }
+   if (src.is_type_const && is_integer_type(src.type) && (src.pvalue < INT32_MIN || src.pvalue > INT32_MAX)) {
+      //only movabs takes a 64-bit immediate, and only into a register
+      emit_instr("movabsq", { src_s, gen_var(REG_ACCUMULATOR) });
+      src_s = gen_var(REG_ACCUMULATOR);
+   }
+   Variable::VType src_type = get_mem_type(src);
+   if (!is_memory_operand(dst_s) && is_memory_operand(src_s) && get_type_size(src_type) < 8) {
+      emit_instr(get_extend_op(src_type), { src_s, dst_s });
+      return;
+   }
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 8;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("mov" + get_size_suffix(size), { src_s, dst_s });
+}
+
+//The declared type of a variable that lives in memory. Registers hold
+//narrow values widened, so they and constants count as int.
+Variable::VType Gen_X64::get_mem_type(Variable var) {
+   if (var.is_type_const || var.is_vector() || stack_man->get_register(var)) {
+      return Variable::INT_32BIT;
+   }
+   const StackMan::Frame_Slot *slot = stack_man->find_slot(var);
+   if (slot) {
+      return slot->type;
+   }
+   const Variable *global = get_global(var);
+   return global ? global->type : Variable::INT_32BIT;
+}
+
+//Gets an integer source ready for an instruction that writes dst_s. Narrow
+//values in memory are widened into %rax, as is anything in memory when the
+//destination is too. A narrow destination takes the source cut to its size.
+std::string Gen_X64::gen_int_source(Variable src, std::string src_s, std::string dst_s, int dst_size) {
+   bool dst_memory = is_memory_operand(dst_s);
+   if (is_memory_operand(src_s)) {
+      Variable::VType src_type = get_mem_type(src);
+      if (get_type_size(src_type) < 8) {
+         emit_instr(get_extend_op(src_type), { src_s, "%rax" });
+         src_s = "%rax";
+      } else if (dst_memory) {
+         //no memory to memory moves, go through the accumulator
+         emit_instr("movq", { src_s, "%rax" });
+         src_s = "%rax";
+      }
+   }
+   if (!dst_memory || dst_size >= 8) {
+      return src_s;
+   }
+   if (src.is_type_const) {
+      return "$" + std::to_string(dst_size == 1 ? (int8_t)src.pvalue : (int16_t)src.pvalue);
+   }
+   return get_sub_register(src_s, dst_size);
+}
+
+void Gen_X64::emit_sub(Variable src, Variable dst) {
+   std::string dst_s = gen_var(dst);
+   std::string src_s = gen_var(src);
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 8;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("sub" + get_size_suffix(size), { src_s, dst_s });
+}
+
+void Gen_X64::emit_add(Variable src, Variable dst) {
+   std::string dst_s = gen_var(dst);
+   std::string src_s = gen_var(src);
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 8;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("add" + get_size_suffix(size), { src_s, dst_s });
+}
+
+void Gen_X64::emit_or(Variable src, Variable dst) {
+   std::string dst_s = gen_var(dst);
+   std::string src_s = gen_var(src);
+   int size = is_memory_operand(dst_s) ? get_type_size(get_mem_type(dst)) : 8;
+   src_s = gen_int_source(src, src_s, dst_s, size);
+   emit_instr("or" + get_size_suffix(size), { src_s, dst_s });
+}
+
+//imul only writes a register, narrow operands are widened first
+void Gen_X64::emit_mul(Variable src, Variable dst) {
+   std::string dst_s = gen_var(dst);
+   std::string src_s = gen_var(src);
+   Variable::VType src_type = get_mem_type(src);
+   if (is_memory_operand(src_s) && get_type_size(src_type) < 8) {
+      emit_instr(get_extend_op(src_type), { src_s, "%r11" });
+      src_s = "%r11";
+   }
+   if (is_reg_operand(dst_s)) {
+      emit_instr("imulq", { src_s, dst_s });
+      return;
+   }
+   Variable::VType dst_type = get_mem_type(dst);
+   int size = get_type_size(dst_type);
+   emit_instr(size < 8 ? get_extend_op(dst_type) : "movq", { dst_s, "%rax" });
+   emit_instr("imulq", { src_s, "%rax" });
+   emit_instr("mov" + get_size_suffix(size), { size < 8 ? get_sub_register("%rax", size) : "%rax", dst_s });
+}
+
+void Gen_X64::emit_call(std::string label) {
+   emit_instr("call", { label });
+}
+
+void Gen_X64::emit_jump(std::string label) {
+   emit_instr("jmp", { label });
+}
+
+void Gen_X64::emit_cond_jump(std::string label, Conditional::CType condition) {
+   if (float_compare) {
+      //ucomiss sets the flags like an unsigned compare, and an unordered
+      //result, a NaN on either side, fails every condition
+      emit_instr("jp", { label });
+      std::string jump;
+      switch (condition) {
+         case Conditional::EQUAL: {
+            jump = "jne";
+         } break;
+
+         case Conditional::GREATER_THAN: {
+            jump = "jbe";
+         } break;
+
+         case Conditional::LESS_THAN: {
+            jump = "jae";
+         } break;
+         case Conditional::GREATER_EQUAL: {
+            jump = "jb";
+         } break;
+
+         case Conditional::LESS_EQUAL: {
+            jump = "ja";
+         } break;
+      }
+      emit_instr(jump, { label });
+      return;
+   }
+   std::string jump;
+   //jumps past the body when the condition fails
+   switch (condition) {
+      case Conditional::EQUAL: {
+         jump = "jne";
+      } break;
+
+      case Conditional::GREATER_THAN: {
+         jump = "jle";
+      } break;
+
+      case Conditional::LESS_THAN: {
+         jump = "jge";
+      } break;
+      case Conditional::GREATER_EQUAL: {
+         jump = "jl";
+      } break;
+
+      case Conditional::LESS_EQUAL: {
+         jump = "jg";
+      } break;
+   }
+   emit_instr(jump, { label });
+}
+
+void Gen_X64::emit_return() {
+   emit_instr("ret");
+}
+
+bool Gen_X64::is_block_exit(const Machine_Instr &instr) {
+   return instr.opcode.compare("jmp") == 0 || instr.opcode.compare("ret") == 0;
+}
+
+void Gen_X64::emit_function_header() {
+   if (uses_frame_pointer()) {
+      emit_push(REG_FRAME);
+      emit_mov(REG_STACK, REG_FRAME);
+   }
+   for (int r : reg_alloc.saved_registers) {
+      emit_push(allocatable_registers[r]);
+   }
+}
+
+void Gen_X64::emit_function_footer() {
+   for (auto r = reg_alloc.saved_registers.rbegin(); r != reg_alloc.saved_registers.rend(); ++r) {
+      emit_pop(allocatable_registers[*r]);
+   }
+   if (uses_frame_pointer()) {
+      emit_pop(REG_FRAME);
+   }
+}
+
+std::string Gen_X64::gen_global(Variable var) {
+   return var.name + (var.offset ? "+" + std::to_string(var.offset) : "") + "(%rip)";
+}
+
+std::string Gen_X64::gen_vector_operand(Variable var) {
+   if (var.is_type_const) {
+      return get_rodata(var) + "(%rip)";
+   }
+   return gen_var(var);
+}
+
+std::string Gen_X64::gen_pointer_register(Variable ptr) {
+   std::string ptr_s = gen_var(ptr);
+   if (!is_reg_operand(ptr_s)) {
+      emit_mov(ptr, REG_INDEX);
+      ptr_s = gen_var(REG_INDEX);
+   }
+   return ptr_s;
+}
+
+void Gen_X64::emit_vector_mov(Variable src, Variable dst) {
+   if (src.is_vector()) {
+      emit_sse_mov(*this, gen_vector_operand(src), gen_var(dst));
+   } else {
+      emit_sse_splat(*this, gen_var(src), gen_var(dst));
+   }
+}
+
+void Gen_X64::emit_vector_op(Instruction::IType op, Variable src, Variable dst) {
+   if (op == Instruction::MULTIPLY && dst.type == Variable::INT_32X4) {
+      std::string src_lanes[4];
+      std::string dst_lanes[4];
+      for (int i = 0; i < 4; ++i) {
+         src_lanes[i] = gen_var(get_lane(src, i));
+         dst_lanes[i] = gen_var(get_lane(dst, i));
+      }
+      emit_sse_int_mul(*this, src_lanes, dst_lanes);
+      return;
+   }
+   emit_sse_op(*this, op, dst.type == Variable::FLOAT_32X4, gen_vector_operand(src), gen_var(dst));
+}
+
+void Gen_X64::emit_vector_shuffle(Variable src, Variable dst, int mask) {
+   emit_sse_shuffle(*this, dst.type == Variable::FLOAT_32X4, mask, gen_var(src), gen_var(dst));
+}
+
+void Gen_X64::emit_vector_load(Variable ptr, Variable dst) {
+   std::string ptr_s = gen_pointer_register(ptr);
+   emit_sse_mov(*this, "(" + ptr_s + ")", gen_var(dst));
+}
+
+void Gen_X64::emit_vector_store(Variable src, Variable ptr) {
+   std::string ptr_s = gen_pointer_register(ptr);
+   emit_sse_mov(*this, gen_var(src), "(" + ptr_s + ")");
+}
+
+//ints take a quad here, but the counters are 32-bit words
+void Gen_X64::gen_profile_count(int id) {
+   if (!profile || !profile->instrument || id < 0) {
+      return;
+   }
+   Variable counter = profile->counters;
+   counter.offset = id * 4;
+   emit_instr("addl", { "$1", gen_var(counter) });
+}
+
+//Called like _exit. Opens the profile, writes the counters into it through
+//the platform library and only then exits with the status it was given.
+void Gen_X64::gen_profile_exit() {
+   Variable path;
+   path.type = Variable::DQString;
+   path.dqstring = profile->path;
+   emit_label(PROFILE_EXIT);
+   emit_instr("pushq", { "%rbx" });
+   emit_instr("pushq", { "%r12" });
+   emit_instr("subq", { "$8", "%rsp" });
+   emit_instr("movq", { "%rdi", "%rbx" });
+   emit_instr("leaq", { get_rodata(path) + "(%rip)", "%rdi" });
+   emit_instr("movq", { "$" + std::to_string(profile->open_flags), "%rsi" });
+   emit_instr("movq", { "$420", "%rdx" }); //rw-r--r--
+   emit_call("_open");
+   emit_instr("movq", { "%rax", "%r12" });
+   emit_instr("movq", { "%rax", "%rdi" });
+   emit_instr("leaq", { PROFILE_COUNTERS + "(%rip)", "%rsi" });
+   emit_instr("movq", { "$" + std::to_string(profile->num_counters * 4), "%rdx" });
+   emit_call("_write");
+   emit_instr("movq", { "%r12", "%rdi" });
+   emit_call("_close");
+   emit_instr("movq", { "%rbx", "%rdi" });
+   emit_call("_exit");
+   print_machine_code();
+}
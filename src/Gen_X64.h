@@ -0,0 +1,86 @@
+#ifndef GEN_X64_H
+#define GEN_X64_H
+
+#include "Code_Gen.h"
+
+//the first six integer arguments travel in registers, the rest on the stack
+const int X64_REGISTER_ARGS = 6;
+//and the first eight float arguments in %xmm0-%xmm7
+const int X64_FLOAT_REGISTER_ARGS = 8;
+
+//Represents the stack for the current function's frame
+//slots are 8 bytes, register arguments are stored to home slots that sit
+//right under the function's own variables
+struct StackMan_X64 : public StackMan {
+
+   virtual Frame_Slot get_param_slot(size_t n, Scope &scope);
+   virtual std::string format_slot(Frame_Slot slot);
+   virtual int get_var_size(const Variable &var);
+   virtual int get_var_align(const Variable &var);
+
+};
+
+struct Gen_X64 : public Code_Gen {
+
+   Gen_X64(Asm_Buf &ost) : Code_Gen(ost) {
+      stack_man = new StackMan_X64();
+      stack_man->code_gen = this;
+      stack_man->slot_size = 8;
+      pic = false; //rodata is addressed relative to %rip
+      //%rbx, %r12-%r15
+      for (int i = 0; i < 5; ++i) {
+         allocatable_registers.push_back(create_register(REGISTER_SAVED + std::to_string(i)));
+      }
+      //%xmm8-%xmm15, SysV preserves none of them across calls
+      for (int i = 0; i < 8; ++i) {
+         float_registers.push_back(create_register(REGISTER_FLOAT_SAVED + std::to_string(i)));
+      }
+      float_registers_caller_saved = true;
+   }
+
+   bool float_compare = false; //the last emit_cmp was a ucomiss
+
+   virtual std::string gen_var(Variable var);
+   virtual std::string gen_global(Variable var);
+   virtual void gen_profile_exit();
+   virtual void gen_profile_count(int id);
+   virtual void gen_stack_alignment(Scope &scope);
+   virtual void gen_stack_unalignment(Scope &scope);
+   virtual void gen_func_params(Function &func, std::vector<Variable> &plist);
+   virtual void gen_param_loads(Function &func);
+   virtual int get_frame_size(Scope &scope);
+   virtual bool gen_tail_call(Function &func, std::vector<Variable> &plist, Scope &scope);
+   Variable get_arg_location(std::vector<Variable> &list, size_t n);
+   int get_home_index(std::vector<Variable> &list, size_t n);
+   std::string gen_float_const(Variable var);
+   void emit_float_mov(Variable src, std::string src_s, std::string dst_s);
+   Variable::VType get_mem_type(Variable var);
+   std::string gen_int_source(Variable src, std::string src_s, std::string dst_s, int dst_size);
+
+   virtual void emit_cmp(Variable src0, Variable src1);
+   virtual void emit_inc(Variable dst);
+   virtual void emit_push(Variable src);
+   virtual void emit_pop(Variable dst);
+   virtual void emit_mov(Variable src, Variable dst);
+   virtual void emit_sub(Variable src, Variable dst);
+   virtual void emit_add(Variable src, Variable dst);
+   virtual void emit_or(Variable src, Variable dst);
+   virtual void emit_mul(Variable src, Variable dst);
+   virtual void emit_call(std::string label);
+   virtual void emit_jump(std::string label);
+   virtual void emit_cond_jump(std::string label, Conditional::CType condition);
+   virtual void emit_return();
+   virtual bool is_block_exit(const Machine_Instr &instr);
+   virtual void emit_function_header();
+   virtual void emit_function_footer();
+
+   std::string gen_vector_operand(Variable var);
+   std::string gen_pointer_register(Variable ptr);
+   virtual void emit_vector_mov(Variable src, Variable dst);
+   virtual void emit_vector_op(Instruction::IType op, Variable src, Variable dst);
+   virtual void emit_vector_shuffle(Variable src, Variable dst, int mask);
+   virtual void emit_vector_load(Variable ptr, Variable dst);
+   virtual void emit_vector_store(Variable src, Variable ptr);
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include <cstdlib>
+#include <cctype>
+
+#include "Machine_Instr.h"
+
+//a plain decimal integer goes in value, anything else stays text in symbol
+static void parse_value(const std::string &text, Machine_Operand &op) {
+   char *end;
+   long long value = strtoll(text.c_str(), &end, 10);
+   if (text.size() && *end == '\0' && std::to_string(value).compare(text) == 0) {
+      op.value = value;
+   } else {
+      op.symbol = text;
+   }
+   op.has_value = text.size() > 0;
+}
+
+static void print_value(Asm_Buf &os, const Machine_Operand &op) {
+   if (op.symbol.size()) {
+      os << op.symbol;
+   } else if (op.has_value) {
+      os << op.value;
+   }
+}
+
+//%reg, $imm, disp(base,index,scale) or a label
+Machine_Operand parse_att_operand(const std::string &text) {
+   Machine_Operand op;
+   if (text.empty()) {
+      return op;
+   }
+   if (text[0] == '%') {
+      op.kind = Machine_Operand::REGISTER;
+      op.reg = text;
+   } else if (text[0] == '$') {
+      op.kind = Machine_Operand::IMMEDIATE;
+      parse_value(text.substr(1), op);
+   } else if (text.back() == ')') {
+      op.kind = Machine_Operand::MEMORY;
+      size_t paren = text.rfind('(');
+      parse_value(text.substr(0, paren), op);
+      std::string inside = text.substr(paren + 1, text.size() - paren - 2);
+      size_t comma = inside.find(',');
+      op.reg = inside.substr(0, comma);
+      if (comma != std::string::npos) {
+         size_t comma2 = inside.find(',', comma + 1);
+         op.index = inside.substr(comma + 1, comma2 - comma - 1);
+         if (comma2 != std::string::npos) {
+            op.scale = atoi(inside.c_str() + comma2 + 1);
+         }
+      }
+   } else {
+      op.symbol = text;
+   }
+   return op;
+}
+
+void print_att_operand(Asm_Buf &os, const Machine_Operand &op) {
+   switch (op.kind) {
+      case Machine_Operand::REGISTER: {
+         os << op.reg;
+      } break;
+      case Machine_Operand::IMMEDIATE: {
+         os << '$';
+         print_value(os, op);
+      } break;
+      case Machine_Operand::MEMORY: {
+         print_value(os, op);
+         os << '(' << op.reg;
+         if (op.index.size()) {
+            os << ',' << op.index << ',' << op.scale;
+         }
+         os << ')';
+      } break;
+      default: {
+         os << op.symbol;
+      } break;
+   }
+}
+
+static bool is_arm_register(const std::string &text) {
+   static const char *named[] = { "sp", "lr", "pc", "fp", "ip", "APSR_nzcv", "fpscr" };
+   for (const char *name : named) {
+      if (text.compare(name) == 0) {
+         return true;
+      }
+   }
+   if (text.size() < 2 || (text[0] != 'r' && text[0] != 's' && text[0] != 'd' && text[0] != 'q')) {
+      return false;
+   }
+   for (size_t i = 1; i < text.size(); ++i) {
+      if (!isdigit(text[i])) {
+         return false;
+      }
+   }
+   return true;
+}
+
+//r0, #imm, =literal, [base], [base, #offset], [base, index], { list } or a label
+Machine_Operand parse_arm_operand(const std::string &text) {
+   Machine_Operand op;
+   if (text.empty()) {
+      return op;
+   }
+   if (text[0] == '#') {
+      op.kind = Machine_Operand::IMMEDIATE;
+      parse_value(text.substr(1), op);
+   } else if (text[0] == '=') {
+      op.kind = Machine_Operand::LITERAL;
+      parse_value(text.substr(1), op);
+   } else if (text[0] == '[') {
+      op.kind = Machine_Operand::MEMORY;
+      std::string inside = text.substr(1, text.size() - 2);
+      size_t comma = inside.find(", ");
+      op.reg = inside.substr(0, comma);
+      if (comma != std::string::npos) {
+         std::string offset = inside.substr(comma + 2);
+         if (offset[0] == '#') {
+            parse_value(offset.substr(1), op);
+         } else {
+            op.index = offset;
+         }
+      }
+   } else if (text[0] == '{') {
+      op.kind = Machine_Operand::REGISTER_LIST;
+      op.symbol = text;
+   } else if (is_arm_register(text)) {
+      op.kind = Machine_Operand::REGISTER;
+      op.reg = text;
+   } else {
+      op.symbol = text;
+   }
+   return op;
+}
+
+void print_arm_operand(Asm_Buf &os, const Machine_Operand &op) {
+   switch (op.kind) {
+      case Machine_Operand::REGISTER: {
+         os << op.reg;
+      } break;
+      case Machine_Operand::IMMEDIATE: {
+         os << '#';
+         print_value(os, op);
+      } break;
+      case Machine_Operand::LITERAL: {
+         os << '=';
+         print_value(os, op);
+      } break;
+      case Machine_Operand::MEMORY: {
+         os << '[' << op.reg;
+         if (op.has_value) {
+            os << ", #";
+            print_value(os, op);
+         } else if (op.index.size()) {
+            os << ", " << op.index;
+         }
+         os << ']';
+      } break;
+      default: {
+         os << op.symbol;
+      } break;
+   }
+}
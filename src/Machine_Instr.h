@@ -0,0 +1,52 @@
+
+#ifndef MACHINE_INSTR_H
+#define MACHINE_INSTR_H
+
+#include <string>
+#include <vector>
+
+#include "Asm_Buf.h"
+
+//An operand of a machine instruction, split into its parts so later passes
+//can look at registers and addresses without parsing assembly text.
+struct Machine_Operand {
+   enum Kind {
+      REGISTER,      //reg
+      IMMEDIATE,     //value, or symbol when it isn't a plain integer
+      MEMORY,        //symbol or value as the displacement, off reg and index
+      SYMBOL,        //a label, as a branch target or an absolute address
+      LITERAL,       //ARM =value or =symbol, loaded from the literal pool
+      REGISTER_LIST  //ARM { ... }, kept as written in symbol
+   };
+
+   Kind kind = SYMBOL;
+   std::string reg;
+   std::string index;
+   int scale = 1;
+   long long value = 0;
+   std::string symbol;
+   bool has_value = false; //the displacement was written out, even if 0
+};
+
+//an instruction in assembler operand order, or with an empty opcode a line
+//of text kept as written, for directives and inline asm
+struct Machine_Instr {
+   std::string opcode;
+   std::vector<Machine_Operand> operands;
+   std::string text;
+
+   bool is_text() const { return opcode.empty(); }
+};
+
+//straight line code from a label up to the next one
+struct Machine_Basic_Block {
+   std::string label; //empty for code that comes before any label
+   std::vector<Machine_Instr> instrs;
+};
+
+Machine_Operand parse_att_operand(const std::string &op);
+void print_att_operand(Asm_Buf &os, const Machine_Operand &op);
+Machine_Operand parse_arm_operand(const std::string &op);
+void print_arm_operand(Asm_Buf &os, const Machine_Operand &op);
+
+#endif
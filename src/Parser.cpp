@@ -78,6 +78,8 @@ Conditional Parser::parse_conditional(Scope &scope) {
    tok = lex.next_token();
    if (tok.type == '<') {
       cond.condition = Conditional::LESS_THAN;
+   } else if (tok.type == '>') {
+      cond.condition = Conditional::GREATER_THAN;
    }
 
    tok = lex.next_token();
@@ -87,6 +89,19 @@ Conditional Parser::parse_conditional(Scope &scope) {
       var.pvalue = tok.int_number;
       var.is_type_const = true;
       cond.right = var;
+   } else if (tok.type == Token::FLOATLIT) {
+      Variable var;
+      var.type = Variable::FLOAT_32BIT;
+      var.fvalue = tok.real_number;
+      var.is_type_const = true;
+      cond.right = var;
+   } else if (tok.type == Token::ID) {
+      Variable *rvar = scope.getVarByName(tok.string);
+      if (rvar) {
+         cond.right = *rvar;
+      } else {
+         compiler_error(std::string("use of undeclared identifier '") + tok.pretty_string() + "'", tok);
+      }
    }
 
    tok = lex.next_token();
@@ -276,6 +291,12 @@ static Variable::VType get_vtype(std::string t) {
       return Variable::INT_32BIT;
    } else if (t.compare("big") == 0) {
       return Variable::INT_64BIT;
+   } else if (t.compare("float") == 0) {
+      return Variable::FLOAT_32BIT;
+   } else if (t.compare("float4") == 0) {
+      return Variable::FLOAT_32X4;
+   } else if (t.compare("int4") == 0) {
+      return Variable::INT_32X4;
    }
 
    return Variable::UNKNOWN;
@@ -288,8 +309,11 @@ Variable Parser::parse_const_assign(Variable dst, Scope &scope, Token &tok) {
       if (tok.type == Token::INTLIT) {
          var.type = dst.type;
          var.pvalue = tok.int_number;
-      } else {
-
+         var.fvalue = tok.int_number;
+      } else if (tok.type == Token::FLOATLIT) {
+         var.type = dst.type;
+         var.pvalue = tok.real_number;
+         var.fvalue = tok.real_number;
       }
 
       tok = lex.next_token();
@@ -322,7 +346,9 @@ Variable Parser::parse_variable(std::string name, Scope &scope, Token &tok, char
          }
       } else if (tok.type == '=') {
          if (var.is_type_const) {
-            var.pvalue = parse_const_assign(var, scope, tok).pvalue;
+            Variable val = parse_const_assign(var, scope, tok);
+            var.pvalue = val.pvalue;
+            var.fvalue = val.fvalue;
             break;
          } else {
             scope.variables.push_back(var);
@@ -355,6 +381,19 @@ std::vector<Instruction> Parser::parse_rvalue(Variable dst, Scope &scope, Token
    while (tok.type != ';') {
       if (tok.type == '|') {
          itype = Instruction::BIT_OR;
+      } else if (tok.type == '+' || tok.type == '*') {
+         if (!dst.is_vector()) {
+            compiler_error("arithmetic is only supported on float4 and int4", tok);
+         }
+         itype = (tok.type == '+' ? Instruction::ADD : Instruction::MULTIPLY);
+      } else if (dst.is_vector() && (tok.type == '{' || tok.type == Token::INTLIT || tok.type == Token::FLOATLIT)) {
+         Instruction in;
+         in.type = itype;
+         in.lvalue_data = dst;
+         in.rvalue_data = parse_vector_literal(dst, tok);
+         instructions.push_back(in);
+         tok = lex.next_token();
+         break;
       } else if (tok.type == Token::INTLIT) {
          Instruction in;
          in.type = itype;
@@ -366,6 +405,17 @@ std::vector<Instruction> Parser::parse_rvalue(Variable dst, Scope &scope, Token
          instructions.push_back(in);
          tok = lex.next_token();
          break;
+      } else if (tok.type == Token::FLOATLIT) {
+         Instruction in;
+         in.type = itype;
+         in.lvalue_data = dst;
+         in.lvalue_data.name = dst.name;
+         in.rvalue_data.type = Variable::FLOAT_32BIT;
+         in.rvalue_data.fvalue = tok.real_number;
+         in.rvalue_data.is_type_const = true;
+         instructions.push_back(in);
+         tok = lex.next_token();
+         break;
       } else if (tok.type == Token::DQSTRING) {
          if (itype != Instruction::ASSIGN) {
             compiler_warning("using string literal for operations other than assignment is undefined.", tok);
@@ -389,7 +439,9 @@ std::vector<Instruction> Parser::parse_rvalue(Variable dst, Scope &scope, Token
             tok = lex.next_token();
             if (tok.type == '(') {
                Function *func = scope.getFuncByName(name);
-               if (func) {
+               if (func && (name.compare("__shuffle__") == 0 || name.compare("__load__") == 0)) {
+                  instructions.push_back(parse_vector_builtin(name, dst, scope, tok));
+               } else if (func) {
                   Instruction in;
                   in.type = Instruction::FUNC_CALL;
                   in.func_call_name = name;
@@ -408,6 +460,11 @@ std::vector<Instruction> Parser::parse_rvalue(Variable dst, Scope &scope, Token
             }
 
          } else {
+            if (rvar->is_vector() && rvar->type != dst.type) {
+               compiler_error(std::string("cannot assign '") + name + "' to a different type", tok);
+            } else if (dst.is_vector() && !rvar->is_vector() && itype != Instruction::ASSIGN) {
+               compiler_error("vector arithmetic needs a vector or a constant operand", tok);
+            }
             Instruction in;
             in.type = itype;
             in.lvalue_data = dst;
@@ -422,6 +479,78 @@ std::vector<Instruction> Parser::parse_rvalue(Variable dst, Scope &scope, Token
    return instructions;
 }
 
+//`{1.0, 2.0, 3.0, 4.0}`, or a single number for every lane
+Variable Parser::parse_vector_literal(Variable dst, Token &tok) {
+   Variable var;
+   var.type = dst.type;
+   var.is_type_const = true;
+   auto lane_bits = [&dst](Token &num, bool negative) -> int32_t {
+      double val = (num.type == Token::FLOATLIT ? num.real_number : num.int_number) * (negative ? -1 : 1);
+      return dst.type == Variable::FLOAT_32X4 ? get_float_bits(val) : (int32_t)val;
+   };
+   if (tok.type != '{') {
+      int32_t bits = lane_bits(tok, false);
+      for (auto &lane : var.lanes) {
+         lane = bits;
+      }
+      return var;
+   }
+   int n = 0;
+   tok = lex.next_token();
+   while (tok.type != '}' && tok.type != ';' && tok.type != Token::EOF) {
+      bool negative = tok.type == '-';
+      if (negative) {
+         tok = lex.next_token();
+      }
+      if (tok.type != Token::INTLIT && tok.type != Token::FLOATLIT) {
+         compiler_error(std::string("expected a number before token '") + tok.pretty_string() + "'", tok);
+      } else if (n < 4) {
+         var.lanes[n] = lane_bits(tok, negative);
+      }
+      n++;
+      tok = lex.next_token();
+      if (tok.type == ',') {
+         tok = lex.next_token();
+      }
+   }
+   if (n != 4) {
+      compiler_error("a vector literal has exactly four lanes", tok);
+   }
+   return var;
+}
+
+//`__shuffle__(v, 3, 2, 1, 0)` takes source lane 3 into lane 0 and so on,
+//`__load__(p)` reads the vector at p
+Instruction Parser::parse_vector_builtin(std::string name, Variable dst, Scope &scope, Token &tok) {
+   Instruction in;
+   in.lvalue_data = dst;
+   std::vector<Variable> plist = parse_parameter_list(scope, tok);
+   if (!dst.is_vector()) {
+      compiler_error(name + " produces a float4 or int4", tok);
+   } else if (name.compare("__load__") == 0) {
+      in.type = Instruction::LOAD;
+      if (plist.size() != 1 || plist[0].type != Variable::POINTER) {
+         compiler_error("__load__ takes a pointer", tok);
+      } else {
+         in.rvalue_data = plist[0];
+      }
+   } else {
+      in.type = Instruction::SHUFFLE;
+      if (plist.size() != 5 || plist[0].type != dst.type) {
+         compiler_error("__shuffle__ takes a vector of the same type and four lane numbers", tok);
+      } else {
+         in.rvalue_data = plist[0];
+         for (int i = 0; i < 4; ++i) {
+            if (!plist[i + 1].is_type_const || plist[i + 1].pvalue < 0 || plist[i + 1].pvalue > 3) {
+               compiler_error("lane numbers run from 0 to 3", tok);
+            }
+            in.shuffle_mask |= (plist[i + 1].pvalue & 3) << (2 * i);
+         }
+      }
+   }
+   return in;
+}
+
 void Parser::parse_declaration(std::string name, Scope &scope) {
    Token tok = lex.next_token();
    if(tok.type == '(') {
@@ -530,6 +659,13 @@ void Parser::parse_function(std::string name, Scope &scope, Token &tok, bool sho
    func.scope->parent = &scope;
    if (tok.type != ')') {
       func.parameters = parse_parameter_list(*func.scope, tok);
+      //parameters live in the caller's argument area, not in this function's frame
+      func.scope->variables.clear();
+      for (auto &param : func.parameters) {
+         if (param.is_vector()) {
+            compiler_error("float4 and int4 can't be passed by value, pass a pointer", tok);
+         }
+      }
    }
 
    tok = lex.next_token();
@@ -544,6 +680,9 @@ void Parser::parse_function(std::string name, Scope &scope, Token &tok, bool sho
       Variable return_type;
       return_type.type = Variable::POINTER;
       return_type.ptype = get_vtype(type_name);
+      if (return_type.ptype == Variable::FLOAT_32X4 || return_type.ptype == Variable::INT_32X4) {
+         compiler_error("float4 and int4 can't be returned by value", tok);
+      }
       func.return_info = return_type;
    }
    tok = lex.next_token();
@@ -557,8 +696,10 @@ void Parser::parse_function(std::string name, Scope &scope, Token &tok, bool sho
       }
    }
 
-   parse_scope(name, *func.scope, '}');
+   //registered before the body is parsed so that the function can call itself,
+   //the body is parsed into the Scope both copies share
    scope.functions.push_back(func);
+   parse_scope(name, *func.scope, '}');
 }
 
 
@@ -585,6 +726,16 @@ Expression Parser::parse_expression(std::string name, Scope &scope, Token &tok,
             instr.type = Instruction::FUNC_CALL;
             instr.func_call_name = name;
             instr.call_target_params = parse_parameter_list(scope, tok);
+            if (name.compare("__store__") == 0) {
+               std::vector<Variable> &plist = instr.call_target_params;
+               if (plist.size() != 2 || plist[0].type != Variable::POINTER || !plist[1].is_vector()) {
+                  compiler_error("__store__ takes a pointer and a float4 or int4", tok);
+               } else {
+                  instr.type = Instruction::STORE;
+                  instr.lvalue_data = plist[0];
+                  instr.rvalue_data = plist[1];
+               }
+            }
 
             tok = lex.next_token();
             if (tok.type != ';') {
@@ -608,11 +759,18 @@ Expression Parser::parse_expression(std::string name, Scope &scope, Token &tok,
             compiler_error("read-only variable is not assignable", tok);
          }
          instr.lvalue_data = *var;
-         instr.lvalue_data.type = (deref ? Variable::DEREFERENCED_POINTER : Variable::POINTER);
+         if (deref || !var->is_vector()) {
+            instr.lvalue_data.type = (deref ? Variable::DEREFERENCED_POINTER : Variable::POINTER);
+         }
       } else if (name.compare("return") == 0) {
          instr.lvalue_data.name = name;
-         if (scope.is_function) {
-            instr.lvalue_data = scope.function->return_info;
+         //returns can sit in a loop body, the return type belongs to the enclosing function
+         Scope *fscope = &scope;
+         while (fscope && !fscope->is_function) {
+            fscope = fscope->parent;
+         }
+         if (fscope) {
+            instr.lvalue_data = fscope->function->return_info;
             instr.lvalue_data.name = name;
             instr.lvalue_data.type = Variable::POINTER;
          }
@@ -643,11 +801,22 @@ Function asmInlineFunc() {
    return func;
 }
 
+//declared for the parser only, Code_Gen lowers them to vector instructions
+static Function vectorBuiltinFunc(std::string name) {
+   Function func;
+   func.name = name;
+   func.is_not_definition = true;
+   return func;
+}
+
 Scope Parser::parse(std::string src) {
    source_code_stack.push(src);
    Parser par = Parser(src);
    Scope globalScope;
    globalScope.functions.push_back(asmInlineFunc());
+   globalScope.functions.push_back(vectorBuiltinFunc("__shuffle__"));
+   globalScope.functions.push_back(vectorBuiltinFunc("__load__"));
+   globalScope.functions.push_back(vectorBuiltinFunc("__store__"));
    par.parse_scope(std::string(), globalScope, Token::EOF);
    source_code_stack.pop();
    return globalScope;
@@ -24,6 +24,8 @@ struct Parser {
    Variable parse_const_assign(Variable dst, Scope &scope, Token &tok);
    Variable parse_variable(std::string name, Scope &scope, Token &tok, char delim_token = ';', char opt_delim_token = ';');
    std::vector<Instruction> parse_rvalue(Variable dst, Scope &scope, Token &tok);
+   Variable parse_vector_literal(Variable dst, Token &tok);
+   Instruction parse_vector_builtin(std::string name, Variable dst, Scope &scope, Token &tok);
    void parse_declaration(std::string name, Scope &scope);
    std::vector<Variable> parse_parameter_list(Scope &scope, Token &tok);
    void parse_function(std::string name, Scope &scope, Token &tok, bool should_inline = false, bool is_plain = false);
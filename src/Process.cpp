@@ -0,0 +1,162 @@
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Process.h"
+
+extern char **environ;
+
+bool Process::spawn(const std::vector<std::string> &args, bool pipe_stdin) {
+   std::string cmd;
+   std::vector<char *> argv;
+   for (auto &arg : args) {
+      cmd += arg + " ";
+      argv.push_back((char *)arg.c_str());
+   }
+   argv.push_back(nullptr);
+   printf("%s\n", cmd.c_str());
+   fflush(stdout);
+
+   int fds[2];
+   posix_spawn_file_actions_t actions;
+   posix_spawn_file_actions_init(&actions);
+   if (pipe_stdin) {
+      if (pipe(fds) != 0) {
+         perror("pipe");
+         return false;
+      }
+      posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+      posix_spawn_file_actions_addclose(&actions, fds[0]);
+      posix_spawn_file_actions_addclose(&actions, fds[1]);
+      //a tool that dies early makes our writes fail instead of killing us
+      signal(SIGPIPE, SIG_IGN);
+   }
+   int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+   posix_spawn_file_actions_destroy(&actions);
+   if (pipe_stdin) {
+      close(fds[0]);
+      stdin_fd = fds[1];
+   }
+   if (err != 0) {
+      printf("can't run %s: %s\n", argv[0], strerror(err));
+      close_stdin();
+      pid = -1;
+      return false;
+   }
+   return true;
+}
+
+void Process::close_stdin() {
+   if (stdin_fd >= 0) {
+      close(stdin_fd);
+      stdin_fd = -1;
+   }
+}
+
+//the exit status, -1 if the process never ran or didn't exit normally
+int Process::wait() {
+   close_stdin();
+   if (pid < 0) {
+      return -1;
+   }
+   int status;
+   while (waitpid(pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+         return -1;
+      }
+   }
+   pid = -1;
+   return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+std::vector<std::string> split_command(const std::string &cmd) {
+   std::vector<std::string> args;
+   size_t pos = cmd.find_first_not_of(" \t");
+   while (pos != std::string::npos) {
+      size_t end = cmd.find_first_of(" \t", pos);
+      args.push_back(cmd.substr(pos, end - pos));
+      pos = cmd.find_first_not_of(" \t", end);
+   }
+   return args;
+}
+
+Fd_Buf::Fd_Buf(int fd) : fd(fd) {
+   setp(buffer, buffer + sizeof(buffer));
+}
+
+Fd_Buf::~Fd_Buf() {
+   flush_buffer();
+}
+
+static bool write_all(int fd, const char *p, size_t size) {
+   const char *end = p + size;
+   while (p < end) {
+      ssize_t n = write(fd, p, end - p);
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         return false;
+      }
+      p += n;
+   }
+   return true;
+}
+
+bool Fd_Buf::flush_buffer() {
+   bool ok = write_all(fd, pbase(), pptr() - pbase());
+   setp(buffer, buffer + sizeof(buffer));
+   return ok;
+}
+
+Fd_Buf::int_type Fd_Buf::overflow(int_type c) {
+   if (!flush_buffer()) {
+      return traits_type::eof();
+   }
+   if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+   }
+   return traits_type::not_eof(c);
+}
+
+//anything that doesn't fit in the buffer is written straight from the caller's memory
+std::streamsize Fd_Buf::xsputn(const char *s, std::streamsize n) {
+   if (n < epptr() - pptr()) {
+      memcpy(pptr(), s, n);
+      pbump(n);
+      return n;
+   }
+   if (!flush_buffer() || !write_all(fd, s, n)) {
+      return 0;
+   }
+   return n;
+}
+
+int Fd_Buf::sync() {
+   return flush_buffer() ? 0 : -1;
+}
+
+Tee_Buf::int_type Tee_Buf::overflow(int_type c) {
+   if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      first->sputc(traits_type::to_char_type(c));
+      second->sputc(traits_type::to_char_type(c));
+   }
+   return traits_type::not_eof(c);
+}
+
+std::streamsize Tee_Buf::xsputn(const char *s, std::streamsize n) {
+   first->sputn(s, n);
+   second->sputn(s, n);
+   return n;
+}
+
+int Tee_Buf::sync() {
+   int a = first->pubsync();
+   int b = second->pubsync();
+   return (a == 0 && b == 0) ? 0 : -1;
+}
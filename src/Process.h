@@ -0,0 +1,50 @@
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <sys/types.h>
+
+//A tool started with posix_spawn. Its output goes straight to ours, and
+//its stdin can be a pipe that we keep writing into while it runs.
+struct Process {
+   pid_t pid = -1;
+   int stdin_fd = -1;
+
+   bool spawn(const std::vector<std::string> &args, bool pipe_stdin = false);
+   void close_stdin();
+   int wait();
+};
+
+//splits a command line on whitespace, arguments never contain any
+std::vector<std::string> split_command(const std::string &cmd);
+
+//an output stream buffer over a file descriptor
+struct Fd_Buf : public std::streambuf {
+   int fd;
+   char buffer[1 << 16];
+
+   Fd_Buf(int fd);
+   ~Fd_Buf();
+
+   bool flush_buffer();
+   virtual int_type overflow(int_type c);
+   virtual std::streamsize xsputn(const char *s, std::streamsize n);
+   virtual int sync();
+};
+
+//writes everything into two stream buffers
+struct Tee_Buf : public std::streambuf {
+   std::streambuf *first;
+   std::streambuf *second;
+
+   Tee_Buf(std::streambuf *a, std::streambuf *b) : first(a), second(b) {}
+
+   virtual int_type overflow(int_type c);
+   virtual std::streamsize xsputn(const char *s, std::streamsize n);
+   virtual int sync();
+};
+
+#endif
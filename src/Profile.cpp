@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <algorithm>
+
+#include "Profile.h"
+
+Profile::
+Profile() {
+   counters.name = PROFILE_COUNTERS;
+   counters.type = Variable::INT_32BIT;
+}
+
+//plain functions are left exactly as written, nothing in them is counted
+void Profile::
+number_scopes(Scope &scope) {
+   for (auto &func : scope.functions) {
+      if (func.plain_instructions || func.is_not_definition || func.name.compare("__asm__") == 0) {
+         continue;
+      }
+      //inline functions are only ever copied into their callers
+      if (!func.should_inline) {
+         func.scope->profile_id = num_counters++;
+      }
+      number_scopes(*func.scope);
+   }
+   for (auto &expr : scope.expressions) {
+      //inline functions share their loops with every copy
+      if (expr.scope->is_loop() && expr.scope->profile_id < 0) {
+         expr.scope->profile_id = num_counters;
+         num_counters += 2;
+      }
+      number_scopes(*expr.scope);
+   }
+}
+
+bool Profile::
+load() {
+   FILE *file = fopen(path.c_str(), "rb");
+   if (!file) {
+      printf("-fprofile-use: can't read %s\n", path.c_str());
+      return false;
+   }
+   counts.resize(num_counters + 1);
+   size_t read = fread(counts.data(), sizeof(uint32_t), counts.size(), file);
+   fclose(file);
+   if (read != (size_t)num_counters) {
+      printf("-fprofile-use: %s was not written by this program, ignored\n", path.c_str());
+      counts.clear();
+      return false;
+   }
+   counts.resize(num_counters);
+   for (uint32_t count : counts) {
+      max_count = std::max(max_count, (long long)count);
+   }
+   return true;
+}
+
+long long Profile::
+get_count(int id) const {
+   return id >= 0 && (size_t)id < counts.size() ? counts[id] : -1;
+}
+
+long long Profile::
+entries(const Scope &scope) const {
+   return get_count(scope.profile_id);
+}
+
+//a return from inside the loop leaves without being counted as an exit
+long long Profile::
+iterations(const Scope &scope) const {
+   long long tests = get_count(scope.profile_id);
+   long long exits = get_count(scope.profile_id + 1);
+   if (tests < 0 || exits < 0) {
+      return -1;
+   }
+   return std::max(0LL, tests - exits);
+}
+
+//within a hundredth of the most executed block of the program
+bool Profile::
+is_hot(long long count) const {
+   return count > 0 && count * 100 >= max_count;
+}
@@ -0,0 +1,44 @@
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Code_Structure.h"
+
+//the counters of an instrumented program, and what writes them out in place of _exit
+const std::string PROFILE_COUNTERS = "__htn_profile_counters";
+const std::string PROFILE_EXIT = "__htn_profile_exit";
+
+//Execution counts for -fprofile-generate and -fprofile-use.
+//Every function body and while loop gets a counter, numbered in the order
+//they appear in the parsed program, so any build of the same source finds
+//its counts again. A function counts its calls, a loop every test of its
+//condition and, in the counter after that, every exit from it. Inlining
+//copies a scope's counter with it, a copy adds to the counts of its source.
+//The instrumented program writes the counters out as an array of 32-bit
+//words, which is all a profile file holds.
+struct Profile {
+   std::string path;
+   bool instrument = false; //-fprofile-generate, otherwise counts were read
+   int num_counters = 0;
+   int open_flags = 0; //O_WRONLY | O_CREAT | O_TRUNC of the target
+   Variable counters;
+   std::vector<uint32_t> counts;
+   long long max_count = 0;
+
+   Profile();
+   void number_scopes(Scope &scope);
+   bool load();
+
+   long long get_count(int id) const;
+   //calls of a function, entries of an inlined copy, tests of a loop's condition
+   long long entries(const Scope &scope) const;
+   //how often a loop's body ran
+   long long iterations(const Scope &scope) const;
+   bool is_hot(long long count) const;
+};
+
+#endif
@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <climits>
+
+#include "Reg_Alloc.h"
+#include "Code_Gen.h"
+
+static Scope *get_declaring_scope(const std::string &name, Scope *scope, Function *func) {
+   for (Scope *sc = scope; sc; sc = sc->parent) {
+      for (auto &v : sc->variables) {
+         if (v.name.compare(name) == 0) {
+            return sc;
+         }
+      }
+      if (sc->is_function) {
+         if (func && sc == func->scope) {
+            for (auto &p : func->parameters) {
+               if (p.name.compare(name) == 0) {
+                  return sc;
+               }
+            }
+         }
+         break;
+      }
+   }
+   return nullptr;
+}
+
+Live_Interval *Reg_Alloc::
+find_interval(const std::string &name, Scope *scope) {
+   Scope *sc = get_declaring_scope(name, scope, function);
+   if (!sc) {
+      return nullptr;
+   }
+   for (auto &li : intervals) {
+      if (li.scope == sc && li.name.compare(name) == 0) {
+         return &li;
+      }
+   }
+   return nullptr;
+}
+
+//Uses in a loop count ten times as much as those around it. With a profile
+//they count as often as the loop's body ran for each call of the function,
+//so a loop that never ran adds nothing.
+int Reg_Alloc::
+get_loop_weight(Scope &loop, int weight) {
+   Profile *profile = stack_man->code_gen->profile;
+   if (profile) {
+      long long runs = profile->iterations(loop);
+      long long calls = profile->entries(*function->scope);
+      if (runs >= 0 && calls >= 0) {
+         return (int)std::min(runs / std::max(calls, 1LL), 10000LL);
+      }
+   }
+   return std::min(weight * 10, 10000);
+}
+
+void Reg_Alloc::
+touch(Function &func, Variable &var, Scope *scope, int weight, bool is_def) {
+   if (var.type == Variable::DQString || (var.is_type_const && var.is_vector())
+      || (split_float && var.is_type_const && var.type == Variable::FLOAT_32BIT)) {
+      rodata_weight += weight;
+      return;
+   }
+   if (var.name.size() == 0 || var.name.compare("return") == 0) {
+      return;
+   }
+   Scope *sc = get_declaring_scope(var.name, scope, &func);
+   if (!sc) {
+      if (stack_man->code_gen->get_global(var)) {
+         has_global_refs = true;
+      }
+      return; //registers, globals and anything declared outside this function
+   }
+   bool is_float = false;
+   for (auto &v : sc->variables) {
+      if (v.name.compare(var.name) == 0 && (v.is_type_const || v.type == Variable::DQString)) {
+         return; //constants are always emitted as immediates
+      }
+      if (v.name.compare(var.name) == 0 && v.is_vector()) {
+         return; //vectors always live in memory
+      }
+      if (v.name.compare(var.name) == 0 && stack_man->get_var_size(v) != stack_man->slot_size) {
+         return; //so does anything that isn't a register wide, its loads and stores keep it in range
+      }
+      if (v.name.compare(var.name) == 0) {
+         is_float = v.type == Variable::FLOAT_32BIT;
+      }
+   }
+
+   Live_Interval *li = find_interval(var.name, scope);
+   if (!li) {
+      Live_Interval nli;
+      nli.scope = sc;
+      nli.name = var.name;
+      if (sc == func.scope) {
+         for (size_t i = 0; i < func.parameters.size(); ++i) {
+            if (func.parameters[i].name.compare(var.name) == 0) {
+               if (stack_man->get_var_size(func.parameters[i]) != stack_man->slot_size) {
+                  return; //left in its argument slot, like the locals above
+               }
+               nli.is_param = true;
+               nli.param_index = i;
+               nli.start = 0; //parameters are live on entry
+               is_float = func.parameters[i].type == Variable::FLOAT_32BIT;
+            }
+         }
+      }
+      nli.is_float = split_float && is_float;
+      if (nli.start < 0) {
+         nli.start = position;
+         nli.first_is_def = is_def;
+      }
+      intervals.push_back(nli);
+      li = &intervals.back();
+   }
+
+   li->end = position;
+   li->weight += weight;
+}
+
+void Reg_Alloc::
+walk_scope(Function &func, Scope &scope, int weight) {
+   int scope_start = position;
+   for (auto &expr : scope.expressions) {
+      for (auto &instr : expr.instructions) {
+         position++;
+         switch (instr.type) {
+            case Instruction::BIT_OR:
+            case Instruction::ADD:
+            case Instruction::MULTIPLY:
+            case Instruction::STORE:
+            case Instruction::INCREMENT: {
+               touch(func, instr.rvalue_data, &scope, weight, false);
+               touch(func, instr.lvalue_data, &scope, weight, false);
+            } break;
+            case Instruction::SHUFFLE:
+            case Instruction::LOAD:
+            case Instruction::ASSIGN: {
+               touch(func, instr.rvalue_data, &scope, weight, false);
+               touch(func, instr.lvalue_data, &scope, weight, true);
+            } break;
+            case Instruction::SUBROUTINE_JUMP: {
+               if (instr.is_conditional_jump && !instr.condition.is_always_true) {
+                  touch(func, instr.condition.left, &scope, weight, false);
+                  touch(func, instr.condition.right, &scope, weight, false);
+               }
+            } break;
+            case Instruction::FUNC_CALL: {
+               if (instr.func_call_name.compare("__asm__") == 0) {
+                  asm_text.push_back(instr.call_target_params[0].dqstring);
+                  //the asm may read or write its operand, so treat it as a use
+                  if (instr.call_target_params.size() > 1) {
+                     touch(func, instr.call_target_params[1], &scope, weight, false);
+                  }
+               } else {
+                  has_calls = true;
+                  call_positions.push_back(position);
+                  max_call_args = std::max(max_call_args, (int)instr.call_target_params.size());
+                  Function *cfunc = scope.getFuncByName(instr.func_call_name);
+                  if (cfunc) {
+                     max_call_words = std::max(max_call_words,
+                        get_arg_words(cfunc->parameters, instr.call_target_params.size()));
+                  }
+                  for (auto &p : instr.call_target_params) {
+                     touch(func, p, &scope, weight, false);
+                  }
+               }
+            } break;
+         }
+      }
+      if (!expr.scope->empty()) {
+         bool is_loop = expr.scope->is_loop();
+         int start = position;
+         walk_scope(func, *expr.scope, is_loop ? get_loop_weight(*expr.scope, weight) : weight);
+         if (is_loop) {
+            loops.push_back({start, position});
+         }
+      }
+   }
+   scope_ranges[&scope] = { scope_start, position };
+}
+
+//A value that is live on entry to a loop, or is read before being written
+//inside one, has to survive the back edge, so it stays live to the loop end.
+void Reg_Alloc::
+extend_over_loops() {
+   bool changed = true;
+   while (changed) {
+      changed = false;
+      for (auto &lr : loops) {
+         for (auto &li : intervals) {
+            bool live_in = li.start <= lr.start && li.end > lr.start;
+            bool read_first = li.start > lr.start && li.start <= lr.end && !li.first_is_def;
+            if ((live_in || read_first) && li.end < lr.end) {
+               li.end = lr.end;
+               changed = true;
+            }
+            if (read_first && li.start > lr.start) {
+               li.start = lr.start;
+               changed = true;
+            }
+         }
+      }
+   }
+}
+
+bool Reg_Alloc::
+crosses_call(const Live_Interval &li) {
+   for (int p : call_positions) {
+      if (li.start <= p && p < li.end) {
+         return true;
+      }
+   }
+   return false;
+}
+
+void Reg_Alloc::
+scan_class(std::vector<Variable> &registers, bool is_float, std::vector<int> &saved, Code_Gen &code_gen) {
+   size_t num_regs = registers.size();
+   std::vector<bool> clobbered(num_regs, false);
+   for (size_t r = 0; r < num_regs; ++r) {
+      clobbered[r] = asm_uses(code_gen.gen_var(registers[r]));
+   }
+
+   //a value touched once is as cheap to use from its stack slot as it is to load,
+   //and caller-saved registers are only handed out between calls
+   bool caller_saved = is_float && code_gen.float_registers_caller_saved;
+   std::vector<Live_Interval *> sorted;
+   for (auto &li : intervals) {
+      if (li.weight > 1 && li.is_float == is_float && !(caller_saved && crosses_call(li))) {
+         sorted.push_back(&li);
+      }
+   }
+   std::stable_sort(sorted.begin(), sorted.end(), [](Live_Interval *a, Live_Interval *b) {
+      return a->start < b->start;
+   });
+
+   std::vector<Live_Interval *> active;
+   for (Live_Interval *cur : sorted) {
+      for (size_t i = 0; i < active.size();) {
+         if (active[i]->end < cur->start) {
+            active.erase(active.begin() + i);
+         } else {
+            ++i;
+         }
+      }
+
+      std::vector<bool> in_use = clobbered;
+      for (Live_Interval *a : active) {
+         in_use[a->reg] = true;
+      }
+      for (size_t r = 0; r < num_regs; ++r) {
+         if (!in_use[r]) {
+            cur->reg = r;
+            break;
+         }
+      }
+
+      if (cur->reg < 0) {
+         //under pressure: whoever is coldest gives up its register
+         Live_Interval *victim = nullptr;
+         for (Live_Interval *a : active) {
+            if (!victim || a->weight < victim->weight) {
+               victim = a;
+            }
+         }
+         if (!victim || victim->weight >= cur->weight) {
+            continue;
+         }
+         cur->reg = victim->reg;
+         victim->reg = -1;
+         active.erase(std::find(active.begin(), active.end(), victim));
+      }
+      active.push_back(cur);
+   }
+
+   for (size_t r = 0; r < num_regs; ++r) {
+      bool used = clobbered[r];
+      for (auto &li : intervals) {
+         if (li.reg == (int)r && li.is_float == is_float) {
+            used = true;
+         }
+      }
+      if (used) {
+         saved.push_back(r);
+      }
+   }
+}
+
+void Reg_Alloc::
+linear_scan(Code_Gen &code_gen) {
+   //string literals are addressed off a PIC base, worth a register once it
+   //is reused. Every access to a global needs it, so then it always is.
+   if (code_gen.pic) {
+      Live_Interval pic_base;
+      pic_base.start = 0;
+      pic_base.end = position;
+      pic_base.weight = has_global_refs ? INT_MAX : rodata_weight;
+      pic_base.is_pic_base = true;
+      intervals.push_back(pic_base);
+   }
+
+   scan_class(code_gen.allocatable_registers, false, saved_registers, code_gen);
+   if (split_float) {
+      scan_class(code_gen.float_registers, true, saved_float_registers, code_gen);
+   }
+   //used more than once without a register, it is still computed only once
+   for (auto &li : intervals) {
+      if (li.is_pic_base) {
+         pic_base_spilled = li.reg < 0 && li.weight > 1;
+      }
+   }
+}
+
+void Reg_Alloc::
+allocate(Function &func, Code_Gen &code_gen) {
+   intervals.clear();
+   scope_ranges.clear();
+   saved_registers.clear();
+   saved_float_registers.clear();
+   loops.clear();
+   call_positions.clear();
+   asm_text.clear();
+   position = 0;
+   has_calls = false;
+   max_call_args = 0;
+   max_call_words = 0;
+   rodata_weight = 0;
+   has_global_refs = false;
+   pic_base_spilled = false;
+   function = &func;
+   split_float = !code_gen.float_registers.empty();
+   stack_man = code_gen.stack_man;
+   if (func.plain_instructions) {
+      return;
+   }
+
+   walk_scope(func, *func.scope, 1);
+   if (code_gen.profile && code_gen.profile->instrument) {
+      has_global_refs = true; //the counters are globals
+   }
+   extend_over_loops();
+   linear_scan(code_gen);
+}
+
+bool Reg_Alloc::
+asm_uses(const std::string &reg_name) {
+   for (auto &text : asm_text) {
+      if (text.find(reg_name) != std::string::npos) {
+         return true;
+      }
+   }
+   return false;
+}
+
+const Variable *Reg_Alloc::
+get_pic_base(Code_Gen &code_gen) {
+   for (auto &li : intervals) {
+      if (li.is_pic_base && li.reg >= 0) {
+         return &code_gen.allocatable_registers[li.reg];
+      }
+   }
+   return nullptr;
+}
+
+const Variable *Reg_Alloc::
+get_interval_register(const Live_Interval &li, Code_Gen &code_gen) {
+   if (li.reg < 0) {
+      return nullptr;
+   }
+   return &(li.is_float ? code_gen.float_registers : code_gen.allocatable_registers)[li.reg];
+}
+
+const Variable *Reg_Alloc::
+get_register(const std::string &name, Scope *scope, Code_Gen &code_gen) {
+   if (!enabled) {
+      return nullptr;
+   }
+   Live_Interval *li = find_interval(name, scope);
+   if (!li) {
+      return nullptr;
+   }
+   return get_interval_register(*li, code_gen);
+}
@@ -0,0 +1,83 @@
+#ifndef REG_ALLOC_H
+#define REG_ALLOC_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Code_Structure.h"
+
+struct Code_Gen;
+struct StackMan;
+
+//The range of instruction positions over which a local must hold its value.
+//Positions are numbered in the order Code_Gen emits a function's instructions.
+struct Live_Interval {
+   Scope *scope = nullptr; //scope the variable is declared in
+   std::string name;
+   int start = -1;
+   int end = -1;
+   int weight = 0; //use count, scaled up in loops
+   bool first_is_def = false;
+   bool is_param = false;
+   bool is_pic_base = false; //the function's PIC base rather than a variable
+   bool is_float = false; //competes for Code_Gen::float_registers instead
+   int param_index = 0;
+   int reg = -1; //index into Code_Gen::allocatable_registers, -1 if spilled
+};
+
+//Linear scan register allocator.
+//Locals and parameters of a function are assigned to the backend's
+//callee-saved registers, so they survive calls without any caller-side saves.
+//When there are more live values than registers, the interval with the
+//lowest weight is left in its stack slot. Backends with floating point
+//registers get float variables allocated to those separately.
+struct Reg_Alloc {
+   struct Scope_Range {
+      int start;
+      int end;
+   };
+
+   std::vector<Live_Interval> intervals;
+   std::unordered_map<Scope *, Scope_Range> scope_ranges; //positions each scope of the function spans
+   std::vector<int> saved_registers; //callee-saved registers the prologue must preserve
+   std::vector<int> saved_float_registers;
+   Function *function = nullptr;
+   bool has_calls = false; //false for leaf functions
+   int max_call_args = 0; //size of the outgoing argument area, in arguments
+   int max_call_words = 0; //the same in 32-bit words, see get_arg_words
+   int rodata_weight = 0; //rodata references, scaled up in loops
+   bool has_global_refs = false; //the PIC base is needed to address globals
+   bool pic_base_spilled = false; //it got no register, so it is kept in a frame slot
+   bool enabled = true;
+
+   void allocate(Function &func, Code_Gen &code_gen);
+   bool asm_uses(const std::string &reg_name);
+   const Variable *get_register(const std::string &name, Scope *scope, Code_Gen &code_gen);
+   const Variable *get_pic_base(Code_Gen &code_gen);
+   const Variable *get_interval_register(const Live_Interval &li, Code_Gen &code_gen);
+   Live_Interval *find_interval(const std::string &name, Scope *scope);
+
+private:
+   struct Loop_Range {
+      int start;
+      int end;
+   };
+
+   std::vector<Loop_Range> loops;
+   std::vector<int> call_positions;
+   std::vector<std::string> asm_text;
+   int position = 0;
+   bool split_float = false;
+   StackMan *stack_man = nullptr;
+
+   int get_loop_weight(Scope &loop, int weight);
+   void touch(Function &func, Variable &var, Scope *scope, int weight, bool is_def);
+   void walk_scope(Function &func, Scope &scope, int weight);
+   void extend_over_loops();
+   void linear_scan(Code_Gen &code_gen);
+   bool crosses_call(const Live_Interval &li);
+   void scan_class(std::vector<Variable> &registers, bool is_float, std::vector<int> &saved, Code_Gen &code_gen);
+};
+
+#endif
@@ -12,6 +12,7 @@ struct Target {
 
    enum TARGET_CPU {
       X86,
+      X64,
       ARM,
       UNKNOWN
    };
@@ -19,10 +20,20 @@ struct Target {
    std::string target_triple;
 
    virtual std::string as_text_section();
+   virtual std::string as_cold_text_section();
    virtual std::string as_rodata_section();
+   virtual std::string as_cstring_section();
+   virtual std::string as_literal4_section();
+   virtual std::string as_literal16_section();
+   virtual std::string as_data_section();
+   virtual std::string as_bss_section();
    virtual std::string assembler_ops();
    virtual std::string arch_flag();
    virtual std::string link_ops();
+   //whether Asm_386 can write this target's objects, without running as
+   virtual bool has_integrated_as();
+   //O_WRONLY | O_CREAT | O_TRUNC of the target's open
+   virtual int open_write_flags();
 
    std::string get_target_as() {
       if (target_triple.size() == 0 || target_triple.compare(STRING(DEFAULT_TARGET)) == 0) return "as"; //system asembler
@@ -39,6 +50,9 @@ struct Target {
       if (cpu.compare("i386") == 0) {
          return X86;
       }
+      if (cpu.compare("x86_64") == 0) {
+         return X64;
+      }
       if (cpu.compare("arm") == 0) {
          return ARM;
       }
@@ -11,6 +11,10 @@ std::string Target_Apple::as_text_section() {
    return ".section __TEXT,__text,regular,pure_instructions";
 }
 
+std::string Target_Apple::as_cold_text_section() {
+   return ".section __TEXT,__text_cold,regular,pure_instructions";
+}
+
 std::string Target_Apple::as_rodata_section() {
    return ".section __TEXT,__cstring,cstring_literals";
 }
@@ -25,3 +29,32 @@ std::string Target_Apple::arch_flag() {
 std::string Target_Apple::link_ops() {
    return " -arch i386 -macosx_version_min 10.10 -e _start ";
 }
+
+bool Target_Apple::has_integrated_as() {
+   return false;
+}
+
+std::string Target_Apple::as_cstring_section() {
+   return ".section __TEXT,__cstring,cstring_literals";
+}
+
+std::string Target_Apple::as_literal4_section() {
+   return ".section __TEXT,__literal4,4byte_literals";
+}
+
+std::string Target_Apple::as_literal16_section() {
+   return ".section __TEXT,__literal16,16byte_literals";
+}
+
+std::string Target_Apple::as_data_section() {
+   return ".section __DATA,__data";
+}
+
+//zerofill sections only take .zerofill, zeroed data is as good
+std::string Target_Apple::as_bss_section() {
+   return ".section __DATA,__data";
+}
+
+int Target_Apple::open_write_flags() {
+   return 0x601;
+}
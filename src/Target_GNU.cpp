@@ -11,6 +11,14 @@ std::string Target_GNU::as_text_section() {
    return ".text";
 }
 
+//functions that rarely run, the linker keeps them apart from the rest
+std::string Target_GNU::as_cold_text_section() {
+   if (get_target_cpu() == Target::ARM) {
+      return ".section .text.unlikely,\"ax\",%progbits";
+   }
+   return ".section .text.unlikely,\"ax\",@progbits";
+}
+
 std::string Target_GNU::as_rodata_section() {
    return ".section .rodata";
 }
@@ -23,6 +31,9 @@ std::string Target_GNU::arch_flag() {
    if (get_target_cpu() == Target::X86) {
       return " --32 ";
    }
+   if (get_target_cpu() == Target::X64) {
+      return " --64 ";
+   }
    return "";
 }
 
@@ -30,5 +41,47 @@ std::string Target_GNU::link_ops() {
    if (get_target_cpu() == Target::X86) {
       return " -m elf_i386 ";
    }
+   if (get_target_cpu() == Target::X64) {
+      return " -m elf_x86_64 ";
+   }
    return " -m elf_arm ";
 }
+
+//only ELF32 objects for i386 so far
+bool Target_GNU::has_integrated_as() {
+   return get_target_cpu() == Target::X86;
+}
+
+std::string Target_GNU::as_cstring_section() {
+   //merged by the linker across objects
+   if (get_target_cpu() == Target::ARM) {
+      return ".section .rodata.str1.1,\"aMS\",%progbits,1";
+   }
+   return ".section .rodata.str1.1,\"aMS\",@progbits,1";
+}
+
+std::string Target_GNU::as_literal4_section() {
+   if (get_target_cpu() == Target::ARM) {
+      return ".section .rodata.cst4,\"aM\",%progbits,4";
+   }
+   return ".section .rodata.cst4,\"aM\",@progbits,4";
+}
+
+std::string Target_GNU::as_literal16_section() {
+   if (get_target_cpu() == Target::ARM) {
+      return ".section .rodata.cst16,\"aM\",%progbits,16";
+   }
+   return ".section .rodata.cst16,\"aM\",@progbits,16";
+}
+
+std::string Target_GNU::as_data_section() {
+   return ".data";
+}
+
+std::string Target_GNU::as_bss_section() {
+   return ".bss";
+}
+
+int Target_GNU::open_write_flags() {
+   return 0x241;
+}
@@ -7,10 +7,18 @@
 struct Target_GNU : public Target {
 
    virtual std::string as_text_section();
+   virtual std::string as_cold_text_section();
    virtual std::string as_rodata_section();
+   virtual std::string as_cstring_section();
+   virtual std::string as_literal4_section();
+   virtual std::string as_literal16_section();
+   virtual std::string as_data_section();
+   virtual std::string as_bss_section();
    virtual std::string assembler_ops();
    virtual std::string arch_flag();
    virtual std::string link_ops();
+   virtual bool has_integrated_as();
+   virtual int open_write_flags();
 
 
    Target_GNU (std::string default_tar);
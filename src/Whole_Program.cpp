@@ -0,0 +1,687 @@
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <functional>
+
+#include "Whole_Program.h"
+#include "Code_Gen.h"
+
+//callees this small are inlined at every call site, bigger ones only where they are called once
+static const int INLINE_SIZE = 16;
+static const int INLINE_ONE_SITE_SIZE = 200;
+//with -fprofile-use, at the call sites that run most
+static const int INLINE_HOT_SIZE = 64;
+
+typedef std::unordered_map<std::string, Variable::VType> Decl_Types;
+typedef std::unordered_map<std::string, std::string> Rename_Map;
+
+bool is_entry_point(const std::string &name) {
+   return name.compare("_start") == 0 || name.compare("start") == 0
+      || name.compare("main") == 0 || name.compare("_main") == 0;
+}
+
+static bool is_asm(const Instruction &instr) {
+   return instr.type == Instruction::FUNC_CALL && instr.func_call_name.compare("__asm__") == 0;
+}
+
+static bool is_register(const Variable &var) {
+   return var.type == Variable::UNKNOWN && var.name.size() && var.name[0] == '_';
+}
+
+static bool is_symbol_char(char c) {
+   return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+//inline asm can call or jump to a function by name
+static bool mentions(const std::string &text, const std::string &name) {
+   for (size_t pos = text.find(name); pos != std::string::npos; pos = text.find(name, pos + 1)) {
+      size_t end = pos + name.size();
+      if ((pos == 0 || !is_symbol_char(text[pos - 1])) && (end == text.size() || !is_symbol_char(text[end]))) {
+         return true;
+      }
+   }
+   return false;
+}
+
+//the Variables an instruction reads or writes
+static void for_each_operand(Instruction &instr, const std::function<void(Variable &)> &fn) {
+   fn(instr.lvalue_data);
+   fn(instr.rvalue_data);
+   if (instr.is_conditional_jump) {
+      fn(instr.condition.left);
+      fn(instr.condition.right);
+   }
+   for (auto &p : instr.call_target_params) {
+      fn(p);
+   }
+}
+
+//the instructions of a function body, not those of functions nested in it
+static void for_each_instr(Scope &scope, const std::function<void(Instruction &)> &fn) {
+   for (auto &expr : scope.expressions) {
+      for (auto &instr : expr.instructions) {
+         fn(instr);
+      }
+      for_each_instr(*expr.scope, fn);
+   }
+}
+
+static bool has_asm(Scope &scope) {
+   bool found = false;
+   for_each_instr(scope, [&](Instruction &instr) {
+      found |= is_asm(instr);
+   });
+   return found;
+}
+
+static bool has_nested_functions(Scope &scope) {
+   if (scope.functions.size()) {
+      return true;
+   }
+   for (auto &expr : scope.expressions) {
+      if (has_nested_functions(*expr.scope)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+static int count_instructions(Scope &scope) {
+   int count = 0;
+   for_each_instr(scope, [&](Instruction &) {
+      ++count;
+   });
+   return count;
+}
+
+static bool uses(Scope &scope, const std::string &name) {
+   bool found = false;
+   for_each_instr(scope, [&](Instruction &instr) {
+      for_each_operand(instr, [&](Variable &var) {
+         found |= !var.is_type_const && var.name.compare(name) == 0;
+      });
+   });
+   return found;
+}
+
+//the parser rejects redeclaring a visible name, only sibling scopes can
+//reuse one, and if they disagree on its type it is left unknown
+static void add_decl(const Variable &var, Decl_Types &decls) {
+   auto it = decls.find(var.name);
+   if (it == decls.end()) {
+      decls[var.name] = var.type;
+   } else if (it->second != var.type) {
+      it->second = Variable::UNKNOWN;
+   }
+}
+
+static void collect_decls(Scope &scope, Decl_Types &decls) {
+   for (auto &var : scope.variables) {
+      add_decl(var, decls);
+   }
+   for (auto &expr : scope.expressions) {
+      collect_decls(*expr.scope, decls);
+   }
+}
+
+static bool is_float_type(Variable::VType type) {
+   return type == Variable::FLOAT_32BIT;
+}
+
+static bool is_scalar_type(Variable::VType type) {
+   return is_integer_type(type) || type == Variable::POINTER || type == Variable::FLOAT_32BIT;
+}
+
+//constants are only propagated where they keep their meaning as immediates
+static bool is_foldable_const(const Variable &value, const Variable &param) {
+   return value.is_type_const && value.type == param.type
+      && (param.type == Variable::INT_32BIT || param.type == Variable::FLOAT_32BIT);
+}
+
+static bool same_const(const Variable &a, const Variable &b) {
+   if (a.type != b.type) {
+      return false;
+   }
+   if (a.type == Variable::FLOAT_32BIT) {
+      return get_float_bits(a.fvalue) == get_float_bits(b.fvalue);
+   }
+   return a.pvalue == b.pvalue;
+}
+
+//A parameter can be replaced by a constant when every use only reads it,
+//somewhere the backends take an immediate: the source of a scalar copy that
+//agrees with it on being a float, the right side of a comparison or a call
+//argument.
+static bool can_fold_param(Scope &body, const Variable &param, const Decl_Types &decls,
+   Variable::VType return_type) {
+   bool ok = true;
+   auto is_param = [&](Variable &var) {
+      return !var.is_type_const && var.name.compare(param.name) == 0;
+   };
+   for_each_instr(body, [&](Instruction &instr) {
+      switch (instr.type) {
+         case Instruction::ASSIGN:
+         case Instruction::BIT_OR: {
+            if (is_param(instr.lvalue_data)) {
+               ok = false;
+            } else if (is_param(instr.rvalue_data)) {
+               Variable::VType type = Variable::UNKNOWN;
+               if (instr.lvalue_data.name.compare("return") == 0) {
+                  type = return_type;
+               } else if (decls.count(instr.lvalue_data.name)) {
+                  type = decls.at(instr.lvalue_data.name);
+               }
+               ok &= is_scalar_type(type) && is_float_type(type) == is_float_type(param.type);
+            }
+         } break;
+         case Instruction::SUBROUTINE_JUMP: {
+            ok &= !(instr.is_conditional_jump && is_param(instr.condition.left));
+         } break;
+         case Instruction::FUNC_CALL: {
+            if (is_asm(instr)) {
+               for (auto &p : instr.call_target_params) {
+                  ok &= !is_param(p);
+               }
+            }
+         } break;
+         default: {
+            ok &= !is_param(instr.lvalue_data) && !is_param(instr.rvalue_data);
+         } break;
+      }
+   });
+   return ok;
+}
+
+static void fold_param(Scope &body, const std::string &name, const Variable &value) {
+   for_each_instr(body, [&](Instruction &instr) {
+      for_each_operand(instr, [&](Variable &var) {
+         if (!var.is_type_const && var.name.compare(name) == 0) {
+            var = value;
+         }
+      });
+   });
+}
+
+static void rename(Variable &var, const Rename_Map &names) {
+   auto it = names.find(var.name);
+   if (it != names.end()) {
+      var.name = it->second;
+   }
+}
+
+//a copy of a function body that can sit in another scope, its scopes are new
+static Scope *clone_scope(Scope &scope, Scope *parent, const Rename_Map &names) {
+   Scope *copy = new Scope(parent);
+   copy->variables = scope.variables;
+   copy->profile_id = scope.profile_id;
+   for (auto &var : copy->variables) {
+      rename(var, names);
+   }
+   for (auto &expr : scope.expressions) {
+      Expression e;
+      e.return_value = expr.return_value;
+      e.instructions = expr.instructions;
+      for (auto &instr : e.instructions) {
+         for_each_operand(instr, [&](Variable &var) {
+            rename(var, names);
+         });
+      }
+      e.scope = clone_scope(*expr.scope, copy, names);
+      copy->expressions.push_back(e);
+   }
+   return copy;
+}
+
+static void collect_names(Scope &scope, const std::string &suffix, Rename_Map &names) {
+   for (auto &var : scope.variables) {
+      names[var.name] = var.name + suffix;
+   }
+   for (auto &expr : scope.expressions) {
+      collect_names(*expr.scope, suffix, names);
+   }
+}
+
+//whether name is a local or parameter of func, seen from scope
+static bool is_local(Scope *scope, Function &func, const std::string &name) {
+   for (; scope; scope = scope->parent) {
+      for (auto &var : scope->variables) {
+         if (var.name.compare(name) == 0) {
+            return true;
+         }
+      }
+      if (scope == func.scope) {
+         for (auto &param : func.parameters) {
+            if (param.name.compare(name) == 0) {
+               return true;
+            }
+         }
+         return false;
+      }
+   }
+   return false;
+}
+
+void Whole_Program::
+collect_functions(Scope &scope) {
+   for (auto &func : scope.functions) {
+      if (func.name.compare("__asm__") == 0) {
+         continue;
+      }
+      //the parser leaves this pointing at the copy it built the function in
+      func.scope->function = &func;
+      if (!func.is_not_definition && !func.should_inline) {
+         functions.push_back(&func);
+         nodes[&func];
+      }
+      collect_functions(*func.scope);
+   }
+   for (auto &expr : scope.expressions) {
+      for (auto &instr : expr.instructions) {
+         if (is_asm(instr)) {
+            asm_text.push_back(instr.call_target_params[0].dqstring);
+         }
+      }
+      collect_functions(*expr.scope);
+   }
+}
+
+void Whole_Program::
+collect_calls(Function *caller, Scope &scope) {
+   for (auto &expr : scope.expressions) {
+      for (auto &instr : expr.instructions) {
+         if (instr.type != Instruction::FUNC_CALL || is_asm(instr)) {
+            continue;
+         }
+         Function *callee = expr.scope->getFuncByName(instr.func_call_name);
+         if (!callee || !nodes.count(callee)) {
+            continue; //declared only, it lives outside the program
+         }
+         Call_Node &node = nodes[callee];
+         bool seen = false;
+         //inline functions are expanded by copying expressions, whose scopes are shared
+         for (auto &site : node.sites) {
+            seen |= site.instr == &instr;
+         }
+         if (!seen) {
+            node.sites.push_back({ caller, &instr });
+         }
+         std::vector<Function *> &callees = nodes[caller].callees;
+         if (std::find(callees.begin(), callees.end(), callee) == callees.end()) {
+            callees.push_back(callee);
+         }
+      }
+      collect_calls(caller, *expr.scope);
+   }
+}
+
+void Whole_Program::
+build_call_graph() {
+   functions.clear();
+   nodes.clear();
+   asm_text.clear();
+   collect_functions(*global);
+   for (Function *func : functions) {
+      collect_calls(func, *func->scope);
+   }
+   for (Function *func : functions) {
+      Call_Node &node = nodes[func];
+      node.call_count = node.sites.size();
+      node.is_root = func->scope->parent == global && is_entry_point(func->name);
+      for (auto &text : asm_text) {
+         node.is_root |= mentions(text, func->name);
+      }
+   }
+}
+
+bool Whole_Program::
+reaches(Function *from, Function *to, std::unordered_set<Function *> &seen) {
+   for (Function *callee : nodes[from].callees) {
+      if (callee == to) {
+         return true;
+      }
+      if (seen.insert(callee).second && reaches(callee, to, seen)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+//only the entry points, and what inline asm refers to, are called from outside
+void Whole_Program::
+internalize() {
+   for (Function *func : functions) {
+      func->is_internal = !nodes[func].is_root;
+   }
+}
+
+//a parameter that is the same constant at every call site becomes that constant
+void Whole_Program::
+propagate_constant_args() {
+   for (Function *func : functions) {
+      Call_Node &node = nodes[func];
+      if (!func->is_internal || func->plain_instructions || node.sites.empty() || has_asm(*func->scope)) {
+         continue;
+      }
+      Decl_Types decls;
+      collect_decls(*func->scope, decls);
+      for (auto &param : func->parameters) {
+         add_decl(param, decls);
+      }
+      for (size_t i = 0; i < func->parameters.size(); ++i) {
+         Variable &param = func->parameters[i];
+         bool same = true;
+         for (auto &site : node.sites) {
+            std::vector<Variable> &args = site.instr->call_target_params;
+            same &= args.size() == func->parameters.size() && is_foldable_const(args[i], param)
+               && same_const(args[i], node.sites[0].instr->call_target_params[i]);
+         }
+         if (same && can_fold_param(*func->scope, param, decls, func->return_info.ptype)) {
+            fold_param(*func->scope, param.name, node.sites[0].instr->call_target_params[i]);
+         }
+      }
+   }
+}
+
+//parameters nothing reads are dropped, along with what every call site passes for them
+void Whole_Program::
+eliminate_dead_args() {
+   for (Function *func : functions) {
+      Call_Node &node = nodes[func];
+      if (!func->is_internal || func->plain_instructions || has_asm(*func->scope)) {
+         continue;
+      }
+      bool matches = true;
+      for (auto &site : node.sites) {
+         matches &= site.instr->call_target_params.size() == func->parameters.size();
+      }
+      if (!matches) {
+         continue;
+      }
+      for (size_t i = func->parameters.size(); i-- > 0;) {
+         if (uses(*func->scope, func->parameters[i].name)) {
+            continue;
+         }
+         func->parameters.erase(func->parameters.begin() + i);
+         for (auto &site : node.sites) {
+            std::vector<Variable> &args = site.instr->call_target_params;
+            args.erase(args.begin() + i);
+         }
+      }
+   }
+}
+
+void Whole_Program::
+post_order(Function *func, std::vector<Function *> &order, std::unordered_set<Function *> &seen) {
+   if (!seen.insert(func).second) {
+      return;
+   }
+   for (Function *callee : nodes[func].callees) {
+      post_order(callee, order, seen);
+   }
+   order.push_back(func);
+}
+
+//Only straight-line returns are inlined: a function that returns a value
+//does so once, at the end of its body. Calls in the body have to reach the
+//same functions from the caller and any global it uses can't be hidden by
+//one of the caller's locals.
+bool Whole_Program::
+can_inline(Function &callee, Function &caller, Scope &scope, Instruction *consumer) {
+   if (callee.plain_instructions || caller.plain_instructions || callee.scope->parent != global
+      || callee.return_info.ptype == Variable::FLOAT_32BIT
+      || has_asm(*callee.scope) || has_nested_functions(*callee.scope)) {
+      return false;
+   }
+   for (auto &param : callee.parameters) {
+      if (param.is_vector() || param.type == Variable::DQString) {
+         return false;
+      }
+   }
+   if (consumer && (consumer->lvalue_data.type == Variable::FLOAT_32BIT || consumer->lvalue_data.is_vector()
+      || (consumer->lvalue_data.name.compare("return") == 0
+      && caller.return_info.ptype == Variable::FLOAT_32BIT))) {
+      return false;
+   }
+   std::unordered_set<Function *> seen;
+   if (reaches(&callee, &callee, seen)) {
+      return false;
+   }
+
+   int returns = 0;
+   for_each_instr(*callee.scope, [&](Instruction &instr) {
+      returns += instr.type == Instruction::ASSIGN && instr.lvalue_data.name.compare("return") == 0;
+   });
+   if (callee.return_info.ptype == Variable::VOID) {
+      if (returns) {
+         return false;
+      }
+   } else {
+      std::vector<Expression> &body = callee.scope->expressions;
+      if (returns != 1 || body.empty() || body.back().instructions.empty() || !body.back().scope->empty()
+         || body.back().instructions.back().lvalue_data.name.compare("return") != 0) {
+         return false;
+      }
+   }
+
+   Decl_Types decls;
+   collect_decls(*callee.scope, decls);
+   for (auto &param : callee.parameters) {
+      add_decl(param, decls);
+   }
+   bool ok = true;
+   for_each_instr(*callee.scope, [&](Instruction &instr) {
+      if (instr.type == Instruction::FUNC_CALL) {
+         ok &= scope.getFuncByName(instr.func_call_name) == callee.scope->getFuncByName(instr.func_call_name);
+      }
+      for_each_operand(instr, [&](Variable &var) {
+         if (var.is_type_const || var.name.empty() || var.name.compare("return") == 0 || is_register(var)
+            || decls.count(var.name)) {
+            return;
+         }
+         ok &= !is_local(&scope, caller, var.name);
+      });
+   });
+   return ok;
+}
+
+//Replaces the call at instruction n of expression e with a copy of the
+//callee's body. The expression is split around the call, the copy becomes
+//the scope of its first half, so it runs right after the instructions that
+//came before the call, and the instruction that read the result reads the
+//returned value directly instead.
+bool Whole_Program::
+inline_call(Function &caller, Scope &scope, size_t e, size_t n, long long count) {
+   std::vector<Instruction> &instrs = scope.expressions[e].instructions;
+   Instruction call = instrs[n];
+   if (call.type != Instruction::FUNC_CALL || is_asm(call)) {
+      return false;
+   }
+   Function *callee = scope.expressions[e].scope->getFuncByName(call.func_call_name);
+   if (!callee || !nodes.count(callee) || call.call_target_params.size() != callee->parameters.size()) {
+      return false;
+   }
+   Instruction *consumer = nullptr;
+   if (n + 1 < instrs.size() && instrs[n + 1].rvalue_data.name.compare(REGISTER_RETURN) == 0) {
+      consumer = &instrs[n + 1];
+   }
+   Call_Node &node = nodes[callee];
+   int size = count_instructions(*callee->scope);
+   int limit = INLINE_SIZE;
+   if (profile && count >= 0) {
+      //a call that never ran isn't worth the code, a hot one is worth more
+      limit = count == 0 ? 0 : profile->is_hot(count) ? INLINE_HOT_SIZE : INLINE_SIZE;
+   }
+   if (size > limit && !(callee->is_internal && node.call_count == 1 && size <= INLINE_ONE_SITE_SIZE)) {
+      return false;
+   }
+   if (!can_inline(*callee, caller, scope, consumer)) {
+      return false;
+   }
+
+   std::string suffix = ".i" + std::to_string(++inline_count);
+   Rename_Map names;
+   for (auto &param : callee->parameters) {
+      names[param.name] = param.name + suffix;
+   }
+   collect_names(*callee->scope, suffix, names);
+   Scope *body = clone_scope(*callee->scope, &scope, names);
+
+   Variable result;
+   bool has_result = callee->return_info.ptype != Variable::VOID;
+   if (has_result) {
+      result = body->expressions.back().instructions.back().rvalue_data;
+      body->expressions.back().instructions.pop_back();
+   }
+
+   Decl_Types decls;
+   collect_decls(*body, decls);
+   Expression params;
+   params.scope->parent = body;
+   std::vector<Variable> param_vars;
+   for (size_t i = 0; i < callee->parameters.size(); ++i) {
+      Variable param = callee->parameters[i];
+      param.name = names[param.name];
+      add_decl(param, decls);
+      param_vars.push_back(param);
+   }
+   for (size_t i = 0; i < param_vars.size(); ++i) {
+      Variable &param = param_vars[i];
+      Variable &arg = call.call_target_params[i];
+      bool result_ok = !has_result || result.is_type_const || result.name.compare(param.name) != 0
+         || !is_float_type(param.type);
+      if (is_foldable_const(arg, param) && result_ok
+         && can_fold_param(*body, param, decls, callee->return_info.ptype)) {
+         fold_param(*body, param.name, arg);
+         if (has_result && !result.is_type_const && result.name.compare(param.name) == 0) {
+            result = arg;
+         }
+         continue;
+      }
+      body->variables.push_back(param);
+      Instruction init;
+      init.type = Instruction::ASSIGN;
+      init.lvalue_data = param;
+      init.lvalue_data.type = Variable::POINTER;
+      init.rvalue_data = arg;
+      params.instructions.push_back(init);
+   }
+   if (params.instructions.size()) {
+      body->expressions.insert(body->expressions.begin(), params);
+   }
+
+   size_t rest_start = n + 1;
+   if (consumer) {
+      Instruction read = *consumer;
+      if (has_result) {
+         read.rvalue_data = result;
+      }
+      if (body->expressions.empty()) {
+         body->expressions.push_back(Expression());
+         body->expressions.back().scope->parent = body;
+      }
+      body->expressions.back().instructions.push_back(read);
+      ++rest_start;
+   }
+
+   //the body's calls are the caller's now
+   --node.call_count;
+   for_each_instr(*body, [&](Instruction &instr) {
+      if (instr.type == Instruction::FUNC_CALL && !is_asm(instr)) {
+         Function *func = body->getFuncByName(instr.func_call_name);
+         if (func && nodes.count(func)) {
+            ++nodes[func].call_count;
+         }
+      }
+   });
+
+   Expression rest;
+   rest.scope->parent = &scope;
+   rest.instructions.assign(instrs.begin() + rest_start, instrs.end());
+   instrs.erase(instrs.begin() + n, instrs.end());
+   scope.expressions[e].scope = body;
+   if (rest.instructions.size()) {
+      scope.expressions.insert(scope.expressions.begin() + e + 1, rest);
+   }
+   return true;
+}
+
+//count is how often the scope's code ran, -1 without a profile
+void Whole_Program::
+inline_calls(Function &caller, Scope &scope, long long count) {
+   for (size_t e = 0; e < scope.expressions.size(); ++e) {
+      Scope &inner = *scope.expressions[e].scope;
+      if (!inner.empty()) {
+         long long inner_count = count;
+         if (profile && inner.is_loop()) {
+            inner_count = profile->iterations(inner);
+         } else if (profile && inner.profile_id >= 0) {
+            inner_count = profile->entries(inner); //an inlined copy
+         }
+         inline_calls(caller, inner, inner_count);
+         continue;
+      }
+      //once the call is replaced, the rest of the expression is the next one
+      for (size_t n = 0; n < scope.expressions[e].instructions.size(); ++n) {
+         if (inline_call(caller, scope, e, n, count)) {
+            break;
+         }
+      }
+   }
+}
+
+void Whole_Program::
+mark_reachable(Function *func) {
+   Call_Node &node = nodes[func];
+   if (node.is_reachable) {
+      return;
+   }
+   node.is_reachable = true;
+   for (Function *callee : node.callees) {
+      mark_reachable(callee);
+   }
+}
+
+//an internal function nothing calls anymore is left undefined, like a prototype
+void Whole_Program::
+remove_unreachable() {
+   for (Function *func : functions) {
+      if (nodes[func].is_root) {
+         mark_reachable(func);
+      }
+   }
+   for (Function *func : functions) {
+      if (func->is_internal && !nodes[func].is_reachable) {
+         func->is_not_definition = true;
+      }
+   }
+}
+
+void Whole_Program::
+optimize(Scope &scope) {
+   global = &scope;
+   build_call_graph();
+   bool has_entry = false;
+   for (Function *func : functions) {
+      has_entry |= nodes[func].is_root;
+   }
+   if (!has_entry) {
+      printf("-fwhole-program: no entry point, every function stays visible\n");
+      return;
+   }
+   internalize();
+   propagate_constant_args();
+   eliminate_dead_args();
+
+   //callees first, so what gets copied into a caller is already inlined into
+   std::vector<Function *> order;
+   std::unordered_set<Function *> seen;
+   for (Function *func : functions) {
+      post_order(func, order, seen);
+   }
+   for (Function *func : order) {
+      inline_calls(*func, *func->scope, profile ? profile->entries(*func->scope) : -1);
+   }
+
+   build_call_graph();
+   remove_unreachable();
+}
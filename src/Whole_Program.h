@@ -0,0 +1,61 @@
+
+#ifndef WHOLE_PROGRAM_H
+#define WHOLE_PROGRAM_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Code_Structure.h"
+#include "Profile.h"
+
+//where a linked program starts, nothing in it calls these
+bool is_entry_point(const std::string &name);
+
+//Interprocedural optimization for -fwhole-program.
+//Everything reached through import is parsed into the one global Scope and
+//binaries are linked statically, so nothing outside of it calls in except at
+//the entry points. Every other function is made internal, after which its
+//parameter list can change along with its call sites, and anything left
+//uncalled once small callees are inlined isn't emitted at all.
+struct Whole_Program {
+   struct Call_Site {
+      Function *caller;
+      Instruction *instr;
+   };
+
+   struct Call_Node {
+      std::vector<Call_Site> sites; //calls to the function
+      std::vector<Function *> callees;
+      int call_count = 0; //sites, kept up to date while inlining
+      bool is_root = false;
+      bool is_reachable = false;
+   };
+
+   Scope *global = nullptr;
+   std::vector<Function *> functions; //definitions in program order
+   std::unordered_map<Function *, Call_Node> nodes;
+   std::vector<std::string> asm_text;
+   int inline_count = 0;
+   Profile *profile = nullptr; //counts from -fprofile-use, if any
+
+   void optimize(Scope &scope);
+
+private:
+   void collect_functions(Scope &scope);
+   void collect_calls(Function *caller, Scope &scope);
+   void build_call_graph();
+   bool reaches(Function *from, Function *to, std::unordered_set<Function *> &seen);
+   void internalize();
+   void propagate_constant_args();
+   void eliminate_dead_args();
+   void post_order(Function *func, std::vector<Function *> &order, std::unordered_set<Function *> &seen);
+   bool can_inline(Function &callee, Function &caller, Scope &scope, Instruction *consumer);
+   bool inline_call(Function &caller, Scope &scope, size_t e, size_t n, long long count);
+   void inline_calls(Function &caller, Scope &scope, long long count);
+   void mark_reachable(Function *func);
+   void remove_unreachable();
+};
+
+#endif
@@ -1,6 +1,11 @@
 
 #include <cstdio>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include <string>
 #include <fstream>
 #include <streambuf>
@@ -12,6 +17,9 @@
 #include "Code_Gen.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "Whole_Program.h"
+#include "Profile.h"
+#include "Function_Layout.h"
 #include "common.h"
 
 Function::
@@ -91,96 +99,313 @@ std::vector<char> load_bin_file(const std::string pathname) {
 
 
 #include "Gen_386.h"
+#include "Gen_X64.h"
 #include "Gen_ARM.h"
+#include "Asm_386.h"
+#include "Elf_Linker.h"
 #include "Target.h"
 #include "common.h"
 
 Target *target = NULL;
+static bool omit_frame_pointer = true;
+static bool pic = true;
+static bool hard_float = false;
+static bool integrated_as = true;
+static bool run_program = false;
+static bool whole_program = false;
+static bool use_profile = false;
+static int reorder_functions = -1; //unless given, only with a profile
+static Profile profile;
 std::string ident_str = "HTN (alpha development build) " + STRING(BRANCH_COMMIT);
 
-static void generate_386(Scope &scope, std::ostream &os) {
-   os << target->as_text_section() << std::endl;
+static void gen_literals(Code_Gen &gen, Asm_Buf &os) {
+   if (gen.has_literals(4)) {
+      os << target->as_literal4_section() << '\n';
+      gen.gen_literals(4);
+   }
+   if (gen.has_literals(16)) {
+      os << target->as_literal16_section() << '\n';
+      gen.gen_literals(16);
+   }
+}
+
+//after the code and before rodata, a pointer's initializer can be a string
+static void gen_globals(Code_Gen &gen, Asm_Buf &os) {
+   if (gen.has_globals(true)) {
+      os << target->as_data_section() << '\n';
+      gen.gen_globals(true);
+   }
+   if (gen.has_globals(false)) {
+      os << target->as_bss_section() << '\n';
+      gen.gen_globals(false);
+   }
+}
+
+static void generate_386(Scope &scope, std::ostream &out) {
+   Asm_Buf os(out.rdbuf());
+   os << target->as_text_section() << '\n';
    Gen_386 g386 = Gen_386(os);
+   g386.omit_frame_pointer = omit_frame_pointer;
+   g386.pic = pic;
+   g386.text_section = target->as_text_section();
+   g386.cold_text_section = target->as_cold_text_section();
+   if (profile.instrument || use_profile) {
+      g386.profile = &profile;
+   }
    g386.gen_scope(scope);
+   if (profile.instrument) {
+      g386.gen_profile_exit();
+   }
+   gen_globals(g386, os);
 
-   os << target->as_rodata_section() << std::endl;
+   os << target->as_cstring_section() << '\n';
    g386.gen_rodata();
-   os << "\t.ident\t\"" << ident_str << "\"" << std::endl;
+   gen_literals(g386, os);
+   os << "\t.ident\t\"" << ident_str << "\"" << '\n';
 }
 
-static void generate_arm(Scope &scope, std::ostream &os) {
-   os << "\t.arch armv5te\n\t.fpu softvfp" << std::endl;
-   os << "\t.thumb" << std::endl;
+static void generate_x64(Scope &scope, std::ostream &out) {
+   Asm_Buf os(out.rdbuf());
+   os << target->as_text_section() << '\n';
+   Gen_X64 gX64 = Gen_X64(os);
+   gX64.omit_frame_pointer = omit_frame_pointer;
+   gX64.text_section = target->as_text_section();
+   gX64.cold_text_section = target->as_cold_text_section();
+   if (profile.instrument || use_profile) {
+      gX64.profile = &profile;
+   }
+   gX64.gen_scope(scope);
+   if (profile.instrument) {
+      gX64.gen_profile_exit();
+   }
+   gen_globals(gX64, os);
+
+   os << target->as_cstring_section() << '\n';
+   gX64.gen_rodata();
+   gen_literals(gX64, os);
+   os << "\t.ident\t\"" << ident_str << "\"" << '\n';
+}
+
+static void generate_arm(Scope &scope, std::ostream &out) {
+   Asm_Buf os(out.rdbuf());
+   if (hard_float) {
+      //VFP instructions need Thumb-2
+      os << "\t.syntax unified\n\t.arch armv7-a\n\t.fpu neon" << '\n';
+   } else {
+      os << "\t.arch armv5te\n\t.fpu softvfp" << '\n';
+   }
+   os << "\t.thumb" << '\n';
    os << "\t.eabi_attribute 23, 1\n"
       "\t.eabi_attribute 24, 1\n"
       "\t.eabi_attribute 25, 1\n"
       "\t.eabi_attribute 26, 1\n"
       "\t.eabi_attribute 30, 2\n"
       "\t.eabi_attribute 34, 0\n"
-      "\t.eabi_attribute 18, 4" << std::endl;
-   os << "\t" << target->as_text_section() << std::endl;
-   Gen_ARM gARM = Gen_ARM(os);
+      "\t.eabi_attribute 18, 4" << '\n';
+   if (hard_float) {
+      os << "\t.eabi_attribute 28, 1" << '\n'; //arguments in VFP registers
+   }
+   os << "\t" << target->as_text_section() << '\n';
+   Gen_ARM gARM = Gen_ARM(os, hard_float);
+   gARM.text_section = target->as_text_section();
+   gARM.cold_text_section = target->as_cold_text_section();
+   if (profile.instrument || use_profile) {
+      gARM.profile = &profile;
+   }
    gARM.gen_scope(scope);
+   if (profile.instrument) {
+      gARM.gen_profile_exit();
+   }
+   gen_globals(gARM, os);
 
-   os << target->as_rodata_section() << std::endl;
+   os << target->as_cstring_section() << '\n';
    gARM.gen_rodata();
-   os << "\t.ident\t\"" << ident_str << "\"" << std::endl;
+   gen_literals(gARM, os);
+   os << "\t.ident\t\"" << ident_str << "\"" << '\n';
 }
 
 #include <fstream>
 #include <string>
 #include <stdio.h>
 #include <sstream>
+#include <functional>
 
-
-
-std::string exec(std::string cmd) {
-    printf("%s\n", cmd.c_str());
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) return "ERROR";
-    char buffer[128];
-    std::string result = "";
-    while(!feof(pipe)) {
-    	if(fgets(buffer, 128, pipe) != NULL)
-    		result += buffer;
-    }
-    pclose(pipe);
-    return result;
-}
-
+#include "Process.h"
 
 static std::string output_file;
 bool no_link = false;
 static std::string link_options = "";
 bool no_del_s = false;
+static std::string object_file; //what the assembler writes, removed after linking
+
+//Links the object with Elf_Linker when every other input is an object or
+//archive it can read, options like -l need ld and its search paths.
+static bool link_in_process(const Elf_Object &obj, const std::string &name) {
+   Elf_Linker linker;
+   linker.add_object(obj, name);
+   std::stringstream inputs(link_options);
+   std::string input;
+   while (inputs >> input) {
+      if (input[0] == '-') {
+         return false;
+      }
+      if (!linker.add_file(input)) {
+         break;
+      }
+   }
+   if (linker.error.empty() && linker.link(output_file)) {
+      return true;
+   }
+   printf("built-in linker: %s, using %s\n", linker.error.c_str(), target->get_target_ld().c_str());
+   return false;
+}
 
+static void set_output_files(const std::string &asm_path) {
+   std::string out(asm_path);
+   out.replace(out.rfind(".s"), 2, ".o");
+   if (output_file.compare("") == 0) {
+      output_file = out;
+      if (!no_link) {
+         output_file.replace(output_file.rfind(".o"), 2, "");
+      }
+   }
+   object_file = (no_link ? output_file : out);
+}
 
-#include <cstdio>
+static int link_with_ld() {
+   std::string _static = "";
+   if (link_options.size() == 0) {
+      _static = "-static ";
+   }
+   Process ld;
+   if (!ld.spawn(split_command(target->get_target_ld() + " " + _static + target->link_ops() + " -o "
+      + output_file + " " + object_file + " " + link_options))) {
+      return -1;
+   }
+   int status = ld.wait();
+   remove(object_file.c_str());
+   return status;
+}
 
-void assemble(std::string path_str) {
-   std::string out(path_str);
-   out.replace(out.rfind(".s"), 2, ".o");
-   if (no_link) {
-      if (output_file.compare("") == 0) {
-         output_file = out;
+//The built-in assembler and linker work straight from the generated text,
+//the .s and .o files only go to disk when asked for. Returns false when the
+//text has to go through the target's as instead.
+static bool assemble_in_process(const std::string &asm_path, const std::string &asm_text, int &status) {
+   Asm_386 as386;
+   if (!as386.assemble(asm_text)) {
+      printf("built-in assembler: %s, using %s\n", as386.error.c_str(), target->get_target_as().c_str());
+      return false;
+   }
+   if (no_del_s) {
+      std::ofstream ofs(asm_path);
+      ofs << asm_text;
+   }
+   status = 0;
+   if (!no_link && link_in_process(as386.obj, object_file)) {
+      return true;
+   }
+   if (!as386.obj.write(object_file, ELF_EM_386)) {
+      printf("can't write %s\n", object_file.c_str());
+      status = -1;
+      return true;
+   }
+   if (!no_link) {
+      status = link_with_ld();
+   }
+   return true;
+}
+
+//Otherwise as is started first and reads the assembly from a pipe while
+//it is being generated, with a copy going to the .s file for -S.
+static int assemble_streaming(const std::string &asm_path, std::function<void(std::ostream &)> generate) {
+   Process as;
+   bool spawned = as.spawn(split_command(target->get_target_as() + target->arch_flag() + " -g -o " + object_file), true);
+   if (!spawned && !no_del_s) {
+      return -1;
+   }
+   {
+      Fd_Buf pipe_buf(as.stdin_fd);
+      std::ofstream s_file;
+      if (no_del_s) {
+         s_file.open(asm_path);
       }
-      std::cout << exec(std::string(target->get_target_as() + target->arch_flag() + " -g -o ") + output_file + " " + path_str) << std::endl;
-   } else {
-      std::cout << exec(std::string(target->get_target_as() + target->arch_flag() + " -g -o ") + out + " " + path_str) << std::endl;
-      if (output_file.compare("") == 0) {
-         output_file = out;
-         output_file.replace(output_file.rfind(".o"), 2, "");
+      Tee_Buf tee(&pipe_buf, s_file.rdbuf());
+      std::streambuf *buf = &pipe_buf;
+      if (no_del_s) {
+         buf = spawned ? (std::streambuf *)&tee : s_file.rdbuf();
       }
-      std::string _static = "";
-      if (link_options.size() == 0) {
-         _static = "-static ";
+      std::ostream os(buf);
+      generate(os);
+      os.flush();
+   }
+   if (as.wait() != 0) {
+      return -1;
+   }
+   return no_link ? 0 : link_with_ld();
+}
+
+//entry code for --run when the program has no _start, main's result is the exit status
+static const char *run_start_stub =
+   ".text\n"
+   ".globl _start\n"
+   "_start:\n"
+   "\tcall main\n"
+   "\tmovl %eax, %ebx\n"
+   "\tmovl $1, %eax\n"
+   "\tint $0x80\n";
+
+//the same, with -fprofile-generate the counters are written out on the way
+static const char *run_profile_start_stub =
+   ".text\n"
+   ".globl _start\n"
+   "_start:\n"
+   "\tcall main\n"
+   "\tpush %eax\n"
+   "\tcall __htn_profile_exit\n";
+
+//--run assembles and links the program in memory and executes it from an
+//anonymous file, htn replaces itself with the program. Nothing is written
+//to disk and no other process is started.
+static int run(const std::string &asm_text, const std::string &name) {
+   Asm_386 as386;
+   if (!as386.assemble(asm_text)) {
+      printf("--run: %s\n", as386.error.c_str());
+      return -1;
+   }
+   Elf_Linker linker;
+   linker.add_object(as386.obj, name);
+   std::string libhtn = prefix_dir + "lib/libhtn.a";
+   std::stringstream inputs(link_options + (file_exists(libhtn) ? libhtn : ""));
+   std::string input;
+   while (inputs >> input) {
+      if (input[0] == '-') {
+         printf("--run: can't link with %s\n", input.c_str());
+         return -1;
+      }
+      if (!linker.add_file(input)) {
+         break;
       }
-      std::cout << exec(std::string(target->get_target_ld() + " " + _static + target->link_ops()  +  " " + " -o ") + output_file + " " + out + " " + link_options) << std::endl;
-      remove(out.c_str());
    }
-   if (!no_del_s) {
-      remove(path_str.c_str());
+   std::vector<uint8_t> image;
+   if (!linker.error.empty() || !linker.link_image(image)) {
+      printf("--run: %s\n", linker.error.c_str());
+      return -1;
    }
+#ifdef __linux__
+   int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+   if (fd < 0 || write(fd, image.data(), image.size()) != (ssize_t)image.size()) {
+      perror("--run");
+      return -1;
+   }
+   fflush(stdout);
+   std::cout.flush();
+   char *args[] = { (char *)name.c_str(), nullptr };
+   fexecve(fd, args, environ);
+   perror("--run");
+#else
+   printf("--run is only supported on Linux hosts\n");
+#endif
+   return -1;
 }
 
 static void print_usage() {
@@ -190,6 +415,15 @@ static void print_usage() {
    printf("  --target <sys>  Specifies the CPU/OS to compile to.\n");
    printf("  -o       <out>  Specify file for output\n");
    printf("  -c              Stop after compilation, does not invoke linker\n");
+   printf("  --run           Compile, link and run the program in memory, i386-linux-gnu only\n");
+   printf("  -fno-omit-frame-pointer  Keep a frame pointer in every function, for debugging\n");
+   printf("  -fno-pic        Address rodata absolutely, for static executables\n");
+   printf("  -fwhole-program  Optimize across functions, only the entry points stay visible outside\n");
+   printf("  -fprofile-generate[=<file>]  Count what runs and write the counts to <file>, <source>.prof by default\n");
+   printf("  -fprofile-use[=<file>]  Optimize for the counts an instrumented build wrote\n");
+   printf("  -freorder-functions  Lay out callers next to their callees and cold functions apart, default with -fprofile-use\n");
+   printf("  -mfloat-abi=<abi>  ARM only, 'hard' keeps floats in VFP registers, 'soft' (default) in integer registers\n");
+   printf("  -fno-integrated-as  Always run the target's as instead of the built-in i386 assembler\n");
 }
 
 int main(int argc, char** argv) {
@@ -199,14 +433,51 @@ int main(int argc, char** argv) {
    }
 
    std::string def_tar = STRING(DEFAULT_TARGET);
+   bool target_given = false;
 
    std::string source_path;
    for (int i = 1; i < argc; ++i) {
       std::string arch = argv[i];
       if (arch.compare("-c") == 0) {
          no_link = true;
+      } else if (arch.compare("--run") == 0) {
+         run_program = true;
       } else if (arch.compare("-S") == 0) {
          no_del_s = true;
+      } else if (arch.compare("-fno-omit-frame-pointer") == 0) {
+         omit_frame_pointer = false;
+      } else if (arch.compare("-fomit-frame-pointer") == 0) {
+         omit_frame_pointer = true;
+      } else if (arch.compare("-fno-pic") == 0) {
+         pic = false;
+      } else if (arch.compare("-fpic") == 0) {
+         pic = true;
+      } else if (arch.compare("-fno-integrated-as") == 0) {
+         integrated_as = false;
+      } else if (arch.compare("-fintegrated-as") == 0) {
+         integrated_as = true;
+      } else if (arch.compare("-fwhole-program") == 0) {
+         whole_program = true;
+      } else if (arch.compare("-fno-whole-program") == 0) {
+         whole_program = false;
+      } else if (arch.compare("-freorder-functions") == 0) {
+         reorder_functions = 1;
+      } else if (arch.compare("-fno-reorder-functions") == 0) {
+         reorder_functions = 0;
+      } else if (arch.compare(0, 18, "-fprofile-generate") == 0) {
+         profile.instrument = true;
+         if (arch.size() > 19 && arch[18] == '=') {
+            profile.path = arch.substr(19);
+         }
+      } else if (arch.compare(0, 13, "-fprofile-use") == 0) {
+         use_profile = true;
+         if (arch.size() > 14 && arch[13] == '=') {
+            profile.path = arch.substr(14);
+         }
+      } else if (arch.compare("-mfloat-abi=hard") == 0) {
+         hard_float = true;
+      } else if (arch.compare("-mfloat-abi=soft") == 0 || arch.compare("-mfloat-abi=softfp") == 0) {
+         hard_float = false;
       } else if (arch.compare(0, 2, "-I") == 0) {
          std::string include_path = arch.substr(2);
          printf("New include path: %s\n", include_path.c_str());
@@ -225,6 +496,7 @@ int main(int argc, char** argv) {
             return -1;
          }
          def_tar = argv[i];
+         target_given = true;
          std::cout << "New target: " << def_tar << std::endl;
       } else if (arch.compare(0, 2, "-l") == 0) {
          link_options += arch + " ";
@@ -245,6 +517,9 @@ int main(int argc, char** argv) {
          source_path = argv[i];
       }
    }
+   if (run_program && !target_given) {
+      def_tar = "i386-linux-gnu"; //the only target built entirely in process
+   }
    prefix_dir += def_tar + "/";
    if (def_tar.find("darwin") != std::string::npos) {
       target = new Target_Apple(def_tar);
@@ -263,19 +538,68 @@ int main(int argc, char** argv) {
    if (error_count) {
       return -1;
    }
+   //numbered before anything is inlined, so every build finds the same counters
+   if (profile.instrument || use_profile) {
+      if (profile.path.empty()) {
+         profile.path = source_path.substr(0, source_path.rfind(".htn")) + ".prof";
+      }
+      profile.open_flags = target->open_write_flags();
+      profile.number_scopes(scope);
+      if (profile.instrument) {
+         use_profile = false; //a build can't be counted and optimized by its counts at once
+      } else if (!profile.load()) {
+         use_profile = false;
+      }
+   }
+   if (whole_program) {
+      Whole_Program wp;
+      if (use_profile) {
+         wp.profile = &profile;
+      }
+      wp.optimize(scope);
+   }
+   if (reorder_functions == 1 || (reorder_functions < 0 && use_profile)) {
+      Function_Layout layout;
+      if (use_profile) {
+         layout.profile = &profile;
+      }
+      layout.arrange(scope);
+   }
    source_path.replace(source_path.rfind(".htn"), std::string::npos, ".s");
-   std::ofstream ofs(source_path);
-   if (target->get_target_cpu() == Target::X86) {
-      generate_386(scope, ofs);
-      ofs.close();
-      assemble(source_path);
-   } else if (target->get_target_cpu() == Target::ARM) {
-      generate_arm(scope, ofs);
-      ofs.close();
-      assemble(source_path);
-   } else {
+   set_output_files(source_path);
+   Target::TARGET_CPU cpu = target->get_target_cpu();
+   if (cpu == Target::UNKNOWN) {
       std::cout << "Invalid target triple: " << target->target_triple << std::endl;
+      return 0;
    }
-
-   return 0;
+   std::stringstream asm_text;
+   if (run_program) {
+      if (target->get_target_cpu() != Target::X86 || !target->has_integrated_as()) {
+         std::cout << "--run needs the i386-linux-gnu target" << std::endl;
+         return -1;
+      }
+      generate_386(scope, asm_text);
+      if (!scope.getFuncByName("_start")) {
+         asm_text << (profile.instrument ? run_profile_start_stub : run_start_stub);
+      }
+      return run(asm_text.str(), source_path.substr(0, source_path.rfind(".s")));
+   }
+   if (cpu == Target::X86 && integrated_as && target->has_integrated_as()) {
+      generate_386(scope, asm_text);
+      int status;
+      if (assemble_in_process(source_path, asm_text.str(), status)) {
+         return status;
+      }
+   }
+   return assemble_streaming(source_path, [&](std::ostream &os) {
+      if (asm_text.tellp() > 0) {
+         os << asm_text.str();
+      } else if (cpu == Target::X86) {
+         generate_386(scope, os);
+      } else if (cpu == Target::X64) {
+         generate_x64(scope, os);
+      } else {
+         generate_arm(scope, os);
+      }
+   });
 }